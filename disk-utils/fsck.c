@@ -1202,48 +1202,337 @@ static int count_slaves(dev_t disk)
 }
 
 /*
- * Returns TRUE if a partition on the same disk is already being
- * checked.
+ * Job scheduler for check_all().
+ *
+ * The dependencies are evaluated only once: the jobs are sorted by pass
+ * number (a pass starts when all jobs from the previous one are finished),
+ * every job occupies its whole disk and a stacked device (MD, DM, ...)
+ * also occupies all the disks it's built on. A job on unknown disk is
+ * never checked in parallel with another job.
+ *
+ * From the jobs that can run, the one on the disk with the most remaining
+ * work in the pass is started first, and the biggest filesystem on the
+ * disk is preferred. The work is estimated from the filesystem size,
+ * rotational disks are expected to be FSCK_ROTATIONAL_COST times slower.
  */
-static int disk_already_active(struct libmnt_fs *fs)
+#define FSCK_ROTATIONAL_COST	4
+
+struct fsck_disk {
+	dev_t		devno;
+	uint64_t	cost;		/* 1 or FSCK_ROTATIONAL_COST */
+	uint64_t	remaining;	/* weight of not started jobs in the pass */
+	unsigned int	busy;		/* number of running jobs */
+};
+
+struct fsck_job {
+	struct libmnt_fs *fs;
+	size_t		order;		/* position in fstab */
+	int		passno;
+	uint64_t	weight;
+
+	size_t		*disks;		/* indexes to fsck_sched->disks */
+	size_t		ndisks;
+
+	unsigned int	exclusive:1,
+			started:1,
+			finished:1;
+};
+
+struct fsck_sched {
+	struct fsck_job	*jobs;
+	size_t		njobs;
+
+	struct fsck_disk *disks;
+	size_t		ndisks;
+
+	size_t		nrunning;	/* started and not finished jobs */
+	size_t		nexclusive;	/* running exclusive jobs */
+};
+
+static uint64_t get_device_sectors(dev_t devno)
 {
-	struct fsck_instance *inst;
-	dev_t disk;
+	char path[PATH_MAX];
+	uint64_t x = 0;
+	FILE *f;
 
-	if (force_all_parallel)
+	snprintf(path, sizeof(path), "/sys/dev/block/%u:%u/size",
+			major(devno), minor(devno));
+	f = fopen(path, "r" UL_CLOEXECSTR);
+	if (!f)
 		return 0;
+	if (fscanf(f, "%" SCNu64, &x) != 1)
+		x = 0;
+	fclose(f);
+	return x;
+}
 
-	if (instance_list && fs_is_stacked(instance_list->fs))
-		/* any instance for a stacked device is already running */
-		return 1;
+static size_t sched_get_disk(struct fsck_sched *sc, dev_t devno)
+{
+	struct fsck_disk *d;
+	size_t i;
+
+	for (i = 0; i < sc->ndisks; i++) {
+		if (sc->disks[i].devno == devno)
+			return i;
+	}
+
+	if (sc->ndisks % 16 == 0)
+		sc->disks = xrealloc(sc->disks,
+				(sc->ndisks + 16) * sizeof(struct fsck_disk));
+	d = &sc->disks[sc->ndisks];
+	memset(d, 0, sizeof(*d));
+	d->devno = devno;
+	d->cost = is_irrotational_disk(devno) ? 1 : FSCK_ROTATIONAL_COST;
+
+	return sc->ndisks++;
+}
+
+static size_t job_add_disk(struct fsck_sched *sc, struct fsck_job *job, dev_t devno)
+{
+	size_t i, idx = sched_get_disk(sc, devno);
+
+	for (i = 0; i < job->ndisks; i++) {
+		if (job->disks[i] == idx)
+			return idx;
+	}
+	job->disks = xrealloc(job->disks, (job->ndisks + 1) * sizeof(size_t));
+	job->disks[job->ndisks++] = idx;
+	return idx;
+}
+
+/*
+ * Adds the whole disks below the stacked @disk to the job. Returns non-zero
+ * if the topology cannot be read.
+ */
+static int job_add_stacked_disks(struct fsck_sched *sc, struct fsck_job *job,
+				 dev_t disk, int depth)
+{
+	char dirname[64];
+	struct dirent *dp;
+	DIR *dir;
+	int rc = 0;
+
+	if (depth > 8)
+		return -1;
+
+	snprintf(dirname, sizeof(dirname), "/sys/dev/block/%u:%u/slaves",
+			major(disk), minor(disk));
+	if (!(dir = opendir(dirname)))
+		return -1;
+
+	while ((dp = readdir(dir)) != NULL) {
+		char path[PATH_MAX];
+		unsigned int maj, min;
+		dev_t whole = 0;
+		FILE *f;
+		int n;
+
+		if (dp->d_name[0] == '.')
+			continue;
+
+		snprintf(path, sizeof(path), "%s/%s/dev", dirname, dp->d_name);
+		f = fopen(path, "r" UL_CLOEXECSTR);
+		if (!f) {
+			rc = -1;
+			continue;
+		}
+		n = fscanf(f, "%u:%u", &maj, &min);
+		fclose(f);
+		if (n != 2) {
+			rc = -1;
+			continue;
+		}
+
+		if (blkid_devno_to_wholedisk(makedev(maj, min), NULL, 0, &whole) || !whole)
+			whole = makedev(maj, min);
+
+		job_add_disk(sc, job, whole);
+		if (count_slaves(whole) > 0
+		    && job_add_stacked_disks(sc, job, whole, depth + 1) != 0)
+			rc = -1;
+	}
+
+	closedir(dir);
+	return rc;
+}
+
+static void sched_add_job(struct fsck_sched *sc, struct libmnt_fs *fs)
+{
+	struct fsck_job *job;
+	const char *device;
+	struct stat st;
+	uint64_t size = 0;
+	size_t idx;
+	dev_t disk;
+
+	if (sc->njobs % 32 == 0)
+		sc->jobs = xrealloc(sc->jobs,
+				(sc->njobs + 32) * sizeof(struct fsck_job));
+	job = &sc->jobs[sc->njobs];
+	memset(job, 0, sizeof(*job));
+	job->fs = fs;
+	job->order = sc->njobs++;
+	job->passno = mnt_fs_get_passno(fs);
+
+	device = fs_get_device(fs);
+	if (device && stat(device, &st) == 0 && S_ISBLK(st.st_mode))
+		size = get_device_sectors(st.st_rdev);
 
 	disk = fs_get_disk(fs, 1);
+	if (!disk) {
+		job->weight = size * FSCK_ROTATIONAL_COST;
+		job->exclusive = force_all_parallel ? 0 : 1;
+		return;
+	}
 
-	/*
-	 * If we don't know the base device, assume that the device is
-	 * already active if there are any fsck instances running.
-	 *
-	 * Don't check a stacked device with any other disk too.
-	 */
-	if (!disk || fs_is_stacked(fs))
-		return (instance_list != NULL);
+	idx = job_add_disk(sc, job, disk);
+	job->weight = size * sc->disks[idx].cost;
 
-	for (inst = instance_list; inst; inst = inst->next) {
-		dev_t idisk = fs_get_disk(inst->fs, 0);
+	if (fs_is_stacked(fs) && !force_all_parallel
+	    && job_add_stacked_disks(sc, job, disk, 0) != 0)
+		job->exclusive = 1;
+}
+
+static int cmp_jobs(const void *a, const void *b)
+{
+	const struct fsck_job *x = a, *y = b;
+
+	if (x->passno != y->passno)
+		return x->passno < y->passno ? -1 : 1;
+	return x->order < y->order ? -1 : x->order > y->order ? 1 : 0;
+}
+
+static void sched_free(struct fsck_sched *sc)
+{
+	size_t i;
+
+	for (i = 0; i < sc->njobs; i++)
+		free(sc->jobs[i].disks);
+	free(sc->jobs);
+	free(sc->disks);
+}
+
+/* remaining work of the most loaded disk used by the job */
+static uint64_t job_get_remaining(struct fsck_sched *sc, struct fsck_job *job)
+{
+	uint64_t rem = job->weight;
+	size_t i;
 
-		if (!idisk || disk == idisk)
+	for (i = 0; i < job->ndisks; i++)
+		rem = max(rem, sc->disks[job->disks[i]].remaining);
+	return rem;
+}
+
+static int job_is_blocked(struct fsck_sched *sc, struct fsck_job *job)
+{
+	size_t i;
+
+	if (force_all_parallel)
+		return 0;
+	if (sc->nexclusive)
+		return 1;
+	if (job->exclusive)
+		return sc->nrunning != 0;
+
+	for (i = 0; i < job->ndisks; i++) {
+		if (sc->disks[job->disks[i]].busy)
 			return 1;
 	}
-
 	return 0;
 }
 
+/* returns the best job from the pass in [begin, end) which can be started now */
+static struct fsck_job *sched_next_job(struct fsck_sched *sc, size_t begin, size_t end)
+{
+	struct fsck_job *best = NULL;
+	uint64_t best_rem = 0;
+	size_t i;
+
+	for (i = begin; i < end; i++) {
+		struct fsck_job *job = &sc->jobs[i];
+		uint64_t rem;
+
+		if (job->started || job_is_blocked(sc, job))
+			continue;
+		if (serialize)
+			return job;	/* keep fstab order */
+
+		rem = job_get_remaining(sc, job);
+		if (!best || rem > best_rem
+		    || (rem == best_rem && job->weight > best->weight)) {
+			best = job;
+			best_rem = rem;
+		}
+	}
+	return best;
+}
+
+static void sched_start_pass(struct fsck_sched *sc, size_t begin, size_t end)
+{
+	size_t i, n;
+
+	for (i = 0; i < sc->ndisks; i++)
+		sc->disks[i].remaining = 0;
+
+	for (i = begin; i < end; i++) {
+		struct fsck_job *job = &sc->jobs[i];
+
+		for (n = 0; n < job->ndisks; n++)
+			sc->disks[job->disks[n]].remaining += job->weight;
+	}
+}
+
+static void sched_start_job(struct fsck_sched *sc, struct fsck_job *job)
+{
+	size_t i;
+
+	job->started = 1;
+	sc->nrunning++;
+	if (job->exclusive)
+		sc->nexclusive++;
+
+	for (i = 0; i < job->ndisks; i++) {
+		struct fsck_disk *d = &sc->disks[job->disks[i]];
+
+		d->busy++;
+		d->remaining -= job->weight;
+	}
+}
+
+static void sched_finish_job(struct fsck_sched *sc, struct fsck_job *job)
+{
+	size_t i;
+
+	job->finished = 1;
+	sc->nrunning--;
+	if (job->exclusive)
+		sc->nexclusive--;
+
+	for (i = 0; i < job->ndisks; i++)
+		sc->disks[job->disks[i]].busy--;
+}
+
+static struct fsck_job *sched_find_running(struct fsck_sched *sc,
+					   struct libmnt_fs *fs,
+					   size_t begin, size_t end)
+{
+	size_t i;
+
+	for (i = begin; i < end; i++) {
+		struct fsck_job *job = &sc->jobs[i];
+
+		if (job->fs == fs && job->started && !job->finished)
+			return job;
+	}
+	return NULL;
+}
+
 /* Check all file systems, using the /etc/fstab table. */
 static int check_all(void)
 {
-	int not_done_yet = 1;
-	int passno = 1;
-	int pass_done;
+	struct fsck_sched sc = { .njobs = 0 };
+	size_t begin, end;
+	int limit;
 	int status = FSCK_EX_OK;
 
 	struct libmnt_fs *fs;
@@ -1302,72 +1591,85 @@ static int check_all(void)
 		}
 	}
 
-	while (not_done_yet) {
-		not_done_yet = 0;
-		pass_done = 1;
+	/*
+	 * Build the jobs.
+	 */
+	mnt_reset_iter(itr, MNT_ITER_FORWARD);
 
-		mnt_reset_iter(itr, MNT_ITER_FORWARD);
+	while (mnt_table_next_fs(fstab, itr, &fs) == 0) {
+		if (fs_is_done(fs))
+			continue;
+		if (ignore_mounted && is_mounted(fs)) {
+			fs_set_done(fs);
+			continue;
+		}
+		sched_add_job(&sc, fs);
+	}
+	if (sc.njobs)
+		qsort(sc.jobs, sc.njobs, sizeof(struct fsck_job), cmp_jobs);
 
-		while(mnt_table_next_fs(fstab, itr, &fs) == 0) {
+	limit = serialize ? 1 : max_running;
+
+	for (begin = 0; begin < sc.njobs && !cancel_requested; begin = end) {
+		size_t pending;
+		int passno = sc.jobs[begin].passno;
+
+		for (end = begin; end < sc.njobs && sc.jobs[end].passno == passno; end++);
+
+		sched_start_pass(&sc, begin, end);
+		pending = end - begin;
+
+		while (pending && !cancel_requested) {
+			struct fsck_instance *inst;
+			struct fsck_job *job;
 
-			if (cancel_requested)
-				break;
-			if (fs_is_done(fs))
-				continue;
-			/*
-			 * If the filesystem's pass number is higher
-			 * than the current pass number, then we don't
-			 * do it yet.
-			 */
-			if (mnt_fs_get_passno(fs) > passno) {
-				not_done_yet++;
-				continue;
-			}
-			if (ignore_mounted && is_mounted(fs)) {
-				fs_set_done(fs);
-				continue;
-			}
 			/*
-			 * If a filesystem on a particular device has
-			 * already been spawned, then we need to defer
-			 * this to another pass.
+			 * Spawn off as many fsck processes as allowed.
 			 */
-			if (disk_already_active(fs)) {
-				pass_done = 0;
-				continue;
+			while ((!limit || num_running < limit)
+			       && (job = sched_next_job(&sc, begin, end))) {
+				int running = num_running;
+
+				sched_start_job(&sc, job);
+				status |= fsck_device(job->fs, serialize);
+				fs_set_done(job->fs);
+
+				if (num_running == running) {
+					/* not executed */
+					sched_finish_job(&sc, job);
+					pending--;
+				}
+				if (cancel_requested)
+					break;
 			}
-			/*
-			 * Spawn off the fsck process
-			 */
-			status |= fsck_device(fs, serialize);
-			fs_set_done(fs);
+			if (!pending || !sc.nrunning || cancel_requested)
+				break;
 
-			/*
-			 * Only do one filesystem at a time, or if we
-			 * have a limit on the number of fsck's extant
-			 * at one time, apply that limit.
-			 */
-			if (serialize ||
-			    (max_running && (num_running >= max_running))) {
-				pass_done = 0;
+			if (verbose > 1)
+				printf(_("--waiting-- (pass %d)\n"), passno);
+
+			inst = wait_one(0);
+			if (!inst)
 				break;
+			status |= inst->exit_status;
+
+			job = sched_find_running(&sc, inst->fs, begin, end);
+			if (job) {
+				sched_finish_job(&sc, job);
+				pending--;
 			}
+			free_instance(inst);
 		}
 		if (cancel_requested)
 			break;
-		if (verbose > 1)
-			printf(_("--waiting-- (pass %d)\n"), passno);
 
-		status |= wait_many(pass_done ? FLAG_WAIT_ALL :
-				    FLAG_WAIT_ATLEAST_ONE);
-		if (pass_done) {
-			if (verbose > 1)
-				printf("----------------------------------\n");
-			passno++;
-		} else
-			not_done_yet++;
+		status |= wait_many(FLAG_WAIT_ALL);
+		if (verbose > 1)
+			printf("----------------------------------\n");
 	}
 
+	sched_free(&sc);
+
 	if (cancel_requested && !kill_sent) {
 		kill_all(SIGTERM);
 		kill_sent++;
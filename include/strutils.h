@@ -207,6 +207,12 @@ extern int parse_range(const char *str, int *lower, int *upper, int def);
 
 extern int streq_paths(const char *a, const char *b);
 
+#define UL_HASH_INIT	2166136261U
+#define UL_HASH_PRIME	16777619U
+
+extern size_t ul_hash_str(const char *str, size_t h);
+extern size_t ul_hash_path(const char *path, size_t h);
+
 /*
  * Match string beginning.
  */
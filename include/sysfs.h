@@ -92,6 +92,7 @@ int sysfs_blkdev_get_wholedisk( struct path_cxt *pc,
 int sysfs_devno_to_wholedisk(dev_t dev, char *diskname,
                              size_t len, dev_t *diskdevno);
 int sysfs_devno_is_dm_private(dev_t devno, char **uuid);
+int sysfs_devno_get_diskseq(dev_t devno, uint64_t *seq);
 int sysfs_devno_is_wholedisk(dev_t devno);
 
 dev_t sysfs_devname_to_devno(const char *name);
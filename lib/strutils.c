@@ -916,6 +916,31 @@ int streq_paths(const char *a, const char *b)
 	return 0;
 }
 
+/*
+ * FNV-1a hash of @str, @h is the initial value (UL_HASH_INIT or result
+ * from the previous ul_hash_*() call).
+ */
+size_t ul_hash_str(const char *str, size_t h)
+{
+	for (; str && *str; str++)
+		h = (h ^ (unsigned char) *str) * UL_HASH_PRIME;
+	return h;
+}
+
+/*
+ * Like ul_hash_str(), but redundant slashes are ignored, so paths equal for
+ * streq_paths() have the same hash.
+ */
+size_t ul_hash_path(const char *path, size_t h)
+{
+	for (; path && *path; path++) {
+		if (*path == '/' && (*(path + 1) == '/' || *(path + 1) == '\0'))
+			continue;
+		h = (h ^ (unsigned char) *path) * UL_HASH_PRIME;
+	}
+	return h;
+}
+
 char *strnappend(const char *s, const char *suffix, size_t b)
 {
         size_t a;
@@ -650,6 +650,29 @@ done:
 	return rc;
 }
 
+/*
+ * Read the disk sequence number (incremented by kernel when a new media is
+ * attached to the disk).  Partitions use the number of the whole-disk.
+ *
+ * Returns 0 on success, or < 0 in case of error (e.g. old kernel).
+ */
+int sysfs_devno_get_diskseq(dev_t devno, uint64_t *seq)
+{
+	struct path_cxt *pc;
+	int rc;
+
+	pc = ul_new_sysfs_path(devno, NULL, NULL);
+	if (!pc)
+		return -ENOMEM;
+
+	rc = ul_path_read_u64(pc, seq, "diskseq");
+	if (rc != 0 && ul_path_access(pc, F_OK, "partition") == 0)
+		rc = ul_path_read_u64(pc, seq, "../diskseq");
+
+	ul_unref_path(pc);
+	return rc;
+}
+
 /*
  * Return 0 or 1, or < 0 in case of error
  */
@@ -54,6 +54,7 @@ struct blkid_struct_dev
 	dev_t			bid_devno;	/* Device major/minor number */
 	time_t			bid_time;	/* Last update time of device */
 	suseconds_t		bid_utime;	/* Last update time (microseconds) */
+	uint64_t		bid_diskseq;	/* Disk sequence number when probed */
 	unsigned int		bid_flags;	/* Device status bitflags */
 	char			*bid_label;	/* Shortcut to device LABEL */
 	char			*bid_uuid;	/* Shortcut to binary UUID */
@@ -74,6 +75,7 @@ struct blkid_struct_tag
 {
 	struct list_head	bit_tags;	/* All tags for this device */
 	struct list_head	bit_names;	/* All tags with given NAME */
+	struct list_head	bit_hash;	/* Tags with the same NAME=value hash */
 	char			*bit_name;	/* NAME of tag (shared) */
 	char			*bit_val;	/* value of tag */
 	blkid_dev		bit_dev;	/* pointer to device */
@@ -181,6 +183,7 @@ struct blkid_bufinfo {
 	unsigned char		*data;
 	uint64_t		off;
 	uint64_t		len;
+	uint64_t		maxend;	/* max. end of this and all previous buffers in index */
 	struct list_head	bufs;	/* list of buffers */
 };
 
@@ -215,6 +218,12 @@ struct blkid_struct_probe
 	struct blkid_chain	*wipe_chain;	/* superblock, partition, ... */
 
 	struct list_head	buffers;	/* list of buffers */
+	struct blkid_bufinfo	**bufidx;	/* buffers sorted by offset */
+	size_t			nbufidx;
+	size_t			bufidx_alloc;
+	uint64_t		nreads;		/* number of read syscalls */
+	uint64_t		nreadbytes;	/* number of read bytes */
+	uint64_t		nreuses;	/* number of requests from buffers */
 	struct list_head	hints;
 
 	struct blkid_chain	chains[BLKID_NCHAINS];	/* array of chains */
@@ -232,6 +241,8 @@ struct blkid_struct_probe
 #define BLKID_FL_CDROM_DEV	(1 << 3)	/* is a CD/DVD drive */
 #define BLKID_FL_NOSCAN_DEV	(1 << 4)	/* do not scan this device */
 #define BLKID_FL_MODIF_BUFF	(1 << 5)	/* cached buffers has been modified */
+#define BLKID_FL_PREFETCHED	(1 << 6)	/* well-known areas already read */
+#define BLKID_FL_NOPREFETCH	(1 << 7)	/* probing area is part of the device */
 
 /* private per-probing flags */
 #define BLKID_PROBE_FL_IGNORE_PT (1 << 1)	/* ignore partition table */
@@ -257,6 +268,18 @@ struct blkid_config {
 	int nevals;			/* number of elems in eval array */
 	int uevent;			/* SEND_UEVENT=<yes|not> option */
 	char *cachefile;		/* CACHE_FILE=<path> option */
+	int cacheformat;		/* CACHE_FORMAT=<text|binary> option */
+	int revalidate;			/* REVALIDATE=<time|diskseq> option */
+};
+
+enum {
+	BLKID_CACHE_TEXT = 0,
+	BLKID_CACHE_BINARY
+};
+
+enum {
+	BLKID_REVALIDATE_TIME = 0,
+	BLKID_REVALIDATE_DISKSEQ
 };
 
 extern struct blkid_config *blkid_read_config(const char *filename)
@@ -277,6 +300,27 @@ extern void blkid_free_config(struct blkid_config *conf);
  */
 #define BLKID_PROBE_INTERVAL	200
 
+/*
+ * Result of a device probed in advance by sysfs_probe_all() worker threads.
+ * blkid_verify() uses it rather than reading the device again.
+ */
+struct blkid_prefetched_val {
+	char		*name;
+	char		*data;
+	size_t		len;
+};
+
+struct blkid_prefetched {
+	dev_t		devno;		/* probed device */
+	dev_t		disk;		/* whole-disk devno */
+	char		*devname;	/* device node to probe */
+	int		rc;		/* blkid_do_safeprobe() result */
+	unsigned int	done : 1;	/* rc and vals are valid */
+
+	size_t		nvals;
+	struct blkid_prefetched_val *vals;
+};
+
 /* This describes an entire blkid cache file and probed devices.
  * We can traverse all of the found devices via bic_list.
  * We can traverse all of the tag types by bic_tags, which hold empty tags
@@ -292,10 +336,70 @@ struct blkid_struct_cache
 	unsigned int		bic_flags;	/* Status flags of the cache */
 	char			*bic_filename;	/* filename of cache */
 	blkid_probe		probe;		/* low-level probing stuff */
+
+	struct list_head	*bic_hash;	/* NAME=value index of tags */
+	size_t			bic_nhash;	/* number of buckets */
+	size_t			bic_nhashed;	/* number of indexed tags */
+
+	void			*bic_map;	/* mmap-ed binary cache file */
+	size_t			bic_mapsz;
+	unsigned char		*bic_mapped;	/* bitmap of devices read from bic_map */
+
+	unsigned int		bic_nthreads;	/* blkid_probe_all() workers */
+	struct blkid_prefetched	*bic_prefetched; /* sorted by devno */
+	size_t			bic_nprefetched;
 };
 
 #define BLKID_BIC_FL_PROBED	0x0002	/* We probed /proc/partition devices */
 #define BLKID_BIC_FL_CHANGED	0x0004	/* Cache has changed from disk */
+#define BLKID_BIC_FL_BINARY	0x0008	/* Cache file in binary format */
+#define BLKID_BIC_FL_DISKSEQ	0x0010	/* Revalidate by diskseq rather than time */
+
+/*
+ * Binary cache file (CACHE_FORMAT=binary in blkid.conf).  The file is
+ * mmap-ed and tags are searched by NAME=value hash (blkid_bincache_hash()),
+ * the devices are added to the cache on demand.  Numbers are in host byte
+ * order, offsets are relative to begin of the file and strings are NUL
+ * terminated.
+ *
+ *	header | devices | tags | hash buckets | strings
+ */
+#define BLKID_BINCACHE_MAGIC	"BLKIDBIN"
+#define BLKID_BINCACHE_VERSION	1
+#define BLKID_BINCACHE_BOM	0x01020304
+#define BLKID_BINCACHE_NONE	UINT32_MAX
+
+struct blkid_bincache_header {
+	char		magic[8];
+	uint32_t	version;
+	uint32_t	bom;		/* byte order mark */
+	uint32_t	ndevs;
+	uint32_t	ntags;
+	uint32_t	nhash;		/* number of hash buckets */
+	uint32_t	strsz;		/* size of strings area */
+	uint64_t	devs_off;	/* struct blkid_bincache_dev[ndevs] */
+	uint64_t	tags_off;	/* struct blkid_bincache_tag[ntags] */
+	uint64_t	hash_off;	/* uint32_t[nhash], first tag in bucket */
+	uint64_t	str_off;
+};
+
+struct blkid_bincache_dev {
+	uint64_t	devno;
+	int64_t		time;
+	int64_t		utime;
+	uint64_t	diskseq;
+	int32_t		pri;
+	uint32_t	name;		/* offset in strings */
+	uint32_t	tags;		/* first tag */
+	uint32_t	ntags;
+};
+
+struct blkid_bincache_tag {
+	uint32_t	name;		/* offset in strings */
+	uint32_t	value;		/* offset in strings */
+	uint32_t	dev;		/* device index */
+	uint32_t	next;		/* next tag in the same hash bucket */
+};
 
 /* config file */
 #define BLKID_CONFIG_FILE	"/etc/blkid.conf"
@@ -364,9 +468,25 @@ extern void blkid__scan_dir(char *, dev_t, struct dir_list **, char **)
 extern int blkid_driver_has_major(const char *drvname, int drvmaj)
 			__attribute__((warn_unused_result));
 
+/* devname.c */
+extern struct blkid_prefetched *blkid_get_prefetched(blkid_cache cache, dev_t devno)
+			__attribute__((nonnull))
+			__attribute__((warn_unused_result));
+
+/* verify.c */
+extern int blkid_verify_needed(blkid_cache cache, blkid_dev dev)
+			__attribute__((nonnull));
+
 /* read.c */
 extern void blkid_read_cache(blkid_cache cache)
 			__attribute__((nonnull));
+extern void blkid_load_mapped_cache(blkid_cache cache)
+			__attribute__((nonnull));
+extern void blkid_load_mapped_tag(blkid_cache cache, const char *type,
+			const char *value)
+			__attribute__((nonnull));
+extern void blkid_free_mapped_cache(blkid_cache cache)
+			__attribute__((nonnull));
 
 /* save.c */
 extern int blkid_flush_cache(blkid_cache cache)
@@ -382,6 +502,14 @@ extern char *blkid_get_cache_filename(struct blkid_config *conf)
 /*
  * Functions to create and find a specific tag type: tag.c
  */
+#define BLKID_TAG_HASH_MIN	64	/* initial number of buckets */
+
+extern int blkid_init_tag_hash(blkid_cache cache)
+			__attribute__((nonnull));
+extern size_t blkid_tag_hash(const char *name, const char *value)
+			__attribute__((nonnull(1)));
+extern uint32_t blkid_bincache_hash(const char *name, const char *value)
+			__attribute__((nonnull(1)));
 extern void blkid_free_tag(blkid_tag tag);
 extern blkid_tag blkid_find_tag_dev(blkid_dev dev, const char *type)
 			__attribute__((nonnull))
@@ -92,6 +92,7 @@ char *blkid_get_cache_filename(struct blkid_config *conf)
  */
 int blkid_get_cache(blkid_cache *ret_cache, const char *filename)
 {
+	struct blkid_config *conf = NULL;
 	blkid_cache cache;
 
 	if (!ret_cache)
@@ -106,14 +107,31 @@ int blkid_get_cache(blkid_cache *ret_cache, const char *filename)
 	INIT_LIST_HEAD(&cache->bic_devs);
 	INIT_LIST_HEAD(&cache->bic_tags);
 
+	if (blkid_init_tag_hash(cache) != 0) {
+		free(cache);
+		return -BLKID_ERR_MEM;
+	}
+
 	if (filename && !*filename)
 		filename = NULL;
 	if (filename)
 		cache->bic_filename = strdup(filename);
-	else
-		cache->bic_filename = blkid_get_cache_filename(NULL);
+	else {
+		conf = blkid_read_config(NULL);
+		cache->bic_filename = blkid_get_cache_filename(conf);
+	}
 
 	blkid_read_cache(cache);
+
+	/* keep format of the file unless specified by config */
+	if (conf && conf->cacheformat == BLKID_CACHE_BINARY)
+		cache->bic_flags |= BLKID_BIC_FL_BINARY;
+	else if (conf)
+		cache->bic_flags &= ~BLKID_BIC_FL_BINARY;
+	if (conf && conf->revalidate == BLKID_REVALIDATE_DISKSEQ)
+		cache->bic_flags |= BLKID_BIC_FL_DISKSEQ;
+	blkid_free_config(conf);
+
 	*ret_cache = cache;
 	return 0;
 }
@@ -160,6 +178,8 @@ void blkid_put_cache(blkid_cache cache)
 		blkid_free_tag(tag);
 	}
 
+	blkid_free_mapped_cache(cache);
+	free(cache->bic_hash);
 	blkid_free_probe(cache->probe);
 
 	free(cache->bic_filename);
@@ -180,6 +200,8 @@ void blkid_gc_cache(blkid_cache cache)
 	if (!cache)
 		return;
 
+	blkid_load_mapped_cache(cache);
+
 	list_for_each_safe(p, pnext, &cache->bic_devs) {
 		blkid_dev dev = list_entry(p, struct blkid_struct_dev, bid_devs);
 		if (stat(dev->bid_name, &st) < 0) {
@@ -100,6 +100,28 @@ static int parse_next(FILE *fd, struct blkid_config *conf)
 			conf->cachefile = strdup(s);
 		else
 			conf->cachefile = NULL;
+	} else if (!strncmp(s, "CACHE_FORMAT=", 13)) {
+		s += 13;
+		if (!strcmp(s, "binary"))
+			conf->cacheformat = BLKID_CACHE_BINARY;
+		else if (!strcmp(s, "text"))
+			conf->cacheformat = BLKID_CACHE_TEXT;
+		else {
+			DBG(CONFIG, ul_debug(
+				"config file: unknown cache format '%s'.", s));
+			return -1;
+		}
+	} else if (!strncmp(s, "REVALIDATE=", 11)) {
+		s += 11;
+		if (!strcmp(s, "diskseq"))
+			conf->revalidate = BLKID_REVALIDATE_DISKSEQ;
+		else if (!strcmp(s, "time"))
+			conf->revalidate = BLKID_REVALIDATE_TIME;
+		else {
+			DBG(CONFIG, ul_debug(
+				"config file: unknown revalidation method '%s'.", s));
+			return -1;
+		}
 	} else if (!strncmp(s, "EVALUATE=", 9)) {
 		s += 9;
 		if (*s && parse_evaluate(conf, s) == -1)
@@ -127,6 +149,7 @@ struct blkid_config *blkid_read_config(const char *filename)
 	if (!conf)
 		return NULL;
 	conf->uevent = -1;
+	conf->cacheformat = -1;
 
 	DBG(CONFIG, ul_debug("reading config file: %s.", filename));
 
@@ -151,6 +174,8 @@ dflt:
 		conf->cachefile = strdup(BLKID_CACHE_FILE);
 	if (conf->uevent == -1)
 		conf->uevent = TRUE;
+	if (conf->cacheformat == -1)
+		conf->cacheformat = BLKID_CACHE_TEXT;
 	if (f)
 		fclose(f);
 	return conf;
@@ -194,6 +219,10 @@ int main(int argc, char *argv[])
 
 	printf("SEND UEVENT: %s\n", conf->uevent ? "TRUE" : "FALSE");
 	printf("CACHE_FILE:  %s\n", conf->cachefile);
+	printf("CACHE_FORMAT: %s\n", conf->cacheformat == BLKID_CACHE_BINARY ?
+				"binary" : "text");
+	printf("REVALIDATE:  %s\n", conf->revalidate == BLKID_REVALIDATE_DISKSEQ ?
+				"diskseq" : "time");
 
 	blkid_free_config(conf);
 	return EXIT_SUCCESS;
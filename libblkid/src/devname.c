@@ -33,6 +33,7 @@
 #include <errno.h>
 #endif
 #include <time.h>
+#include <pthread.h>
 
 #include "blkidP.h"
 
@@ -40,6 +41,7 @@
 #include "pathnames.h"
 #include "sysfs.h"
 #include "fileutils.h"
+#include "env.h"
 
 /*
  * Find a dev struct in the cache by device name, if available.
@@ -56,6 +58,8 @@ blkid_dev blkid_get_dev(blkid_cache cache, const char *devname, int flags)
 	if (!cache || !devname)
 		return NULL;
 
+	blkid_load_mapped_cache(cache);
+
 	/* search by name */
 	list_for_each(p, &cache->bic_devs) {
 		tmp = list_entry(p, struct blkid_struct_dev, bid_devs);
@@ -442,6 +446,321 @@ ubi_probe_all(blkid_cache cache, int only_if_new)
 	}
 }
 
+/*
+ * Devices found in /sys/block, in the order sysfs_probe_all() adds them to
+ * the cache.
+ */
+struct sysfs_probe_ent {
+	char		*name;		/* sysfs name */
+	dev_t		devno;
+	dev_t		disk;		/* whole-disk devno */
+	unsigned int	remove : 1;	/* partitioned whole-disk */
+};
+
+struct sysfs_probe_list {
+	struct sysfs_probe_ent *ents;
+	size_t		nents;
+	size_t		nalloc;
+};
+
+static int add_probe_ent(struct sysfs_probe_list *ls, const char *name,
+			 dev_t devno, dev_t disk, int remove)
+{
+	struct sysfs_probe_ent *e;
+
+	if (ls->nents == ls->nalloc) {
+		size_t n = ls->nalloc ? ls->nalloc * 2 : 64;
+
+		e = realloc(ls->ents, n * sizeof(*e));
+		if (!e)
+			return -ENOMEM;
+		ls->ents = e;
+		ls->nalloc = n;
+	}
+
+	e = &ls->ents[ls->nents];
+	e->name = strdup(name);
+	if (!e->name)
+		return -ENOMEM;
+	e->devno = devno;
+	e->disk = disk;
+	e->remove = remove ? 1 : 0;
+	ls->nents++;
+	return 0;
+}
+
+static void free_probe_list(struct sysfs_probe_list *ls)
+{
+	size_t i;
+
+	for (i = 0; i < ls->nents; i++)
+		free(ls->ents[i].name);
+	free(ls->ents);
+}
+
+/*
+ * Parallel probing
+ *
+ * Reading superblocks is the expensive part of blkid_probe_all(), so with
+ * more than one thread the devices are read in advance by a pool of workers
+ * and blkid_verify() picks up the results.  The cache itself is still
+ * updated by the caller only, in the same order as without threads.
+ *
+ * Each worker owns a whole disk at a time and reads its partitions one by
+ * one; it's pointless (and slow for rotational disks) to read the same disk
+ * from more threads.
+ */
+struct prefetch_pool {
+	struct blkid_prefetched	*pfs;
+	size_t			npfs;
+
+	pthread_mutex_t		lock;
+	size_t			next;	/* first not yet probed entry */
+};
+
+static void free_prefetched(struct blkid_prefetched *pfs, size_t npfs)
+{
+	size_t i, n;
+
+	for (i = 0; i < npfs; i++) {
+		for (n = 0; n < pfs[i].nvals; n++) {
+			free(pfs[i].vals[n].name);
+			free(pfs[i].vals[n].data);
+		}
+		free(pfs[i].vals);
+		free(pfs[i].devname);
+	}
+	free(pfs);
+}
+
+static int cmp_prefetched(const void *a, const void *b)
+{
+	dev_t x = ((const struct blkid_prefetched *) a)->devno;
+	dev_t y = ((const struct blkid_prefetched *) b)->devno;
+
+	return x < y ? -1 : x > y ? 1 : 0;
+}
+
+struct blkid_prefetched *blkid_get_prefetched(blkid_cache cache, dev_t devno)
+{
+	struct blkid_prefetched key = { .devno = devno }, *pf;
+
+	if (!cache->bic_nprefetched)
+		return NULL;
+
+	pf = bsearch(&key, cache->bic_prefetched, cache->bic_nprefetched,
+			sizeof(key), cmp_prefetched);
+	return pf && pf->done ? pf : NULL;
+}
+
+static int prefetch_values(blkid_probe pr, struct blkid_prefetched *pf)
+{
+	int n, nvals = blkid_probe_numof_values(pr);
+
+	pf->vals = calloc(nvals, sizeof(struct blkid_prefetched_val));
+	if (nvals && !pf->vals)
+		return -ENOMEM;
+
+	for (n = 0; n < nvals; n++) {
+		struct blkid_prefetched_val *v = &pf->vals[pf->nvals];
+		const char *name, *data;
+		size_t len;
+
+		if (blkid_probe_get_value(pr, n, &name, &data, &len) != 0)
+			continue;
+		v->name = strdup(name);
+		v->data = malloc(len);
+		if (!v->name || !v->data) {
+			free(v->name);
+			free(v->data);
+			return -ENOMEM;
+		}
+		memcpy(v->data, data, len);
+		v->len = len;
+		pf->nvals++;
+	}
+	return 0;
+}
+
+static void prefetch_one(blkid_probe pr, struct blkid_prefetched *pf)
+{
+	struct stat st;
+	int fd;
+
+	/* blkid_verify() reads the device itself if anything is unexpected */
+	if (stat(pf->devname, &st) != 0 || !S_ISBLK(st.st_mode)
+	    || st.st_rdev != pf->devno
+	    || sysfs_devno_is_dm_private(pf->devno, NULL))
+		return;
+
+	fd = open(pf->devname, O_RDONLY|O_CLOEXEC|O_NONBLOCK);
+	if (fd < 0)
+		return;
+
+	if (blkid_probe_set_device(pr, fd, 0, 0) != 0)
+		pf->rc = -1;
+	else {
+		pf->rc = blkid_do_safeprobe(pr);
+		if (pf->rc == 0 && prefetch_values(pr, pf) != 0) {
+			close(fd);
+			blkid_probe_set_device(pr, -1, 0, 0);
+			return;
+		}
+		blkid_probe_set_device(pr, -1, 0, 0);
+	}
+	close(fd);
+	pf->done = 1;
+}
+
+static void *prefetch_thread(void *data)
+{
+	struct prefetch_pool *pool = data;
+	blkid_probe pr;
+
+	pr = blkid_new_probe();
+	if (!pr)
+		return NULL;
+
+	blkid_probe_enable_superblocks(pr, TRUE);
+	blkid_probe_set_superblocks_flags(pr,
+		BLKID_SUBLKS_LABEL | BLKID_SUBLKS_UUID |
+		BLKID_SUBLKS_TYPE | BLKID_SUBLKS_SECTYPE);
+	blkid_probe_enable_partitions(pr, TRUE);
+	blkid_probe_set_partitions_flags(pr, BLKID_PARTS_ENTRY_DETAILS);
+
+	for (;;) {
+		size_t i, end;
+
+		/* take all entries of the next whole disk */
+		pthread_mutex_lock(&pool->lock);
+		i = pool->next;
+		for (end = i; end < pool->npfs; end++) {
+			if (pool->pfs[end].disk != pool->pfs[i].disk)
+				break;
+		}
+		pool->next = end;
+		pthread_mutex_unlock(&pool->lock);
+
+		if (i == end)
+			break;
+		for (; i < end; i++)
+			prefetch_one(pr, &pool->pfs[i]);
+	}
+
+	blkid_free_probe(pr);
+	return NULL;
+}
+
+static unsigned int get_probe_threads(blkid_cache cache)
+{
+	unsigned long n;
+	char *str, *end = NULL;
+
+	if (cache->bic_nthreads)
+		return cache->bic_nthreads;
+
+	str = safe_getenv("LIBBLKID_PROBE_THREADS");
+	if (!str || !*str)
+		return 1;
+
+	errno = 0;
+	n = strtoul(str, &end, 10);
+	if (errno || !end || *end || !n)
+		return 1;
+	return n > UINT_MAX ? UINT_MAX : n;
+}
+
+/*
+ * Read devices from @ls by worker threads; the results are available by
+ * blkid_get_prefetched() until the cache->bic_prefetched array is freed.
+ */
+static void prefetch_devices(blkid_cache cache, struct sysfs_probe_list *ls,
+			     int only_if_new, unsigned int nthreads)
+{
+	struct prefetch_pool pool = { .npfs = 0 };
+	pthread_t *threads;
+	size_t i, ndisks = 0;
+	unsigned int n, nrun = 0;
+
+	pool.pfs = calloc(ls->nents, sizeof(struct blkid_prefetched));
+	if (!pool.pfs)
+		return;
+
+	for (i = 0; i < ls->nents; i++) {
+		struct sysfs_probe_ent *e = &ls->ents[i];
+		struct blkid_prefetched *pf;
+		struct list_head *p;
+		char *devname = NULL;
+		int skip = 0;
+
+		if (e->remove)
+			continue;
+
+		/* use the name from the cache, see probe_one() */
+		list_for_each(p, &cache->bic_devs) {
+			blkid_dev tmp = list_entry(p, struct blkid_struct_dev,
+						   bid_devs);
+			if (tmp->bid_devno != e->devno)
+				continue;
+			if ((only_if_new && !access(tmp->bid_name, F_OK)) ||
+			    !blkid_verify_needed(cache, tmp))
+				skip = 1;
+			else
+				devname = strdup(tmp->bid_name);
+			break;
+		}
+		if (skip)
+			continue;
+		if (!devname && !strncmp(e->name, "dm-", 3) && isdigit(e->name[3]))
+			devname = canonicalize_dm_name(e->name);
+		if (!devname) {
+			char device[256];
+
+			snprintf(device, sizeof(device), "/dev/%s", e->name);
+			devname = strdup(device);
+		}
+		if (!devname)
+			break;
+
+		pf = &pool.pfs[pool.npfs++];
+		pf->devno = e->devno;
+		pf->disk = e->disk;
+		pf->devname = devname;
+		if (pool.npfs == 1 || pf->disk != pf[-1].disk)
+			ndisks++;
+	}
+
+	if (nthreads > ndisks)
+		nthreads = ndisks;
+	if (nthreads < 2)
+		goto done;
+
+	DBG(DEVNAME, ul_debug("prefetching %zu devices (%zu disks) by %u threads",
+				pool.npfs, ndisks, nthreads));
+
+	threads = calloc(nthreads, sizeof(pthread_t));
+	if (!threads)
+		goto done;
+
+	pthread_mutex_init(&pool.lock, NULL);
+	for (n = 0; n < nthreads; n++) {
+		if (pthread_create(&threads[n], NULL, prefetch_thread, &pool) != 0)
+			break;
+		nrun++;
+	}
+	for (n = 0; n < nrun; n++)
+		pthread_join(threads[n], NULL);
+	pthread_mutex_destroy(&pool.lock);
+	free(threads);
+
+	qsort(pool.pfs, pool.npfs, sizeof(struct blkid_prefetched), cmp_prefetched);
+	cache->bic_prefetched = pool.pfs;
+	cache->bic_nprefetched = pool.npfs;
+	return;
+done:
+	free_prefetched(pool.pfs, pool.npfs);
+}
+
 /*
  * This function uses /sys to read all block devices in way compatible with
  * /proc/partitions (like the original libblkid implementation)
@@ -451,13 +770,19 @@ sysfs_probe_all(blkid_cache cache, int only_if_new, int only_removable)
 {
 	DIR *sysfs;
 	struct dirent *dev;
+	struct sysfs_probe_list ls = { .nents = 0 };
+	unsigned int nthreads;
+	size_t i;
+	int rc = 0;
 
 	sysfs = opendir(_PATH_SYS_BLOCK);
 	if (!sysfs)
 		return -BLKID_ERR_SYSFS;
 
+	blkid_load_mapped_cache(cache);
+
 	/* scan /sys/block */
-	while ((dev = xreaddir(sysfs))) {
+	while (rc == 0 && (dev = xreaddir(sysfs))) {
 		DIR *dir = NULL;
 		dev_t devno;
 		size_t nparts = 0;
@@ -520,17 +845,40 @@ sysfs_probe_all(blkid_cache cache, int only_if_new, int only_removable)
 			if (!partno)
 				continue;
 
-			DBG(DEVNAME, ul_debug(" Probe partition dev %s, devno 0x%04X",
-                                   part->d_name, (unsigned int) partno));
 			nparts++;
-			probe_one(cache, part->d_name, partno, 0, only_if_new, 0);
+			rc = add_probe_ent(&ls, part->d_name, partno, devno, 0);
+			if (rc)
+				goto next;
 		}
 
-		if (!nparts) {
-			/* add non-partitioned whole disk to cache */
-			DBG(DEVNAME, ul_debug(" Probe whole dev %s, devno 0x%04X",
-				   dev->d_name, (unsigned int) devno));
-			probe_one(cache, dev->d_name, devno, 0, only_if_new, 0);
+		/* non-partitioned whole disk is probed, partitioned is removed */
+		rc = add_probe_ent(&ls, dev->d_name, devno, devno, nparts != 0);
+	next:
+		if (dir)
+			closedir(dir);
+		if (pc)
+			ul_unref_path(pc);
+	}
+
+	closedir(sysfs);
+
+	if (rc) {
+		free_probe_list(&ls);
+		return -BLKID_ERR_MEM;
+	}
+
+	nthreads = get_probe_threads(cache);
+	if (nthreads > 1)
+		prefetch_devices(cache, &ls, only_if_new, nthreads);
+
+	for (i = 0; i < ls.nents; i++) {
+		struct sysfs_probe_ent *e = &ls.ents[i];
+
+		if (!e->remove) {
+			DBG(DEVNAME, ul_debug(" Probe %s dev %s, devno 0x%04X",
+				   e->devno == e->disk ? "whole" : "partition",
+				   e->name, (unsigned int) e->devno));
+			probe_one(cache, e->name, e->devno, 0, only_if_new, 0);
 		} else {
 			/* remove partitioned whole-disk from cache */
 			struct list_head *p, *pnext;
@@ -538,7 +886,7 @@ sysfs_probe_all(blkid_cache cache, int only_if_new, int only_removable)
 			list_for_each_safe(p, pnext, &cache->bic_devs) {
 				blkid_dev tmp = list_entry(p, struct blkid_struct_dev,
 							bid_devs);
-				if (tmp->bid_devno == devno) {
+				if (tmp->bid_devno == e->devno) {
 					DBG(DEVNAME, ul_debug(" freeing %s", tmp->bid_name));
 					blkid_free_dev(tmp);
 					cache->bic_flags |= BLKID_BIC_FL_CHANGED;
@@ -546,14 +894,14 @@ sysfs_probe_all(blkid_cache cache, int only_if_new, int only_removable)
 				}
 			}
 		}
-	next:
-		if (dir)
-			closedir(dir);
-		if (pc)
-			ul_unref_path(pc);
 	}
 
-	closedir(sysfs);
+	if (cache->bic_prefetched) {
+		free_prefetched(cache->bic_prefetched, cache->bic_nprefetched);
+		cache->bic_prefetched = NULL;
+		cache->bic_nprefetched = 0;
+	}
+	free_probe_list(&ls);
 	return 0;
 }
 
@@ -570,6 +918,7 @@ static int probe_all(blkid_cache cache, int only_if_new)
 		return 0;
 
 	blkid_read_cache(cache);
+	blkid_load_mapped_cache(cache);
 
 	evms_probe_all(cache, only_if_new);
 #ifdef VG_DIR
@@ -583,6 +932,32 @@ static int probe_all(blkid_cache cache, int only_if_new)
 	return 0;
 }
 
+/**
+ * blkid_probe_all_set_threads:
+ * @cache: cache handler
+ * @nthreads: number of threads or zero for the default
+ *
+ * Sets number of threads used to read devices by blkid_probe_all(),
+ * blkid_probe_all_new() and blkid_probe_all_removable(). Every thread reads
+ * one whole disk (and its partitions) at a time, the cache is updated in the
+ * same order as without threads.
+ *
+ * The default is one thread (no parallel probing), or the number specified
+ * by the LIBBLKID_PROBE_THREADS environment variable.
+ *
+ * Returns: 0 on success, or number less than zero in case of error.
+ *
+ * Since: 2.37
+ */
+int blkid_probe_all_set_threads(blkid_cache cache, unsigned int nthreads)
+{
+	if (!cache)
+		return -BLKID_ERR_PARAM;
+
+	cache->bic_nthreads = nthreads;
+	return 0;
+}
+
 /**
  * blkid_probe_all:
  * @cache: cache handler
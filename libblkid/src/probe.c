@@ -248,6 +248,7 @@ void blkid_free_probe(blkid_probe pr)
 	if ((pr->flags & BLKID_FL_PRIVATE_FD) && pr->fd >= 0)
 		close(pr->fd);
 	blkid_probe_reset_buffers(pr);
+	free(pr->bufidx);
 	blkid_probe_reset_values(pr);
 	blkid_probe_reset_hints(pr);
 	blkid_free_probe(pr->disk_probe);
@@ -532,16 +533,19 @@ int __blkid_probe_filter_types(blkid_probe pr, int chain, int flag, char *names[
 	return 0;
 }
 
+/*
+ * Areas read by one read() call before the first request is served. Almost all
+ * superblocks and partition tables are within the first 1MiB of the device and
+ * RAID-like metadata are usually at the end of the device.
+ */
+#define BLKID_PREFETCH_HEAD	(1024 * 1024)
+#define BLKID_PREFETCH_TAIL	(64 * 1024)
+
 static struct blkid_bufinfo *read_buffer(blkid_probe pr, uint64_t real_off, uint64_t len)
 {
 	ssize_t ret;
 	struct blkid_bufinfo *bf = NULL;
 
-	if (lseek(pr->fd, real_off, SEEK_SET) == (off_t) -1) {
-		errno = 0;
-		return NULL;
-	}
-
 	/* someone trying to overflow some buffers? */
 	if (len > ULONG_MAX - sizeof(struct blkid_bufinfo)) {
 		errno = ENOMEM;
@@ -563,14 +567,17 @@ static struct blkid_bufinfo *read_buffer(blkid_probe pr, uint64_t real_off, uint
 	DBG(LOWPROBE, ul_debug("\tread: off=%"PRIu64" len=%"PRIu64"",
 	                       real_off, len));
 
-	ret = read(pr->fd, bf->data, len);
+	ret = pread(pr->fd, bf->data, len, real_off);
+	pr->nreads++;
+	if (ret > 0)
+		pr->nreadbytes += ret;
 	if (ret != (ssize_t) len) {
 		DBG(LOWPROBE, ul_debug("\tread failed: %m"));
 		free(bf);
 
 		/* I/O errors on CDROMs are non-fatal to work with hybrid
 		 * audio+data disks */
-		if (ret >= 0 || blkid_probe_is_cdrom(pr))
+		if (ret >= 0 || blkid_probe_is_cdrom(pr) || errno == ESPIPE)
 			errno = 0;
 		return NULL;
 	}
@@ -578,27 +585,124 @@ static struct blkid_bufinfo *read_buffer(blkid_probe pr, uint64_t real_off, uint
 	return bf;
 }
 
+/*
+ * Adds the buffer to the list of buffers and to the index of buffers sorted
+ * by offset.
+ */
+static int add_buffer(blkid_probe pr, struct blkid_bufinfo *bf)
+{
+	size_t lo = 0, hi = pr->nbufidx, i;
+
+	if (pr->nbufidx == pr->bufidx_alloc) {
+		size_t sz = pr->bufidx_alloc ? pr->bufidx_alloc * 2 : 16;
+		struct blkid_bufinfo **tmp = realloc(pr->bufidx, sz * sizeof(*tmp));
+
+		if (!tmp)
+			return -ENOMEM;
+		pr->bufidx = tmp;
+		pr->bufidx_alloc = sz;
+	}
+
+	while (lo < hi) {
+		size_t mid = (lo + hi) / 2;
+
+		if (pr->bufidx[mid]->off <= bf->off)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	memmove(&pr->bufidx[lo + 1], &pr->bufidx[lo],
+			(pr->nbufidx - lo) * sizeof(struct blkid_bufinfo *));
+	pr->bufidx[lo] = bf;
+	pr->nbufidx++;
+
+	/* update max. ends */
+	for (i = lo; i < pr->nbufidx; i++) {
+		struct blkid_bufinfo *x = pr->bufidx[i];
+		uint64_t prev = i ? pr->bufidx[i - 1]->maxend : 0;
+
+		x->maxend = max(prev, x->off + x->len);
+	}
+
+	list_add_tail(&bf->bufs, &pr->buffers);
+	return 0;
+}
+
 /*
  * Search in buffers we already have in memory
  */
 static struct blkid_bufinfo *get_cached_buffer(blkid_probe pr, uint64_t off, uint64_t len)
 {
 	uint64_t real_off = pr->off + off;
-	struct list_head *p;
+	size_t lo = 0, hi = pr->nbufidx;
 
-	list_for_each(p, &pr->buffers) {
-		struct blkid_bufinfo *x =
-				list_entry(p, struct blkid_bufinfo, bufs);
+	/* the first buffer which starts after real_off */
+	while (lo < hi) {
+		size_t mid = (lo + hi) / 2;
 
-		if (real_off >= x->off && real_off + len <= x->off + x->len) {
+		if (pr->bufidx[mid]->off <= real_off)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	/* all buffers before 'lo' start before real_off, check the ends */
+	while (lo > 0) {
+		struct blkid_bufinfo *x = pr->bufidx[--lo];
+
+		if (x->maxend < real_off + len)
+			break;
+		if (real_off + len <= x->off + x->len) {
 			DBG(BUFFER, ul_debug("\treuse: off=%"PRIu64" len=%"PRIu64" (for off=%"PRIu64" len=%"PRIu64")",
 						x->off, x->len, real_off, len));
+			pr->nreuses++;
 			return x;
 		}
 	}
 	return NULL;
 }
 
+/*
+ * Reads the begin and the end of the probing area by one read() call per area
+ * (or by one call if the areas are overlapping). The small requests from
+ * probing functions are served from these buffers. The errors are ignored,
+ * the areas are read on demand by read_buffer() in this case.
+ */
+static void prefetch_buffers(blkid_probe pr)
+{
+	uint64_t head, tail_off;
+	struct blkid_bufinfo *bf;
+
+	pr->flags |= BLKID_FL_PREFETCHED;
+
+	if (S_ISCHR(pr->mode) || pr->size == 0 || (pr->flags & BLKID_FL_NOPREFETCH))
+		return;
+
+	/* the area is the whole device here, blkid_probe_set_device() checks
+	 * it against the device size */
+	head = min(pr->size, (uint64_t) BLKID_PREFETCH_HEAD);
+	tail_off = pr->size > BLKID_PREFETCH_TAIL ? pr->size - BLKID_PREFETCH_TAIL : 0;
+
+	/* areas are overlapping or adjacent, read all by one call */
+	if (tail_off <= head)
+		head = pr->size;
+
+	DBG(BUFFER, ul_debug("prefetch: head=%"PRIu64", tail=%"PRIu64" (size=%"PRIu64")",
+				head, head == pr->size ? 0 : pr->size - tail_off, pr->size));
+
+	bf = read_buffer(pr, pr->off, head);
+	if (bf && add_buffer(pr, bf) != 0)
+		free(bf);
+
+	/* I/O errors at the end of CDROMs are common, don't read there */
+	if (head == pr->size || blkid_probe_is_cdrom(pr))
+		return;
+
+	bf = read_buffer(pr, pr->off + tail_off, pr->size - tail_off);
+	if (bf && add_buffer(pr, bf) != 0)
+		free(bf);
+}
+
 /*
  * Zeroize in-memory data in already read buffer. The next blkid_probe_get_buffer()
  * will return modified buffer. This is usable when you want to call the same probing
@@ -674,6 +778,9 @@ unsigned char *blkid_probe_get_buffer(blkid_probe pr, uint64_t off, uint64_t len
 				pr->off + off - pr->parent->off, len);
 	}
 
+	if (!(pr->flags & BLKID_FL_PREFETCHED))
+		prefetch_buffers(pr);
+
 	/* try buffers we already have in memory or read from device */
 	bf = get_cached_buffer(pr, off, len);
 	if (!bf) {
@@ -681,7 +788,11 @@ unsigned char *blkid_probe_get_buffer(blkid_probe pr, uint64_t off, uint64_t len
 		if (!bf)
 			return NULL;
 
-		list_add_tail(&bf->bufs, &pr->buffers);
+		if (add_buffer(pr, bf) != 0) {
+			free(bf);
+			errno = ENOMEM;
+			return NULL;
+		}
 	}
 
 	assert(bf->off <= real_off);
@@ -704,9 +815,13 @@ unsigned char *blkid_probe_get_buffer(blkid_probe pr, uint64_t off, uint64_t len
  */
 int blkid_probe_reset_buffers(blkid_probe pr)
 {
-	uint64_t ct = 0, len = 0;
+	pr->flags &= ~(BLKID_FL_MODIF_BUFF | BLKID_FL_PREFETCHED);
 
-	pr->flags &= ~BLKID_FL_MODIF_BUFF;
+	if (pr->nreads || pr->nreuses)
+		DBG(LOWPROBE, ul_debug(" buffers summary: %"PRIu64" bytes by %"PRIu64" read() calls, "
+				"%"PRIu64" requests from buffers",
+			pr->nreadbytes, pr->nreads, pr->nreuses));
+	pr->nreads = pr->nreadbytes = pr->nreuses = 0;
 
 	if (list_empty(&pr->buffers))
 		return 0;
@@ -716,8 +831,6 @@ int blkid_probe_reset_buffers(blkid_probe pr)
 	while (!list_empty(&pr->buffers)) {
 		struct blkid_bufinfo *bf = list_entry(pr->buffers.next,
 						struct blkid_bufinfo, bufs);
-		ct++;
-		len += bf->len;
 		list_del(&bf->bufs);
 
 		DBG(BUFFER, ul_debug(" remove buffer: [off=%"PRIu64", len=%"PRIu64"]",
@@ -725,10 +838,8 @@ int blkid_probe_reset_buffers(blkid_probe pr)
 		free(bf);
 	}
 
-	DBG(LOWPROBE, ul_debug(" buffers summary: %"PRIu64" bytes by %"PRIu64" read() calls",
-			len, ct));
-
 	INIT_LIST_HEAD(&pr->buffers);
+	pr->nbufidx = 0;
 
 	return 0;
 }
@@ -886,6 +997,7 @@ int blkid_probe_set_device(blkid_probe pr, int fd,
 	pr->flags &= ~BLKID_FL_PRIVATE_FD;
 	pr->flags &= ~BLKID_FL_TINY_DEV;
 	pr->flags &= ~BLKID_FL_CDROM_DEV;
+	pr->flags &= ~BLKID_FL_NOPREFETCH;
 	pr->prob_flags = 0;
 	pr->fd = fd;
 	pr->off = (uint64_t) off;
@@ -939,6 +1051,10 @@ int blkid_probe_set_device(blkid_probe pr, int fd,
 		goto err;
 	}
 
+	/* the caller probes a part of the device, read only what is requested */
+	if (pr->off || pr->size < devsiz)
+		pr->flags |= BLKID_FL_NOPREFETCH;
+
 	if (pr->size <= 1440 * 1024 && !S_ISCHR(sb.st_mode))
 		pr->flags |= BLKID_FL_TINY_DEV;
 
@@ -1026,6 +1142,7 @@ int blkid_probe_set_dimension(blkid_probe pr, uint64_t off, uint64_t size)
 	pr->off = off;
 	pr->size = size;
 	pr->flags &= ~BLKID_FL_TINY_DEV;
+	pr->flags |= BLKID_FL_NOPREFETCH;
 
 	if (pr->size <= 1440ULL * 1024ULL && !S_ISCHR(pr->mode))
 		pr->flags |= BLKID_FL_TINY_DEV;
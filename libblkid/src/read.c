@@ -19,6 +19,7 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <sys/mman.h>
 #ifdef HAVE_ERRNO_H
 #include <errno.h>
 #endif
@@ -42,10 +43,13 @@
  *	<TIME="sec.usec"> (time_t and suseconds_t) time this entry was last
  *	                 read from disk
  *	<TYPE="type">	(detected) type of filesystem/data for this partition
+ *	<DISKSEQ="seq">	disk sequence number when the entry was read (optional)
  *
  *	The following tags may be present, depending on the device contents
  *	<LABEL="label">	(user supplied) label (volume name, etc)
  *	<UUID="uuid">	(generated) universally unique identifier (serial no)
+ *
+ * or the binary format, see struct blkid_bincache_header.
  */
 
 static char *skip_over_blank(char *cp)
@@ -307,7 +311,9 @@ static int parse_tag(blkid_cache cache, blkid_dev dev, char **cp)
 		dev->bid_time = strtoull(value, &end, 0);
 		if (end && *end == '.')
 			dev->bid_utime = strtoull(end + 1, NULL, 0);
-	} else
+	} else if (!strcmp(name, "DISKSEQ"))
+		dev->bid_diskseq = strtoull(value, NULL, 0);
+	else
 		ret = blkid_set_tag(dev, name, value, strlen(value));
 
 	return ret < 0 ? ret : 1;
@@ -355,6 +361,218 @@ done:
 	return ret;
 }
 
+/*
+ * Binary cache file
+ */
+#define bincache_header(_c)	((struct blkid_bincache_header *) (_c)->bic_map)
+#define bincache_ptr(_c, _off)	((char *) (_c)->bic_map + (_off))
+
+static int bincache_area_ok(size_t mapsz, uint64_t off, uint64_t n,
+			    size_t size, size_t align)
+{
+	return off <= mapsz && off % align == 0 && n <= (mapsz - off) / size;
+}
+
+static const char *bincache_string(blkid_cache cache, uint32_t off)
+{
+	struct blkid_bincache_header *h = bincache_header(cache);
+
+	/* the last byte of the strings area is NUL, see map_cache() */
+	return off < h->strsz ? bincache_ptr(cache, h->str_off) + off : NULL;
+}
+
+static blkid_dev find_dev_by_name(blkid_cache cache, const char *name)
+{
+	struct list_head *p;
+
+	list_for_each(p, &cache->bic_devs) {
+		blkid_dev dev = list_entry(p, struct blkid_struct_dev, bid_devs);
+
+		if (strcmp(dev->bid_name, name) == 0)
+			return dev;
+	}
+	return NULL;
+}
+
+/*
+ * Add @idx device from the binary cache to cache->bic_devs.  The semantic is
+ * the same as for blkid_parse_line(), except that canonicalized names are not
+ * searched, the file does not contain the same device more than once.
+ */
+static void load_dev(blkid_cache cache, uint32_t idx, int dedup)
+{
+	struct blkid_bincache_header *h = bincache_header(cache);
+	struct blkid_bincache_dev *d;
+	struct blkid_bincache_tag *tags;
+	const char *name;
+	blkid_dev dev = NULL;
+	uint32_t i;
+
+	setbit(cache->bic_mapped, idx);
+
+	d = (struct blkid_bincache_dev *) bincache_ptr(cache, h->devs_off) + idx;
+	tags = (struct blkid_bincache_tag *) bincache_ptr(cache, h->tags_off);
+
+	name = bincache_string(cache, d->name);
+	if (!name || *name != '/' || d->tags > h->ntags
+	    || d->ntags > h->ntags - d->tags) {
+		DBG(READ, ul_debug("blkid: bad binary cache device %u", idx));
+		return;
+	}
+	if (dedup)
+		dev = find_dev_by_name(cache, name);
+	if (!dev) {
+		if (access(name, F_OK) < 0)
+			return;
+		dev = blkid_new_dev();
+		if (!dev)
+			return;
+		dev->bid_name = strdup(name);
+		if (!dev->bid_name) {
+			blkid_free_dev(dev);
+			return;
+		}
+		dev->bid_cache = cache;
+		list_add_tail(&dev->bid_devs, &cache->bic_devs);
+	}
+
+	DBG(READ, ul_debug("found dev %s", name));
+
+	dev->bid_devno = d->devno;
+	dev->bid_time = d->time;
+	dev->bid_diskseq = d->diskseq;
+	dev->bid_utime = d->utime;
+	dev->bid_pri = d->pri;
+
+	for (i = d->tags; i < d->tags + d->ntags; i++) {
+		const char *type = bincache_string(cache, tags[i].name),
+			   *value = bincache_string(cache, tags[i].value);
+
+		if (type && value)
+			blkid_set_tag(dev, type, value, strlen(value));
+	}
+
+	if (dev->bid_type == NULL) {
+		DBG(READ, ul_debug("blkid: device %s has no TYPE", dev->bid_name));
+		blkid_free_dev(dev);
+	}
+}
+
+static int map_cache(blkid_cache cache, int fd, struct stat *st)
+{
+	struct blkid_bincache_header *h;
+	size_t sz = st->st_size;
+	void *map;
+
+	if (sz < sizeof(*h))
+		return -BLKID_ERR_CACHE;
+
+	map = mmap(NULL, sz, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (map == MAP_FAILED)
+		return -BLKID_ERR_IO;
+	h = map;
+
+	if (memcmp(h->magic, BLKID_BINCACHE_MAGIC, sizeof(h->magic)) != 0
+	    || h->version != BLKID_BINCACHE_VERSION
+	    || h->bom != BLKID_BINCACHE_BOM
+	    || !h->nhash || !h->strsz
+	    || !bincache_area_ok(sz, h->devs_off, h->ndevs,
+				 sizeof(struct blkid_bincache_dev), sizeof(uint64_t))
+	    || !bincache_area_ok(sz, h->tags_off, h->ntags,
+				 sizeof(struct blkid_bincache_tag), sizeof(uint32_t))
+	    || !bincache_area_ok(sz, h->hash_off, h->nhash,
+				 sizeof(uint32_t), sizeof(uint32_t))
+	    || !bincache_area_ok(sz, h->str_off, h->strsz, 1, 1)
+	    || ((char *) map)[h->str_off + h->strsz - 1] != '\0') {
+		DBG(READ, ul_debug("blkid: bad binary cache header"));
+		munmap(map, sz);
+		return -BLKID_ERR_CACHE;
+	}
+
+	cache->bic_mapped = calloc(1, h->ndevs / NBBY + 1);
+	if (!cache->bic_mapped) {
+		munmap(map, sz);
+		return -BLKID_ERR_MEM;
+	}
+	cache->bic_map = map;
+	cache->bic_mapsz = sz;
+
+	DBG(READ, ul_debug("mapped binary cache: %u devices, %u tags",
+				h->ndevs, h->ntags));
+	return 0;
+}
+
+void blkid_free_mapped_cache(blkid_cache cache)
+{
+	if (!cache->bic_map)
+		return;
+
+	munmap(cache->bic_map, cache->bic_mapsz);
+	free(cache->bic_mapped);
+	cache->bic_map = NULL;
+	cache->bic_mapped = NULL;
+	cache->bic_mapsz = 0;
+}
+
+/*
+ * Add all not yet added devices from the binary cache file to the cache and
+ * unmap the file.  This is necessary before anything walks cache->bic_devs.
+ */
+void blkid_load_mapped_cache(blkid_cache cache)
+{
+	unsigned int changed = cache->bic_flags & BLKID_BIC_FL_CHANGED;
+	uint32_t i, ndevs;
+
+	if (!cache->bic_map)
+		return;
+
+	ndevs = bincache_header(cache)->ndevs;
+	for (i = 0; i < ndevs; i++) {
+		if (!isset(cache->bic_mapped, i))
+			load_dev(cache, i, 0);
+	}
+
+	cache->bic_flags &= ~BLKID_BIC_FL_CHANGED;
+	cache->bic_flags |= changed;
+	blkid_free_mapped_cache(cache);
+}
+
+/*
+ * Add devices with tag @type=@value from the binary cache file to the cache.
+ */
+void blkid_load_mapped_tag(blkid_cache cache, const char *type, const char *value)
+{
+	unsigned int changed = cache->bic_flags & BLKID_BIC_FL_CHANGED;
+	struct blkid_bincache_header *h = bincache_header(cache);
+	struct blkid_bincache_tag *tags;
+	uint32_t *hash, idx, n;
+
+	if (!cache->bic_map)
+		return;
+
+	hash = (uint32_t *) bincache_ptr(cache, h->hash_off);
+	tags = (struct blkid_bincache_tag *) bincache_ptr(cache, h->tags_off);
+
+	idx = hash[blkid_bincache_hash(type, value) % h->nhash];
+
+	for (n = 0; idx < h->ntags && n < h->ntags; n++, idx = tags[idx].next) {
+		struct blkid_bincache_tag *t = &tags[idx];
+		const char *tn = bincache_string(cache, t->name),
+			   *tv = bincache_string(cache, t->value);
+
+		if (!tn || !tv || t->dev >= h->ndevs
+		    || isset(cache->bic_mapped, t->dev)
+		    || strcmp(tv, value) != 0 || strcmp(tn, type) != 0)
+			continue;
+
+		DBG(READ, ul_debug("binary cache: %s=%s on device %u", type, value, t->dev));
+		load_dev(cache, t->dev, 0);
+	}
+
+	cache->bic_flags &= ~BLKID_BIC_FL_CHANGED;
+	cache->bic_flags |= changed;
+}
+
 /*
  * Parse the specified filename, and return the data in the supplied or
  * a newly allocated cache struct.  If the file doesn't exist, return a
@@ -364,6 +582,7 @@ void blkid_read_cache(blkid_cache cache)
 {
 	FILE *file;
 	char buf[4096];
+	char magic[sizeof(BLKID_BINCACHE_MAGIC) - 1];
 	int fd, lineno = 0;
 	struct stat st;
 
@@ -385,6 +604,27 @@ void blkid_read_cache(blkid_cache cache)
 	DBG(CACHE, ul_debug("reading cache file %s",
 				cache->bic_filename));
 
+	if (pread(fd, magic, sizeof(magic), 0) == sizeof(magic)
+	    && memcmp(magic, BLKID_BINCACHE_MAGIC, sizeof(magic)) == 0) {
+		/* devices from the previous version of the file */
+		blkid_load_mapped_cache(cache);
+
+		if (map_cache(cache, fd, &st) != 0)
+			goto errout;
+		cache->bic_flags |= BLKID_BIC_FL_BINARY;
+
+		/* re-read, merge with the current devices */
+		if (!list_empty(&cache->bic_devs)) {
+			uint32_t i, ndevs = bincache_header(cache)->ndevs;
+
+			for (i = 0; i < ndevs; i++)
+				load_dev(cache, i, 1);
+			blkid_free_mapped_cache(cache);
+		}
+		close(fd);
+		goto done;
+	}
+
 	file = fdopen(fd, "r" UL_CLOEXECSTR);
 	if (!file)
 		goto errout;
@@ -410,7 +650,7 @@ void blkid_read_cache(blkid_cache cache)
 		}
 	}
 	fclose(file);
-
+done:
 	/*
 	 * Initially we do not need to write out the cache file.
 	 */
@@ -423,16 +663,215 @@ errout:
 }
 
 #ifdef TEST_PROGRAM
+#include <sys/time.h>
+
+static double bench_msec(struct timeval *start)
+{
+	struct timeval now;
+
+	gettimeofday(&now, NULL);
+	return (now.tv_sec - start->tv_sec) * 1000.0 +
+	       (now.tv_usec - start->tv_usec) / 1000.0;
+}
+
+/*
+ * Create text and binary cache with @ndevs devices (empty files in a
+ * temporary directory) and compare time to load the cache and resolve one
+ * UUID= tag.
+ */
+static int bench(unsigned int ndevs)
+{
+	char dir[] = "/tmp/blkid-bench-XXXXXX", path[PATH_MAX], uuid[64];
+	char *files[2] = { NULL, NULL };
+	const char *formats[2] = { "text", "binary" };
+	blkid_cache cache = NULL;
+	unsigned int i;
+	int rc = EXIT_FAILURE;
+
+	if (!mkdtemp(dir))
+		return EXIT_FAILURE;
+	if (asprintf(&files[0], "%s/blkid.tab", dir) < 0 ||
+	    asprintf(&files[1], "%s/blkid.bin", dir) < 0)
+		goto done;
+
+	if (blkid_get_cache(&cache, files[0]) != 0)
+		goto done;
+	for (i = 0; i < ndevs; i++) {
+		blkid_dev dev;
+		int fd;
+
+		snprintf(path, sizeof(path), "%s/dev%u", dir, i);
+		fd = open(path, O_WRONLY|O_CREAT|O_CLOEXEC, 0600);
+		if (fd < 0)
+			goto done;
+		close(fd);
+
+		dev = blkid_get_dev(cache, path, BLKID_DEV_CREATE);
+		if (!dev)
+			goto done;
+		dev->bid_devno = i + 1;
+		/* newer than the file, so blkid_verify() does not read it */
+		dev->bid_time = time(NULL);
+		dev->bid_utime = 999999;
+		snprintf(uuid, sizeof(uuid), "%08x-0000-4000-8000-%012x", i, i);
+		blkid_set_tag(dev, "UUID", uuid, strlen(uuid));
+		blkid_set_tag(dev, "LABEL", path + sizeof(dir), strlen(path + sizeof(dir)));
+		blkid_set_tag(dev, "TYPE", "ext4", 4);
+	}
+
+	/* write the same devices in both formats */
+	for (i = 0; i < 2; i++) {
+		free(cache->bic_filename);
+		cache->bic_filename = strdup(files[i]);
+		if (i)
+			cache->bic_flags |= BLKID_BIC_FL_BINARY;
+		cache->bic_flags |= BLKID_BIC_FL_CHANGED;
+		if (blkid_flush_cache(cache) < 0)
+			goto done;
+	}
+	blkid_put_cache(cache);
+	cache = NULL;
+
+	snprintf(uuid, sizeof(uuid), "%08x-0000-4000-8000-%012x", ndevs / 2, ndevs / 2);
+	for (i = 0; i < 2; i++) {
+		struct timeval start;
+		double load;
+		char *name;
+
+		gettimeofday(&start, NULL);
+		if (blkid_get_cache(&cache, files[i]) != 0)
+			goto done;
+		load = bench_msec(&start);
+		name = blkid_get_devname(cache, "UUID", uuid);
+
+		printf("%-6s: %u devices, load %.3f ms, load and resolve %.3f ms (%s)\n",
+			formats[i], ndevs, load, bench_msec(&start),
+			name ? name : "not found");
+		free(name);
+
+		cache->bic_flags &= ~BLKID_BIC_FL_CHANGED;
+		blkid_put_cache(cache);
+		cache = NULL;
+	}
+	rc = EXIT_SUCCESS;
+done:
+	if (cache) {
+		cache->bic_flags &= ~BLKID_BIC_FL_CHANGED;
+		blkid_put_cache(cache);
+	}
+	for (i = 0; i < ndevs; i++) {
+		snprintf(path, sizeof(path), "%s/dev%u", dir, i);
+		unlink(path);
+	}
+	for (i = 0; i < 2; i++) {
+		if (files[i]) {
+			unlink(files[i]);
+			free(files[i]);
+		}
+	}
+	rmdir(dir);
+	return rc;
+}
+
+/*
+ * Print all devices from the cache (or from the default cache file if
+ * @filename is NULL), the output does not depend on the file format.
+ */
+static int dump(const char *filename)
+{
+	blkid_cache cache = NULL;
+	struct list_head *p, *t;
+
+	if (blkid_get_cache(&cache, filename) != 0)
+		return EXIT_FAILURE;
+	blkid_load_mapped_cache(cache);
+
+	list_for_each(p, &cache->bic_devs) {
+		blkid_dev dev = list_entry(p, struct blkid_struct_dev, bid_devs);
+
+		printf("%s: DEVNO=0x%04jx TIME=%jd.%jd PRI=%d DISKSEQ=%ju\n",
+			dev->bid_name, (uintmax_t) dev->bid_devno,
+			(intmax_t) dev->bid_time, (intmax_t) dev->bid_utime,
+			dev->bid_pri, (uintmax_t) dev->bid_diskseq);
+		list_for_each(t, &dev->bid_tags) {
+			blkid_tag tag = list_entry(t, struct blkid_struct_tag, bit_tags);
+
+			printf("\t%s=\"%s\"\n", tag->bit_name, tag->bit_val);
+		}
+	}
+	cache->bic_flags &= ~BLKID_BIC_FL_CHANGED;
+	blkid_put_cache(cache);
+	return EXIT_SUCCESS;
+}
+
+/*
+ * Read the cache and write it again, the format follows blkid.conf (or the
+ * format of the file if @filename is specified).
+ */
+static int rewrite(const char *filename)
+{
+	blkid_cache cache = NULL;
+	int rc;
+
+	if (blkid_get_cache(&cache, filename) != 0)
+		return EXIT_FAILURE;
+	cache->bic_flags |= BLKID_BIC_FL_CHANGED;
+	rc = blkid_flush_cache(cache);
+	blkid_put_cache(cache);
+	return rc < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+/*
+ * Print devices added to the cache by NAME=value lookup in the binary cache
+ * file index.
+ */
+static int find(const char *filename, const char *name, const char *value)
+{
+	blkid_cache cache = NULL;
+	struct list_head *p;
+
+	if (blkid_get_cache(&cache, filename) != 0)
+		return EXIT_FAILURE;
+	if (!cache->bic_map) {
+		fprintf(stderr, "%s: not a binary cache\n", filename);
+		blkid_put_cache(cache);
+		return EXIT_FAILURE;
+	}
+	blkid_load_mapped_tag(cache, name, value);
+
+	list_for_each(p, &cache->bic_devs) {
+		blkid_dev dev = list_entry(p, struct blkid_struct_dev, bid_devs);
+
+		printf("%s\n", dev->bid_name);
+	}
+	cache->bic_flags &= ~BLKID_BIC_FL_CHANGED;
+	blkid_put_cache(cache);
+	return EXIT_SUCCESS;
+}
 
 int main(int argc, char**argv)
 {
 	blkid_cache cache = NULL;
 	int ret;
 
+	if (argc == 3 && strcmp(argv[1], "--bench") == 0)
+		return bench(strtoul(argv[2], NULL, 10));
+	if (argc <= 3 && argc >= 2 && strcmp(argv[1], "--dump") == 0)
+		return dump(argv[2]);
+	if (argc <= 3 && argc >= 2 && strcmp(argv[1], "--rewrite") == 0)
+		return rewrite(argv[2]);
+	if (argc == 5 && strcmp(argv[1], "--find") == 0)
+		return find(argv[2], argv[3], argv[4]);
+
 	blkid_init_debug(BLKID_DEBUG_ALL);
 	if (argc > 2) {
 		fprintf(stderr, "Usage: %s [filename]\n"
-			"Test parsing of the cache (filename)\n", argv[0]);
+			"       %s --bench <ndevs>\n"
+			"       %s --dump [filename]\n"
+			"       %s --rewrite [filename]\n"
+			"       %s --find <filename> <NAME> <value>\n"
+			"Test parsing of the cache (filename)\n",
+			argv[0], argv[0], argv[0], argv[0], argv[0]);
 		exit(1);
 	}
 	if ((ret = blkid_get_cache(&cache, argv[1])) < 0)
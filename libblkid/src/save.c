@@ -42,6 +42,11 @@ static void save_quoted(const char *data, FILE *file)
 	}
 	fputc('"', file);
 }
+static int is_saved_dev(blkid_dev dev)
+{
+	return dev->bid_type && !(dev->bid_flags & BLKID_BID_FL_REMOVABLE);
+}
+
 static int save_dev(blkid_dev dev, FILE *file)
 {
 	struct list_head *p;
@@ -59,6 +64,8 @@ static int save_dev(blkid_dev dev, FILE *file)
 
 	if (dev->bid_pri)
 		fprintf(file, " PRI=\"%d\"", dev->bid_pri);
+	if (dev->bid_diskseq)
+		fprintf(file, " DISKSEQ=\"%ju\"", (uintmax_t) dev->bid_diskseq);
 
 	list_for_each(p, &dev->bid_tags) {
 		blkid_tag tag = list_entry(p, struct blkid_struct_tag, bit_tags);
@@ -73,6 +80,137 @@ static int save_dev(blkid_dev dev, FILE *file)
 	return 0;
 }
 
+/*
+ * Binary cache file, see struct blkid_bincache_header.
+ */
+struct bincache_strings {
+	char	*data;
+	size_t	size;
+	size_t	alloc;
+};
+
+static int add_string(struct bincache_strings *s, const char *str, uint32_t *off)
+{
+	size_t len = strlen(str) + 1;
+
+	if (s->size + len > UINT32_MAX)
+		return -BLKID_ERR_BIG;
+	if (s->size + len > s->alloc) {
+		size_t sz = max(s->alloc * 2, s->size + len);
+		char *data = realloc(s->data, max(sz, (size_t) 4096));
+
+		if (!data)
+			return -BLKID_ERR_MEM;
+		s->data = data;
+		s->alloc = max(sz, (size_t) 4096);
+	}
+	memcpy(s->data + s->size, str, len);
+	*off = s->size;
+	s->size += len;
+	return 0;
+}
+
+static int save_binary(blkid_cache cache, FILE *file)
+{
+	struct blkid_bincache_header hdr = { .version = BLKID_BINCACHE_VERSION };
+	struct blkid_bincache_dev *devs = NULL;
+	struct blkid_bincache_tag *tags = NULL;
+	struct bincache_strings strs = { .size = 0 };
+	uint32_t *hash = NULL, i;
+	struct list_head *p, *t;
+	size_t ndevs = 0, ntags = 0, pad;
+	int ret = -BLKID_ERR_MEM;
+
+	list_for_each(p, &cache->bic_devs) {
+		blkid_dev dev = list_entry(p, struct blkid_struct_dev, bid_devs);
+
+		/* the same as save_dev(), load_dev() rejects other names */
+		if (!is_saved_dev(dev) || dev->bid_name[0] != '/')
+			continue;
+		ndevs++;
+		list_for_each(t, &dev->bid_tags)
+			ntags++;
+	}
+	if (ndevs > UINT32_MAX || ntags >= UINT32_MAX)
+		return -BLKID_ERR_BIG;
+
+	memcpy(hdr.magic, BLKID_BINCACHE_MAGIC, sizeof(hdr.magic));
+	hdr.bom = BLKID_BINCACHE_BOM;
+	hdr.ndevs = ndevs;
+	hdr.ntags = ntags;
+	hdr.nhash = ntags ? ntags : 1;	/* load factor 1 */
+
+	devs = calloc(ndevs ? ndevs : 1, sizeof(*devs));
+	tags = calloc(ntags ? ntags : 1, sizeof(*tags));
+	hash = malloc(hdr.nhash * sizeof(uint32_t));
+	if (!devs || !tags || !hash)
+		goto done;
+	for (i = 0; i < hdr.nhash; i++)
+		hash[i] = BLKID_BINCACHE_NONE;
+
+	ndevs = ntags = 0;
+	list_for_each(p, &cache->bic_devs) {
+		blkid_dev dev = list_entry(p, struct blkid_struct_dev, bid_devs);
+		struct blkid_bincache_dev *d = &devs[ndevs];
+
+		if (!is_saved_dev(dev) || dev->bid_name[0] != '/')
+			continue;
+
+		DBG(SAVE, ul_debug("device %s, type %s (binary)", dev->bid_name,
+					dev->bid_type));
+		d->devno = dev->bid_devno;
+		d->time = dev->bid_time;
+		d->diskseq = dev->bid_diskseq;
+		d->utime = dev->bid_utime;
+		d->pri = dev->bid_pri;
+		d->tags = ntags;
+		if ((ret = add_string(&strs, dev->bid_name, &d->name)) != 0)
+			goto done;
+
+		list_for_each(t, &dev->bid_tags) {
+			blkid_tag tag = list_entry(t, struct blkid_struct_tag, bit_tags);
+			struct blkid_bincache_tag *x = &tags[ntags];
+			uint32_t h = blkid_bincache_hash(tag->bit_name, tag->bit_val) % hdr.nhash;
+
+			if ((ret = add_string(&strs, tag->bit_name, &x->name)) != 0 ||
+			    (ret = add_string(&strs, tag->bit_val, &x->value)) != 0)
+				goto done;
+			x->dev = ndevs;
+			x->next = hash[h];
+			hash[h] = ntags++;
+			d->ntags++;
+		}
+		ndevs++;
+	}
+	if (!strs.size && (ret = add_string(&strs, "", &i)) != 0)
+		goto done;
+
+	hdr.strsz = strs.size;
+	hdr.devs_off = sizeof(hdr);
+	hdr.tags_off = hdr.devs_off + ndevs * sizeof(*devs);
+	hdr.hash_off = hdr.tags_off + ntags * sizeof(*tags);
+	hdr.str_off = hdr.hash_off + hdr.nhash * sizeof(uint32_t);
+	pad = hdr.str_off % sizeof(uint64_t) ?
+		sizeof(uint64_t) - hdr.str_off % sizeof(uint64_t) : 0;
+	hdr.str_off += pad;
+
+	if (fwrite(&hdr, sizeof(hdr), 1, file) != 1 ||
+	    fwrite(devs, sizeof(*devs), ndevs, file) != ndevs ||
+	    fwrite(tags, sizeof(*tags), ntags, file) != ntags ||
+	    fwrite(hash, sizeof(uint32_t), hdr.nhash, file) != hdr.nhash ||
+	    fwrite("\0\0\0\0\0\0\0", 1, pad, file) != pad ||
+	    fwrite(strs.data, 1, strs.size, file) != strs.size)
+		ret = -BLKID_ERR_IO;
+	else
+		ret = 0;
+done:
+	free(devs);
+	free(tags);
+	free(hash);
+	free(strs.data);
+	return ret;
+}
+
 /*
  * Write out the cache struct to the cache file on disk.
  */
@@ -86,8 +224,15 @@ int blkid_flush_cache(blkid_cache cache)
 	int fd, ret = 0;
 	struct stat st;
 
-	if (list_empty(&cache->bic_devs) ||
-	    !(cache->bic_flags & BLKID_BIC_FL_CHANGED)) {
+	if (!(cache->bic_flags & BLKID_BIC_FL_CHANGED)) {
+		DBG(SAVE, ul_debug("skipping cache file write"));
+		return 0;
+	}
+
+	/* all devices are necessary to write the file */
+	blkid_load_mapped_cache(cache);
+
+	if (list_empty(&cache->bic_devs)) {
 		DBG(SAVE, ul_debug("skipping cache file write"));
 		return 0;
 	}
@@ -156,12 +301,16 @@ int blkid_flush_cache(blkid_cache cache)
 		goto errout;
 	}
 
-	list_for_each(p, &cache->bic_devs) {
-		blkid_dev dev = list_entry(p, struct blkid_struct_dev, bid_devs);
-		if (!dev->bid_type || (dev->bid_flags & BLKID_BID_FL_REMOVABLE))
-			continue;
-		if ((ret = save_dev(dev, file)) < 0)
-			break;
+	if (cache->bic_flags & BLKID_BIC_FL_BINARY)
+		ret = save_binary(cache, file);
+	else {
+		list_for_each(p, &cache->bic_devs) {
+			blkid_dev dev = list_entry(p, struct blkid_struct_dev, bid_devs);
+			if (!is_saved_dev(dev))
+				continue;
+			if ((ret = save_dev(dev, file)) < 0)
+				break;
+		}
 	}
 
 	if (ret >= 0) {
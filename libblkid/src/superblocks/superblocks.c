@@ -171,6 +171,252 @@ static const struct blkid_idinfo *idinfos[] =
 	&zonefs_idinfo
 };
 
+/*
+ * Magic strings dispatch table
+ *
+ * All magic strings with a fixed offset (without a hint) are sorted by the
+ * offset and the first byte of the magic string. The superblocks_probe()
+ * reads every 1KiB block with any magic only once and checks only the magic
+ * strings which start with the byte found at the offset.
+ */
+struct sb_magic {
+	uint64_t	off;		/* byte offset of the magic string */
+	unsigned char	first;		/* the first byte of the magic string */
+	unsigned short	id;		/* index to idinfos[] */
+	unsigned short	mag;		/* index to idinfos[]->magics[] */
+};
+
+struct sb_magics {
+	size_t		nmagics;
+	struct sb_magic	magics[];
+};
+
+/* idinfos[] with hints or without magic strings are probed as before */
+#define SB_MAGIC_DYNAMIC	(-1)	/* not in the table */
+#define SB_MAGIC_NONE		(-2)	/* no magic string found */
+
+/* result of match_sb_magics() for one idinfo */
+struct sb_match {
+	int	mag;		/* the first matching magic string or SB_MAGIC_* */
+	int	errmag;		/* the first unreadable magic string or -1 */
+	int	err;		/* -errno for errmag */
+};
+
+static struct sb_magics *sb_magics_table;
+
+static int cmp_sb_magic(const void *a, const void *b)
+{
+	const struct sb_magic *x = a, *y = b;
+
+	if (x->off != y->off)
+		return x->off < y->off ? -1 : 1;
+	if (x->first != y->first)
+		return x->first < y->first ? -1 : 1;
+	if (x->id != y->id)
+		return x->id < y->id ? -1 : 1;
+	return x->mag < y->mag ? -1 : x->mag > y->mag;
+}
+
+static int idinfo_is_dynamic(const struct blkid_idinfo *id)
+{
+	const struct blkid_idmag *mag;
+
+	if (!id->magics[0].magic)
+		return 1;
+	for (mag = &id->magics[0]; mag->magic; mag++) {
+		if (mag->hoff)
+			return 1;
+	}
+	return 0;
+}
+
+/* the table is read-only and built only once */
+static const struct sb_magics *get_sb_magics(void)
+{
+	struct sb_magics *tb;
+	size_t i, n = 0;
+
+	if (sb_magics_table)
+		return sb_magics_table;
+
+	for (i = 0; i < ARRAY_SIZE(idinfos); i++) {
+		const struct blkid_idmag *mag;
+
+		if (idinfo_is_dynamic(idinfos[i]))
+			continue;
+		for (mag = &idinfos[i]->magics[0]; mag->magic; mag++)
+			n++;
+	}
+
+	tb = malloc(sizeof(struct sb_magics) + n * sizeof(struct sb_magic));
+	if (!tb)
+		return NULL;
+	tb->nmagics = 0;
+
+	for (i = 0; i < ARRAY_SIZE(idinfos); i++) {
+		const struct blkid_idmag *mag;
+		unsigned short m = 0;
+
+		if (idinfo_is_dynamic(idinfos[i]))
+			continue;
+		for (mag = &idinfos[i]->magics[0]; mag->magic; mag++, m++) {
+			struct sb_magic *x = &tb->magics[tb->nmagics++];
+
+			x->off = (mag->kboff << 10) + mag->sboff;
+			x->first = (unsigned char) mag->magic[0];
+			x->id = i;
+			x->mag = m;
+		}
+	}
+	qsort(tb->magics, tb->nmagics, sizeof(struct sb_magic), cmp_sb_magic);
+
+	/* another thread could be faster */
+	if (!__sync_bool_compare_and_swap(&sb_magics_table, NULL, tb))
+		free(tb);
+
+	DBG(LOWPROBE, ul_debug("superblocks magic table: %zu magics", sb_magics_table->nmagics));
+	return sb_magics_table;
+}
+
+static int idinfo_is_usable(blkid_probe pr, struct blkid_chain *chn, size_t i)
+{
+	const struct blkid_idinfo *id = idinfos[i];
+
+	if (chn->fltr && blkid_bmp_get_item(chn->fltr, i))
+		return 0;
+
+	/* the device is too small */
+	if (id->minsz && (unsigned)id->minsz > pr->size)
+		return 0;
+
+	/* don't probe for RAIDs, swap or journal on CD/DVDs */
+	if ((id->usage & (BLKID_USAGE_RAID | BLKID_USAGE_OTHER)) &&
+	    blkid_probe_is_cdrom(pr))
+		return 0;
+
+	/* don't probe for RAIDs on floppies */
+	if ((id->usage & BLKID_USAGE_RAID) && blkid_probe_is_tiny(pr))
+		return 0;
+
+	return 1;
+}
+
+/*
+ * Checks all fixed magic strings for usable idinfos[] starting at @start.
+ * The device is read only once for all magic strings in the same 1KiB block.
+ */
+static void match_sb_magics(blkid_probe pr, struct blkid_chain *chn, size_t start,
+			    struct sb_match *res)
+{
+	const struct sb_magics *tb = get_sb_magics();
+	char usable[ARRAY_SIZE(idinfos)];
+	size_t i, nusable = 0;
+
+	for (i = 0; i < ARRAY_SIZE(idinfos); i++) {
+		res[i].mag = SB_MAGIC_DYNAMIC;
+		res[i].errmag = -1;
+		res[i].err = 0;
+		usable[i] = 0;
+
+		if (!tb || i < start || idinfo_is_dynamic(idinfos[i]))
+			continue;
+		res[i].mag = SB_MAGIC_NONE;
+		usable[i] = idinfo_is_usable(pr, chn, i);
+		if (usable[i])
+			nusable++;
+	}
+	if (!nusable)
+		return;
+
+	for (i = 0; i < tb->nmagics; ) {
+		uint64_t blk = tb->magics[i].off >> 10;
+		unsigned char *buf;
+		size_t end, k;
+
+		/* all magic strings in the same 1KiB block */
+		for (end = i, k = 0; end < tb->nmagics &&
+				     (tb->magics[end].off >> 10) == blk; end++) {
+			if (usable[tb->magics[end].id])
+				k++;
+		}
+		if (!k) {
+			i = end;
+			continue;
+		}
+
+		buf = blkid_probe_get_buffer(pr, blk << 10, 1024);
+		if (!buf) {
+			int rc = -errno;
+
+			for ( ; rc && i < end; i++) {
+				struct sb_match *m = &res[tb->magics[i].id];
+				int mag = tb->magics[i].mag;
+
+				if (usable[tb->magics[i].id] &&
+				    (m->errmag < 0 || mag < m->errmag)) {
+					m->errmag = mag;
+					m->err = rc;
+				}
+			}
+			i = end;
+			continue;
+		}
+
+		while (i < end) {
+			uint64_t off = tb->magics[i].off;
+			unsigned char c = buf[off & 0x3ff];
+
+			/* skip to the magic strings with the first byte */
+			while (i < end && tb->magics[i].off == off && tb->magics[i].first < c)
+				i++;
+
+			for ( ; i < end && tb->magics[i].off == off && tb->magics[i].first == c; i++) {
+				const struct sb_magic *x = &tb->magics[i];
+				const struct blkid_idmag *mag = &idinfos[x->id]->magics[x->mag];
+				struct sb_match *m = &res[x->id];
+
+				if (!usable[x->id])
+					continue;
+				if (m->mag >= 0 && m->mag < x->mag)
+					continue;	/* previous magic string already matches */
+				if (memcmp(mag->magic, buf + (off & 0x3ff), mag->len) == 0)
+					m->mag = x->mag;
+			}
+
+			/* skip to the next offset */
+			while (i < end && tb->magics[i].off == off)
+				i++;
+		}
+	}
+}
+
+/*
+ * The same as blkid_probe_get_idmag(), but uses result from match_sb_magics()
+ * if possible.
+ */
+static int get_sb_idmag(blkid_probe pr, size_t i, struct sb_match *res,
+			uint64_t *offset, const struct blkid_idmag **mag)
+{
+	const struct blkid_idinfo *id = idinfos[i];
+	struct sb_match *m = &res[i];
+
+	if (m->mag == SB_MAGIC_DYNAMIC)
+		return blkid_probe_get_idmag(pr, id, offset, mag);
+
+	/* the same order as in blkid_probe_get_idmag() */
+	if (m->errmag >= 0 && (m->mag < 0 || m->errmag < m->mag))
+		return m->err;
+	if (m->mag < 0)
+		return BLKID_PROBE_NONE;
+
+	*mag = &id->magics[m->mag];
+	*offset = ((*mag)->kboff << 10) + (*mag)->sboff;
+
+	DBG(LOWPROBE, ul_debug("\tmagic sboff=%u, kboff=%ld",
+		(*mag)->sboff, (*mag)->kboff));
+	return BLKID_PROBE_OK;
+}
+
 /*
  * Driver definition
  */
@@ -340,6 +586,7 @@ int blkid_superblocks_get_name(size_t idx, const char **name, int *usage)
  */
 static int superblocks_probe(blkid_probe pr, struct blkid_chain *chn)
 {
+	struct sb_match res[ARRAY_SIZE(idinfos)];
 	size_t i;
 	int rc = BLKID_PROBE_NONE;
 
@@ -366,6 +613,8 @@ static int superblocks_probe(blkid_probe pr, struct blkid_chain *chn)
 
 	i = chn->idx < 0 ? 0 : chn->idx + 1U;
 
+	match_sb_magics(pr, chn, i, res);
+
 	for ( ; i < ARRAY_SIZE(idinfos); i++) {
 		const struct blkid_idinfo *id;
 		const struct blkid_idmag *mag = NULL;
@@ -374,33 +623,15 @@ static int superblocks_probe(blkid_probe pr, struct blkid_chain *chn)
 		chn->idx = i;
 		id = idinfos[i];
 
-		if (chn->fltr && blkid_bmp_get_item(chn->fltr, i)) {
+		if (!idinfo_is_usable(pr, chn, i)) {
 			DBG(LOWPROBE, ul_debug("filter out: %s", id->name));
 			rc = BLKID_PROBE_NONE;
 			continue;
 		}
 
-		if (id->minsz && (unsigned)id->minsz > pr->size) {
-			rc = BLKID_PROBE_NONE;
-			continue;	/* the device is too small */
-		}
-
-		/* don't probe for RAIDs, swap or journal on CD/DVDs */
-		if ((id->usage & (BLKID_USAGE_RAID | BLKID_USAGE_OTHER)) &&
-		    blkid_probe_is_cdrom(pr)) {
-			rc = BLKID_PROBE_NONE;
-			continue;
-		}
-
-		/* don't probe for RAIDs on floppies */
-		if ((id->usage & BLKID_USAGE_RAID) && blkid_probe_is_tiny(pr)) {
-			rc = BLKID_PROBE_NONE;
-			continue;
-		}
-
 		DBG(LOWPROBE, ul_debug("[%zd] %s:", i, id->name));
 
-		rc = blkid_probe_get_idmag(pr, id, &off, &mag);
+		rc = get_sb_idmag(pr, i, res, &off, &mag);
 		if (rc < 0)
 			break;
 		if (rc != BLKID_PROBE_OK)
@@ -16,6 +16,7 @@
 #include <stdio.h>
 
 #include "blkidP.h"
+#include "strutils.h"
 
 static blkid_tag blkid_new_tag(void)
 {
@@ -27,10 +28,100 @@ static blkid_tag blkid_new_tag(void)
 	DBG(TAG, ul_debugobj(tag, "alloc"));
 	INIT_LIST_HEAD(&tag->bit_tags);
 	INIT_LIST_HEAD(&tag->bit_names);
+	INIT_LIST_HEAD(&tag->bit_hash);
 
 	return tag;
 }
 
+/*
+ * The cache keeps all tags in a hash table indexed by NAME=value, so
+ * blkid_find_dev_with_tag() does not have to walk all devices.  The cache
+ * tag heads (without value) are indexed by NAME only.
+ */
+size_t blkid_tag_hash(const char *name, const char *value)
+{
+	size_t h = ul_hash_str(name, UL_HASH_INIT);
+
+	h = ul_hash_str("=", h);
+	return ul_hash_str(value, h);
+}
+
+/*
+ * The same for the binary cache file; it's FNV-1a 32 for all architectures,
+ * the file may be shared by 32-bit and 64-bit processes.
+ */
+static uint32_t fnv32_str(const char *s, uint32_t h)
+{
+	for (; s && *s; s++)
+		h = (h ^ (unsigned char) *s) * UL_HASH_PRIME;
+	return h;
+}
+
+uint32_t blkid_bincache_hash(const char *name, const char *value)
+{
+	return fnv32_str(value, fnv32_str("=", fnv32_str(name, UL_HASH_INIT)));
+}
+
+static inline struct list_head *tag_bucket(blkid_cache cache,
+					   const char *name, const char *value)
+{
+	return &cache->bic_hash[blkid_tag_hash(name, value) % cache->bic_nhash];
+}
+
+static int tag_hash_resize(blkid_cache cache, size_t nhash)
+{
+	struct list_head *hash;
+	size_t i;
+
+	hash = malloc(nhash * sizeof(struct list_head));
+	if (!hash)
+		return -BLKID_ERR_MEM;
+	for (i = 0; i < nhash; i++)
+		INIT_LIST_HEAD(&hash[i]);
+
+	for (i = 0; i < cache->bic_nhash; i++) {
+		while (!list_empty(&cache->bic_hash[i])) {
+			blkid_tag t = list_entry(cache->bic_hash[i].next,
+						 struct blkid_struct_tag, bit_hash);
+			size_t h = blkid_tag_hash(t->bit_name, t->bit_val) % nhash;
+
+			list_del(&t->bit_hash);
+			list_add_tail(&t->bit_hash, &hash[h]);
+		}
+	}
+
+	DBG(TAG, ul_debugobj(cache, "tags hash resized %zu -> %zu buckets",
+				cache->bic_nhash, nhash));
+	free(cache->bic_hash);
+	cache->bic_hash = hash;
+	cache->bic_nhash = nhash;
+	return 0;
+}
+
+int blkid_init_tag_hash(blkid_cache cache)
+{
+	return tag_hash_resize(cache, BLKID_TAG_HASH_MIN);
+}
+
+static void tag_hash_add(blkid_cache cache, blkid_tag tag)
+{
+	/* keep the load factor below 2, it's fine to continue on ENOMEM */
+	if (tag->bit_val && ++cache->bic_nhashed > cache->bic_nhash * 2)
+		tag_hash_resize(cache, cache->bic_nhash * 4);
+
+	list_add_tail(&tag->bit_hash,
+		      tag_bucket(cache, tag->bit_name, tag->bit_val));
+}
+
+static void tag_hash_del(blkid_tag tag)
+{
+	if (list_empty(&tag->bit_hash))
+		return;
+	list_del_init(&tag->bit_hash);
+	if (tag->bit_val && tag->bit_dev && tag->bit_dev->bid_cache)
+		tag->bit_dev->bid_cache->bic_nhashed--;
+}
+
 void blkid_free_tag(blkid_tag tag)
 {
 	if (!tag)
@@ -40,6 +131,7 @@ void blkid_free_tag(blkid_tag tag)
 
 	list_del(&tag->bit_tags);	/* list of tags for this device */
 	list_del(&tag->bit_names);	/* list of tags with this type */
+	tag_hash_del(tag);		/* NAME=value index */
 
 	free(tag->bit_name);
 	free(tag->bit_val);
@@ -85,14 +177,15 @@ int blkid_dev_has_tag(blkid_dev dev, const char *type,
 static blkid_tag blkid_find_head_cache(blkid_cache cache, const char *type)
 {
 	blkid_tag head = NULL, tmp;
-	struct list_head *p;
+	struct list_head *p, *bucket;
 
 	if (!cache || !type)
 		return NULL;
 
-	list_for_each(p, &cache->bic_tags) {
-		tmp = list_entry(p, struct blkid_struct_tag, bit_tags);
-		if (!strcmp(tmp->bit_name, type)) {
+	bucket = tag_bucket(cache, type, NULL);
+	list_for_each(p, bucket) {
+		tmp = list_entry(p, struct blkid_struct_tag, bit_hash);
+		if (!tmp->bit_val && !strcmp(tmp->bit_name, type)) {
 			DBG(TAG, ul_debug("found cache tag head %s", type));
 			head = tmp;
 			break;
@@ -139,8 +232,12 @@ int blkid_set_tag(blkid_dev dev, const char *name,
 			return 0;
 		}
 		DBG(TAG, ul_debugobj(t, "update (%s) '%s' -> '%s'", t->bit_name, t->bit_val, val));
+		if (dev->bid_cache)
+			tag_hash_del(t);
 		free(t->bit_val);
 		t->bit_val = val;
+		if (dev->bid_cache)
+			tag_hash_add(dev->bid_cache, t);
 	} else {
 		/* Existing tag not present, add to device */
 		if (!(t = blkid_new_tag()))
@@ -166,8 +263,10 @@ int blkid_set_tag(blkid_dev dev, const char *name,
 					goto errout;
 				list_add_tail(&head->bit_tags,
 					      &dev->bid_cache->bic_tags);
+				tag_hash_add(dev->bid_cache, head);
 			}
 			list_add_tail(&t->bit_names, &head->bit_names);
+			tag_hash_add(dev->bid_cache, t);
 		}
 	}
 
@@ -322,10 +421,9 @@ blkid_dev blkid_find_dev_with_tag(blkid_cache cache,
 					 const char *type,
 					 const char *value)
 {
-	blkid_tag	head;
 	blkid_dev	dev;
 	int		pri;
-	struct list_head *p;
+	struct list_head *p, *bucket;
 	int		probe_new = 0;
 
 	if (!cache || !type || !value)
@@ -338,19 +436,22 @@ blkid_dev blkid_find_dev_with_tag(blkid_cache cache,
 try_again:
 	pri = -1;
 	dev = NULL;
-	head = blkid_find_head_cache(cache, type);
-
-	if (head) {
-		list_for_each(p, &head->bit_names) {
-			blkid_tag tmp = list_entry(p, struct blkid_struct_tag,
-						   bit_names);
-
-			if (!strcmp(tmp->bit_val, value) &&
-			    (tmp->bit_dev->bid_pri > pri) &&
-			    !access(tmp->bit_dev->bid_name, F_OK)) {
-				dev = tmp->bit_dev;
-				pri = dev->bid_pri;
-			}
+
+	/* add candidates from the binary cache file */
+	if (cache->bic_map)
+		blkid_load_mapped_tag(cache, type, value);
+	bucket = tag_bucket(cache, type, value);
+
+	list_for_each(p, bucket) {
+		blkid_tag tmp = list_entry(p, struct blkid_struct_tag, bit_hash);
+
+		if (tmp->bit_val && tmp->bit_dev &&
+		    (tmp->bit_dev->bid_pri > pri) &&
+		    !strcmp(tmp->bit_val, value) &&
+		    !strcmp(tmp->bit_name, type) &&
+		    !access(tmp->bit_dev->bid_name, F_OK)) {
+			dev = tmp->bit_dev;
+			pri = dev->bid_pri;
 		}
 	}
 	if (dev && !(dev->bid_flags & BLKID_BID_FL_VERIFIED)) {
@@ -388,9 +489,108 @@ static void __attribute__((__noreturn__)) usage(char *prog)
 		"[type value]\n",
 		prog);
 	fprintf(stderr, "\tList all tags for a device and exit\n");
+	fprintf(stderr, "       %s -H <count>\n", prog);
+	fprintf(stderr, "\tTest NAME=value index with <count> fake devices\n");
 	exit(1);
 }
 
+/* returns number of hashed NAME=value tags, @dev is the expected owner */
+static int hash_lookup(blkid_cache cache, blkid_dev dev,
+		       const char *name, const char *value)
+{
+	struct list_head *p;
+	int ct = 0;
+
+	list_for_each(p, tag_bucket(cache, name, value)) {
+		blkid_tag t = list_entry(p, struct blkid_struct_tag, bit_hash);
+
+		if (t->bit_val && !strcmp(t->bit_name, name)
+		    && !strcmp(t->bit_val, value)) {
+			if (t->bit_dev != dev)
+				fprintf(stderr, "%s=%s: wrong device\n", name, value);
+			ct++;
+		}
+	}
+	return ct;
+}
+
+static int test_hash(int count)
+{
+	blkid_cache cache = NULL;
+	blkid_dev *devs;
+	char name[64], value[64];
+	int i, found, nerrs = 0;
+
+	if (blkid_get_cache(&cache, "/dev/null") != 0)
+		return EXIT_FAILURE;
+	devs = calloc(count, sizeof(blkid_dev));
+	if (!devs)
+		return EXIT_FAILURE;
+
+	printf("buckets: %zu\n", cache->bic_nhash);
+
+	for (i = 0; i < count; i++) {
+		blkid_dev dev = blkid_new_dev();
+
+		if (!dev)
+			return EXIT_FAILURE;
+		snprintf(name, sizeof(name), "/dev/fake%d", i);
+		dev->bid_name = strdup(name);
+		dev->bid_cache = cache;
+		list_add_tail(&dev->bid_devs, &cache->bic_devs);
+		devs[i] = dev;
+
+		snprintf(value, sizeof(value), "uuid-%d", i);
+		blkid_set_tag(dev, "UUID", value, strlen(value));
+		snprintf(value, sizeof(value), "label-%d", i);
+		blkid_set_tag(dev, "LABEL", value, strlen(value));
+	}
+	printf("added: %d devices, %zu tags, %zu buckets\n",
+		count, cache->bic_nhashed, cache->bic_nhash);
+
+	for (found = 0, i = 0; i < count; i++) {
+		snprintf(value, sizeof(value), "uuid-%d", i);
+		found += hash_lookup(cache, devs[i], "UUID", value);
+		snprintf(value, sizeof(value), "label-%d", i);
+		found += hash_lookup(cache, devs[i], "LABEL", value);
+	}
+	printf("found: %d\n", found);
+
+	/* remove LABEL from the odd devices, change UUID of the even ones */
+	for (i = 0; i < count; i++) {
+		if (i % 2)
+			blkid_set_tag(devs[i], "LABEL", NULL, 0);
+		else {
+			snprintf(value, sizeof(value), "new-uuid-%d", i);
+			blkid_set_tag(devs[i], "UUID", value, strlen(value));
+		}
+	}
+	printf("modified: %zu tags\n", cache->bic_nhashed);
+
+	for (found = 0, i = 0; i < count; i++) {
+		int old, new;
+
+		snprintf(value, sizeof(value), "label-%d", i);
+		found += hash_lookup(cache, devs[i], "LABEL", value);
+
+		snprintf(value, sizeof(value), "uuid-%d", i);
+		old = hash_lookup(cache, devs[i], "UUID", value);
+		snprintf(value, sizeof(value), "new-uuid-%d", i);
+		new = hash_lookup(cache, devs[i], "UUID", value);
+		found += old + new;
+
+		if (blkid_dev_has_tag(devs[i], "LABEL", NULL) != !(i % 2)
+		    || old != i % 2 || new != !(i % 2))
+			nerrs++;
+	}
+	printf("found: %d, errors: %d\n", found, nerrs);
+
+	free(devs);
+	cache->bic_flags &= ~BLKID_BIC_FL_CHANGED;
+	blkid_put_cache(cache);
+	return nerrs ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
 int main(int argc, char **argv)
 {
 	blkid_tag_iterate	iter;
@@ -405,11 +605,13 @@ int main(int argc, char **argv)
 	char			*search_value = NULL;
 	const char		*type, *value;
 
-	while ((c = getopt (argc, argv, "m:f:")) != EOF)
+	while ((c = getopt (argc, argv, "m:f:H:")) != EOF)
 		switch (c) {
 		case 'f':
 			file = optarg;
 			break;
+		case 'H':
+			return test_hash(atoi(optarg));
 		case 'm':
 		{
 			int mask = strtoul (optarg, &tmp, 0);
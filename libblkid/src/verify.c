@@ -23,6 +23,22 @@
 #include "blkidP.h"
 #include "sysfs.h"
 
+static void blkid_value_to_tag(blkid_dev dev, const char *name,
+			       const char *data, size_t len)
+{
+	if (strncmp(name, "PART_ENTRY_", 11) == 0) {
+		if (strcmp(name, "PART_ENTRY_UUID") == 0)
+			blkid_set_tag(dev, "PARTUUID", data, len);
+		else if (strcmp(name, "PART_ENTRY_NAME") == 0)
+			blkid_set_tag(dev, "PARTLABEL", data, len);
+
+	} else if (!strstr(name, "_ID")) {
+		/* superblock UUID, LABEL, ...
+		 * but not {SYSTEM,APPLICATION,..._ID} */
+		blkid_set_tag(dev, name, data, len);
+	}
+}
+
 static void blkid_probe_to_tags(blkid_probe pr, blkid_dev dev)
 {
 	const char *data;
@@ -35,20 +51,78 @@ static void blkid_probe_to_tags(blkid_probe pr, blkid_dev dev)
 	for (n = 0; n < nvals; n++) {
 		if (blkid_probe_get_value(pr, n, &name, &data, &len) != 0)
 			continue;
-		if (strncmp(name, "PART_ENTRY_", 11) == 0) {
-			if (strcmp(name, "PART_ENTRY_UUID") == 0)
-				blkid_set_tag(dev, "PARTUUID", data, len);
-			else if (strcmp(name, "PART_ENTRY_NAME") == 0)
-				blkid_set_tag(dev, "PARTLABEL", data, len);
-
-		} else if (!strstr(name, "_ID")) {
-			/* superblock UUID, LABEL, ...
-			 * but not {SYSTEM,APPLICATION,..._ID} */
-			blkid_set_tag(dev, name, data, len);
-		}
+		blkid_value_to_tag(dev, name, data, len);
 	}
 }
 
+static void blkid_prefetched_to_tags(struct blkid_prefetched *pf, blkid_dev dev)
+{
+	size_t n;
+
+	for (n = 0; n < pf->nvals; n++)
+		blkid_value_to_tag(dev, pf->vals[n].name,
+				   pf->vals[n].data, pf->vals[n].len);
+}
+
+/*
+ * Returns 1 if the cached @dev does not have to be read again, @st is the
+ * current stat() of the device. The device diskseq is stored to @diskseq,
+ * it's read from sysfs for REVALIDATE=diskseq only.
+ */
+static int is_unmodified(blkid_cache cache, blkid_dev dev,
+			 const struct stat *st, time_t now, uint64_t *diskseq)
+{
+	time_t diff = (uintmax_t)now - dev->bid_time;
+	int unmodified;
+
+	/* the kernel increments diskseq when a new media is attached */
+	*diskseq = 0;
+	if ((cache->bic_flags & BLKID_BIC_FL_DISKSEQ) && S_ISBLK(st->st_mode) &&
+	    sysfs_devno_get_diskseq(st->st_rdev, diskseq) != 0)
+		*diskseq = 0;
+
+	unmodified = now >= dev->bid_time &&
+#ifdef HAVE_STRUCT_STAT_ST_MTIM_TV_NSEC
+	    (st->st_mtime < dev->bid_time ||
+	        (st->st_mtime == dev->bid_time &&
+		 st->st_mtim.tv_nsec / 1000 <= dev->bid_utime)) &&
+#else
+	    st->st_mtime <= dev->bid_time &&
+#endif
+	    (!*diskseq || !dev->bid_diskseq || *diskseq == dev->bid_diskseq);
+
+	if (unmodified && diff >= 0 && diff < BLKID_PROBE_MIN)
+		return 1;
+
+	/*
+	 * REVALIDATE=diskseq: the same media and the device node has not
+	 * been modified since the last probe, don't read the device again.
+	 */
+	if (unmodified && *diskseq && *diskseq == dev->bid_diskseq &&
+	    st->st_rdev == dev->bid_devno) {
+		DBG(PROBE, ul_debug("%s: diskseq %ju unchanged", dev->bid_name,
+					(uintmax_t) *diskseq));
+		return 1;
+	}
+	return 0;
+}
+
+/*
+ * Returns 1 if blkid_verify() would read the device, used to select
+ * devices for prefetching.
+ */
+int blkid_verify_needed(blkid_cache cache, blkid_dev dev)
+{
+	struct stat st;
+	uint64_t diskseq;
+
+	if (dev->bid_flags & BLKID_BID_FL_VERIFIED)
+		return 0;
+	if (stat(dev->bid_name, &st) < 0)
+		return 0;
+	return !is_unmodified(cache, dev, &st, time(NULL), &diskseq);
+}
+
 /*
  * Verify that the data in dev is consistent with what is on the actual
  * block device (using the devname field only).  Normally this will be
@@ -62,9 +136,11 @@ blkid_dev blkid_verify(blkid_cache cache, blkid_dev dev)
 {
 	blkid_tag_iterate iter;
 	const char *type, *value;
+	struct blkid_prefetched *pf;
 	struct stat st;
 	time_t diff, now;
-	int fd;
+	uint64_t diskseq = 0;
+	int fd = -1, rc;
 
 	if (!dev || !cache)
 		return NULL;
@@ -87,58 +163,58 @@ blkid_dev blkid_verify(blkid_cache cache, blkid_dev dev)
 		return NULL;
 	}
 
-	if (now >= dev->bid_time &&
-#ifdef HAVE_STRUCT_STAT_ST_MTIM_TV_NSEC
-	    (st.st_mtime < dev->bid_time ||
-	        (st.st_mtime == dev->bid_time &&
-		 st.st_mtim.tv_nsec / 1000 <= dev->bid_utime)) &&
-#else
-	    st.st_mtime <= dev->bid_time &&
-#endif
-	    diff >= 0 && diff < BLKID_PROBE_MIN) {
+	if (is_unmodified(cache, dev, &st, now, &diskseq)) {
 		dev->bid_flags |= BLKID_BID_FL_VERIFIED;
 		return dev;
 	}
 
 #ifndef HAVE_STRUCT_STAT_ST_MTIM_TV_NSEC
 	DBG(PROBE, ul_debug("need to revalidate %s (cache time %lld, stat time %lld,\t"
-		   "time since last check %lld)",
+		   "time since last check %lld, diskseq %ju -> %ju)",
 		   dev->bid_name, (long long)dev->bid_time,
-		   (long long)st.st_mtime, (long long)diff));
+		   (long long)st.st_mtime, (long long)diff,
+		   (uintmax_t)dev->bid_diskseq, (uintmax_t)diskseq));
 #else
 	DBG(PROBE, ul_debug("need to revalidate %s (cache time %lld.%lld, stat time %lld.%lld,\t"
-		   "time since last check %lld)",
+		   "time since last check %lld, diskseq %ju -> %ju)",
 		   dev->bid_name,
 		   (long long)dev->bid_time, (long long)dev->bid_utime,
 		   (long long)st.st_mtime, (long long)st.st_mtim.tv_nsec / 1000,
-		   (long long)diff));
+		   (long long)diff,
+		   (uintmax_t)dev->bid_diskseq, (uintmax_t)diskseq));
 #endif
 
 	if (sysfs_devno_is_dm_private(st.st_rdev, NULL)) {
 		blkid_free_dev(dev);
 		return NULL;
 	}
-	if (!cache->probe) {
-		cache->probe = blkid_new_probe();
+	/* already read by blkid_probe_all() workers */
+	pf = blkid_get_prefetched(cache, st.st_rdev);
+	if (pf)
+		DBG(PROBE, ul_debug("using prefetched result for %s", dev->bid_name));
+	else {
 		if (!cache->probe) {
-			blkid_free_dev(dev);
-			return NULL;
+			cache->probe = blkid_new_probe();
+			if (!cache->probe) {
+				blkid_free_dev(dev);
+				return NULL;
+			}
 		}
-	}
 
-	fd = open(dev->bid_name, O_RDONLY|O_CLOEXEC|O_NONBLOCK);
-	if (fd < 0) {
-		DBG(PROBE, ul_debug("blkid_verify: error %s (%d) while "
-					"opening %s", strerror(errno), errno,
-					dev->bid_name));
-		goto open_err;
-	}
+		fd = open(dev->bid_name, O_RDONLY|O_CLOEXEC|O_NONBLOCK);
+		if (fd < 0) {
+			DBG(PROBE, ul_debug("blkid_verify: error %s (%d) while "
+						"opening %s", strerror(errno), errno,
+						dev->bid_name));
+			goto open_err;
+		}
 
-	if (blkid_probe_set_device(cache->probe, fd, 0, 0)) {
-		/* failed to read the device */
-		close(fd);
-		blkid_free_dev(dev);
-		return NULL;
+		if (blkid_probe_set_device(cache->probe, fd, 0, 0)) {
+			/* failed to read the device */
+			close(fd);
+			blkid_free_dev(dev);
+			return NULL;
+		}
 	}
 
 	/* remove old cache info */
@@ -147,18 +223,24 @@ blkid_dev blkid_verify(blkid_cache cache, blkid_dev dev)
 		blkid_set_tag(dev, type, NULL, 0);
 	blkid_tag_iterate_end(iter);
 
-	/* enable superblocks probing */
-	blkid_probe_enable_superblocks(cache->probe, TRUE);
-	blkid_probe_set_superblocks_flags(cache->probe,
-		BLKID_SUBLKS_LABEL | BLKID_SUBLKS_UUID |
-		BLKID_SUBLKS_TYPE | BLKID_SUBLKS_SECTYPE);
+	if (pf) {
+		rc = pf->rc;
+	} else {
+		/* enable superblocks probing */
+		blkid_probe_enable_superblocks(cache->probe, TRUE);
+		blkid_probe_set_superblocks_flags(cache->probe,
+			BLKID_SUBLKS_LABEL | BLKID_SUBLKS_UUID |
+			BLKID_SUBLKS_TYPE | BLKID_SUBLKS_SECTYPE);
+
+		/* enable partitions probing */
+		blkid_probe_enable_partitions(cache->probe, TRUE);
+		blkid_probe_set_partitions_flags(cache->probe, BLKID_PARTS_ENTRY_DETAILS);
 
-	/* enable partitions probing */
-	blkid_probe_enable_partitions(cache->probe, TRUE);
-	blkid_probe_set_partitions_flags(cache->probe, BLKID_PARTS_ENTRY_DETAILS);
+		/* probe */
+		rc = blkid_do_safeprobe(cache->probe);
+	}
 
-	/* probe */
-	if (blkid_do_safeprobe(cache->probe)) {
+	if (rc) {
 		/* found nothing or error */
 		blkid_free_dev(dev);
 		dev = NULL;
@@ -175,19 +257,28 @@ blkid_dev blkid_verify(blkid_cache cache, blkid_dev dev)
 			dev->bid_time = time(NULL);
 
 		dev->bid_devno = st.st_rdev;
+		dev->bid_diskseq = diskseq;
 		dev->bid_flags |= BLKID_BID_FL_VERIFIED;
 		cache->bic_flags |= BLKID_BIC_FL_CHANGED;
 
-		blkid_probe_to_tags(cache->probe, dev);
+		if (pf)
+			blkid_prefetched_to_tags(pf, dev);
+		else
+			blkid_probe_to_tags(cache->probe, dev);
 
 		DBG(PROBE, ul_debug("%s: devno 0x%04llx, type %s",
 			   dev->bid_name, (long long)st.st_rdev, dev->bid_type));
 	}
 
-	/* reset prober */
-	blkid_probe_reset_superblocks_filter(cache->probe);
-	blkid_probe_set_device(cache->probe, -1, 0, 0);
-	close(fd);
+	if (pf) {
+		/* use the result only once, later calls read the device */
+		pf->done = 0;
+	} else {
+		/* reset prober */
+		blkid_probe_reset_superblocks_filter(cache->probe);
+		blkid_probe_set_device(cache->probe, -1, 0, 0);
+		close(fd);
+	}
 
 	return dev;
 }
@@ -44,6 +44,8 @@
 #define MNT_CACHE_ISPATH	(1 << 2) /* entry is path */
 #define MNT_CACHE_TAGREAD	(1 << 3) /* tag read by mnt_cache_read_tags() */
 
+#define MNT_CACHE_IDX_MINSZ	64	/* initial number of index slots */
+
 /* path cache entry */
 struct mnt_cache_entry {
 	char			*key;	/* search key (e.g. uncanonicalized path) */
@@ -51,12 +53,35 @@ struct mnt_cache_entry {
 	int			flag;
 };
 
+/*
+ * Open-addressing (linear probing) index to cache->ents[]. The slot contains
+ * entry index + 1 (zero is unused slot) and hash of the entry key. The entries
+ * are never removed from the cache, so there are no tombstones.
+ */
+struct mnt_cache_slot {
+	size_t			ent;
+	size_t			hash;
+};
+
+struct mnt_cache_idx {
+	struct mnt_cache_slot	*slots;
+	size_t			nslots;	/* always power of 2 */
+	size_t			nused;
+};
+
 struct libmnt_cache {
 	struct mnt_cache_entry	*ents;
 	size_t			nents;
 	size_t			nallocs;
 	int			refcount;
 
+	struct mnt_cache_idx	paths;	/* ISPATH entries by key (path) */
+	struct mnt_cache_idx	tags;	/* ISTAG entries by key (tag name and value) */
+	struct mnt_cache_idx	devs;	/* ISTAG entries by value (devname) */
+
+	size_t			nhits;
+	size_t			nmisses;
+
 	/* blkid_evaluate_tag() works in two ways:
 	 *
 	 * 1/ all tags are evaluated by udev /dev/disk/by-* symlinks,
@@ -100,7 +125,9 @@ void mnt_free_cache(struct libmnt_cache *cache)
 	if (!cache)
 		return;
 
-	DBG(CACHE, ul_debugobj(cache, "free [refcount=%d]", cache->refcount));
+	DBG(CACHE, ul_debugobj(cache, "free [refcount=%d, entries=%zu, hits=%zu, misses=%zu]",
+				cache->refcount, cache->nents,
+				cache->nhits, cache->nmisses));
 
 	for (i = 0; i < cache->nents; i++) {
 		struct mnt_cache_entry *e = &cache->ents[i];
@@ -109,6 +136,9 @@ void mnt_free_cache(struct libmnt_cache *cache)
 		free(e->key);
 	}
 	free(cache->ents);
+	free(cache->paths.slots);
+	free(cache->tags.slots);
+	free(cache->devs.slots);
 	if (cache->bc)
 		blkid_put_cache(cache->bc);
 	free(cache);
@@ -171,6 +201,76 @@ int mnt_cache_set_targets(struct libmnt_cache *cache,
 }
 
 
+static size_t hash_tag(const char *token, const char *value)
+{
+	/* hash "TAG_NAME\0TAG_VALUE" */
+	size_t h = ul_hash_str(token, UL_HASH_INIT);
+
+	h *= UL_HASH_PRIME;
+	return ul_hash_str(value, h);
+}
+
+static void idx_insert(struct mnt_cache_idx *idx, size_t h, size_t n)
+{
+	size_t mask = idx->nslots - 1, i;
+
+	for (i = h & mask; idx->slots[i].ent; i = (i + 1) & mask);
+
+	idx->slots[i].ent = n + 1;
+	idx->slots[i].hash = h;
+	idx->nused++;
+}
+
+/* make sure there is space for one more entry in the index */
+static int idx_reserve(struct mnt_cache_idx *idx)
+{
+	struct mnt_cache_slot *slots, *old;
+	size_t oldsz, i, sz;
+
+	if ((idx->nused + 1) * 2 <= idx->nslots)
+		return 0;
+
+	sz = idx->nslots ? idx->nslots * 2 : MNT_CACHE_IDX_MINSZ;
+	slots = calloc(sz, sizeof(struct mnt_cache_slot));
+	if (!slots)
+		return -ENOMEM;
+
+	old = idx->slots;
+	oldsz = idx->nslots;
+
+	idx->slots = slots;
+	idx->nslots = sz;
+	idx->nused = 0;
+
+	for (i = 0; i < oldsz; i++) {
+		if (old[i].ent)
+			idx_insert(idx, old[i].hash, old[i].ent - 1);
+	}
+	free(old);
+	return 0;
+}
+
+/* returns the next entry with @h hash, *@i is the probing position */
+static struct mnt_cache_entry *idx_next(struct libmnt_cache *cache,
+					struct mnt_cache_idx *idx,
+					size_t h, size_t *i)
+{
+	size_t mask = idx->nslots - 1;
+
+	if (!idx->nslots)
+		return NULL;
+	if (*i == (size_t) -1)
+		*i = h & mask;
+	else
+		*i = (*i + 1) & mask;
+
+	for (; idx->slots[*i].ent; *i = (*i + 1) & mask) {
+		if (idx->slots[*i].hash == h)
+			return &cache->ents[idx->slots[*i].ent - 1];
+	}
+	return NULL;
+}
+
 /* note that the @key could be the same pointer as @value */
 static int cache_add_entry(struct libmnt_cache *cache, char *key,
 					char *value, int flag)
@@ -191,10 +291,24 @@ static int cache_add_entry(struct libmnt_cache *cache, char *key,
 		cache->nallocs = sz;
 	}
 
+	if (flag & MNT_CACHE_ISPATH) {
+		if (idx_reserve(&cache->paths))
+			return -ENOMEM;
+	} else if (idx_reserve(&cache->tags) ||
+		   idx_reserve(&cache->devs))
+		return -ENOMEM;
+
 	e = &cache->ents[cache->nents];
 	e->key = key;
 	e->value = value;
 	e->flag = flag;
+
+	if (flag & MNT_CACHE_ISPATH)
+		idx_insert(&cache->paths, ul_hash_path(key, UL_HASH_INIT), cache->nents);
+	else {
+		idx_insert(&cache->tags, hash_tag(key, key + strlen(key) + 1), cache->nents);
+		idx_insert(&cache->devs, ul_hash_str(value, UL_HASH_INIT), cache->nents);
+	}
 	cache->nents++;
 
 	DBG(CACHE, ul_debugobj(cache, "add entry [%2zd] (%s): %s: %s",
@@ -245,18 +359,20 @@ static int cache_add_tag(struct libmnt_cache *cache, const char *tagname,
  */
 static const char *cache_find_path(struct libmnt_cache *cache, const char *path)
 {
-	size_t i;
+	struct mnt_cache_entry *e;
+	size_t h, i = (size_t) -1;
 
 	if (!cache || !path)
 		return NULL;
 
-	for (i = 0; i < cache->nents; i++) {
-		struct mnt_cache_entry *e = &cache->ents[i];
-		if (!(e->flag & MNT_CACHE_ISPATH))
-			continue;
-		if (streq_paths(path, e->key))
+	h = ul_hash_path(path, UL_HASH_INIT);
+	while ((e = idx_next(cache, &cache->paths, h, &i))) {
+		if (streq_paths(path, e->key)) {
+			cache->nhits++;
 			return e->value;
+		}
 	}
+	cache->nmisses++;
 	return NULL;
 }
 
@@ -266,21 +382,46 @@ static const char *cache_find_path(struct libmnt_cache *cache, const char *path)
 static const char *cache_find_tag(struct libmnt_cache *cache,
 			const char *token, const char *value)
 {
-	size_t i;
+	struct mnt_cache_entry *e;
+	size_t h, i = (size_t) -1;
 	size_t tksz;
 
 	if (!cache || !token || !value)
 		return NULL;
 
 	tksz = strlen(token);
+	h = hash_tag(token, value);
 
-	for (i = 0; i < cache->nents; i++) {
-		struct mnt_cache_entry *e = &cache->ents[i];
-		if (!(e->flag & MNT_CACHE_ISTAG))
-			continue;
+	while ((e = idx_next(cache, &cache->tags, h, &i))) {
 		if (strcmp(token, e->key) == 0 &&
-		    strcmp(value, e->key + tksz + 1) == 0)
+		    strcmp(value, e->key + tksz + 1) == 0) {
+			cache->nhits++;
 			return e->value;
+		}
+	}
+	cache->nmisses++;
+	return NULL;
+}
+
+/*
+ * Returns the first tag entry for @devname with @flag, or with @token if
+ * @token is not NULL.
+ */
+static struct mnt_cache_entry *cache_find_dev_entry(struct libmnt_cache *cache,
+			const char *devname, const char *token, int flag)
+{
+	struct mnt_cache_entry *e;
+	size_t h, i = (size_t) -1;
+
+	h = ul_hash_str(devname, UL_HASH_INIT);
+	while ((e = idx_next(cache, &cache->devs, h, &i))) {
+		if (strcmp(e->value, devname) != 0)		/* dev name */
+			continue;
+		if ((e->flag & flag) != flag)
+			continue;
+		if (token && strcmp(token, e->key) != 0)	/* tag name */
+			continue;
+		return e;
 	}
 	return NULL;
 }
@@ -288,22 +429,19 @@ static const char *cache_find_tag(struct libmnt_cache *cache,
 static char *cache_find_tag_value(struct libmnt_cache *cache,
 			const char *devname, const char *token)
 {
-	size_t i;
+	struct mnt_cache_entry *e;
 
 	assert(cache);
 	assert(devname);
 	assert(token);
 
-	for (i = 0; i < cache->nents; i++) {
-		struct mnt_cache_entry *e = &cache->ents[i];
-		if (!(e->flag & MNT_CACHE_ISTAG))
-			continue;
-		if (strcmp(e->value, devname) == 0 &&	/* dev name */
-		    strcmp(token, e->key) == 0)	/* tag name */
-			return e->key + strlen(token) + 1;	/* tag value */
+	e = cache_find_dev_entry(cache, devname, token, MNT_CACHE_ISTAG);
+	if (!e) {
+		cache->nmisses++;
+		return NULL;
 	}
-
-	return NULL;
+	cache->nhits++;
+	return e->key + strlen(token) + 1;	/* tag value */
 }
 
 /**
@@ -330,14 +468,9 @@ int mnt_cache_read_tags(struct libmnt_cache *cache, const char *devname)
 	DBG(CACHE, ul_debugobj(cache, "tags for %s requested", devname));
 
 	/* check if device is already cached */
-	for (i = 0; i < cache->nents; i++) {
-		struct mnt_cache_entry *e = &cache->ents[i];
-		if (!(e->flag & MNT_CACHE_TAGREAD))
-			continue;
-		if (strcmp(e->value, devname) == 0)
-			/* tags have already been read */
-			return 0;
-	}
+	if (cache_find_dev_entry(cache, devname, NULL, MNT_CACHE_TAGREAD))
+		/* tags have already been read */
+		return 0;
 
 	pr =  blkid_new_probe_from_filename(devname);
 	if (!pr)
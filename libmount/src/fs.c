@@ -22,6 +22,7 @@
 
 #include "mountP.h"
 #include "strutils.h"
+#include "mangle.h"
 
 /**
  * mnt_new_fs:
@@ -79,21 +80,23 @@ void mnt_reset_fs(struct libmnt_fs *fs)
 	ref = fs->refcount;
 
 	list_del(&fs->ents);
-	free(fs->source);
+	__mnt_fs_free_string(fs, fs->source);
 	free(fs->bindsrc);
 	free(fs->tagname);
 	free(fs->tagval);
-	free(fs->root);
+	__mnt_fs_free_string(fs, fs->root);
 	free(fs->swaptype);
-	free(fs->target);
-	free(fs->fstype);
+	__mnt_fs_free_string(fs, fs->target);
+	__mnt_fs_free_string(fs, fs->fstype);
 	free(fs->optstr);
 	free(fs->vfs_optstr);
 	free(fs->fs_optstr);
 	free(fs->user_optstr);
 	free(fs->attrs);
-	free(fs->opt_fields);
+	__mnt_fs_free_string(fs, fs->opt_fields);
 	free(fs->comment);
+	__mnt_fs_free_string(fs, fs->line);
+	mnt_unref_arena(fs->arena);
 
 	memset(fs, 0, sizeof(*fs));
 	INIT_LIST_HEAD(&fs->ents);
@@ -131,6 +134,55 @@ void mnt_unref_fs(struct libmnt_fs *fs)
 	}
 }
 
+/*
+ * The parser stores some strings in the table arena (see tab_parse.c), don't
+ * call free() for these strings.
+ */
+void __mnt_fs_free_string(struct libmnt_fs *fs, char *str)
+{
+	if (str && fs->arena && str >= fs->arena->data
+	    && str < fs->arena->data + fs->arena->size)
+		return;
+	free(str);
+}
+
+/* like strdup_to_struct_member(), but aware of fs->arena */
+static int set_string(struct libmnt_fs *fs, char **member, int mangled,
+		      const char *str)
+{
+	char *p = NULL;
+
+	if (!fs)
+		return -EINVAL;
+	if (str) {
+		p = strdup(str);
+		if (!p)
+			return -ENOMEM;
+	}
+
+	__mnt_fs_free_string(fs, *member);
+	*member = p;
+	fs->mangled &= ~mangled;
+	return 0;
+}
+
+/* unmangles the string from the parser in place, see MNT_FS_MANGLED_* */
+static char *get_unmangled(struct libmnt_fs *fs, char *str, int mangled)
+{
+	if (fs->mangled & mangled) {
+		unmangle_string(str);
+		fs->mangled &= ~mangled;
+	}
+	return str;
+}
+
+/* the copy functions use the struct members directly */
+static void unmangle_strings(struct libmnt_fs *fs)
+{
+	get_unmangled(fs, fs->target, MNT_FS_MANGLED_TARGET);
+	get_unmangled(fs, fs->root, MNT_FS_MANGLED_ROOT);
+}
+
 static inline int update_str(char **dest, const char *src)
 {
 	size_t sz;
@@ -194,6 +246,8 @@ struct libmnt_fs *mnt_copy_fs(struct libmnt_fs *dest,
 		dest->tab	 = NULL;
 	}
 
+	unmangle_strings((struct libmnt_fs *) src);
+
 	dest->id         = src->id;
 	dest->parent     = src->parent;
 	dest->devno      = src->devno;
@@ -255,6 +309,8 @@ struct libmnt_fs *mnt_copy_mtab_fs(const struct libmnt_fs *fs)
 	if (!n)
 		return NULL;
 
+	unmangle_strings((struct libmnt_fs *) fs);
+
 	if (strdup_between_structs(n, fs, source))
 		goto err;
 	if (strdup_between_structs(n, fs, target))
@@ -380,7 +436,7 @@ int __mnt_fs_set_source_ptr(struct libmnt_fs *fs, char *source)
 	}
 
 	if (fs->source != source)
-		free(fs->source);
+		__mnt_fs_free_string(fs, fs->source);
 
 	free(fs->tagname);
 	free(fs->tagval);
@@ -388,6 +444,9 @@ int __mnt_fs_set_source_ptr(struct libmnt_fs *fs, char *source)
 	fs->source = source;
 	fs->tagname = t;
 	fs->tagval = v;
+
+	if (fs->tab)
+		mnt_table_reset_index(fs->tab);
 	return 0;
 }
 
@@ -535,7 +594,7 @@ int mnt_fs_get_tag(struct libmnt_fs *fs, const char **name, const char **value)
  */
 const char *mnt_fs_get_target(struct libmnt_fs *fs)
 {
-	return fs ? fs->target : NULL;
+	return fs ? get_unmangled(fs, fs->target, MNT_FS_MANGLED_TARGET) : NULL;
 }
 
 /**
@@ -549,7 +608,7 @@ const char *mnt_fs_get_target(struct libmnt_fs *fs)
  */
 int mnt_fs_set_target(struct libmnt_fs *fs, const char *tgt)
 {
-	return strdup_to_struct_member(fs, target, tgt);
+	return set_string(fs, &fs->target, MNT_FS_MANGLED_TARGET, tgt);
 }
 
 static int mnt_fs_get_flags(struct libmnt_fs *fs)
@@ -653,7 +712,7 @@ int __mnt_fs_set_fstype_ptr(struct libmnt_fs *fs, char *fstype)
 	assert(fs);
 
 	if (fstype != fs->fstype)
-		free(fs->fstype);
+		__mnt_fs_free_string(fs, fs->fstype);
 
 	fs->fstype = fstype;
 	fs->flags &= ~MNT_FS_PSEUDO;
@@ -669,6 +728,9 @@ int __mnt_fs_set_fstype_ptr(struct libmnt_fs *fs, char *fstype)
 		else if (!strcmp(fs->fstype, "swap"))
 			fs->flags |= MNT_FS_SWAP;
 	}
+
+	if (fs->tab)
+		mnt_table_reset_index(fs->tab);	/* pseudo and net fs are compared in another way */
 	return 0;
 }
 
@@ -1090,7 +1152,7 @@ int mnt_fs_set_passno(struct libmnt_fs *fs, int passno)
  */
 const char *mnt_fs_get_root(struct libmnt_fs *fs)
 {
-	return fs ? fs->root : NULL;
+	return fs ? get_unmangled(fs, fs->root, MNT_FS_MANGLED_ROOT) : NULL;
 }
 
 /**
@@ -1102,7 +1164,7 @@ const char *mnt_fs_get_root(struct libmnt_fs *fs)
  */
 int mnt_fs_set_root(struct libmnt_fs *fs, const char *path)
 {
-	return strdup_to_struct_member(fs, root, path);
+	return set_string(fs, &fs->root, MNT_FS_MANGLED_ROOT, path);
 }
 
 /**
@@ -1350,9 +1412,13 @@ int mnt_fs_append_comment(struct libmnt_fs *fs, const char *comm)
 int mnt_fs_match_target(struct libmnt_fs *fs, const char *target,
 			struct libmnt_cache *cache)
 {
+	const char *tgt;
 	int rc = 0;
 
-	if (!fs || !target || !fs->target)
+	if (!fs || !target)
+		return 0;
+	tgt = mnt_fs_get_target(fs);
+	if (!tgt)
 		return 0;
 
 	/* 1) native paths */
@@ -1365,7 +1431,7 @@ int mnt_fs_match_target(struct libmnt_fs *fs, const char *target,
 
 		/* 3) - canonicalized and canonicalized */
 		if (!rc && cn && !mnt_fs_is_kernel(fs) && !mnt_fs_is_swaparea(fs)) {
-			char *tcn = mnt_resolve_target(fs->target, cache);
+			char *tcn = mnt_resolve_target(tgt, cache);
 			rc = (tcn && strcmp(cn, tcn) == 0);
 		}
 	}
@@ -213,6 +213,13 @@ struct libmnt_fs {
 	int		flags;		/* MNT_FS_* flags */
 	pid_t		tid;		/* /proc/<tid>/mountinfo otherwise zero */
 
+	uint64_t	linehash;	/* hash of the parsed line (see mnt_table_refresh()) */
+	char		*line;		/* the parsed line or NULL (see mnt_table_enable_refresh()) */
+	size_t		linesz;		/* length of the line */
+
+	struct libmnt_arena *arena;	/* parsed strings (source, target, ...) */
+	int		mangled;	/* MNT_FS_MANGLED_* not unmangled strings */
+
 	char		*comment;	/* fstab comment */
 
 	void		*userdata;	/* library independent data */
@@ -227,10 +234,29 @@ struct libmnt_fs {
 #define MNT_FS_KERNEL	(1 << 4) /* data from /proc/{mounts,self/mountinfo} */
 #define MNT_FS_MERGED	(1 << 5) /* already merged data from /run/mount/utab */
 
+/*
+ * The parser does not unmangle target and root, the strings are unmangled on
+ * the first mnt_fs_get_{target,root}() call
+ */
+#define MNT_FS_MANGLED_TARGET	(1 << 1)
+#define MNT_FS_MANGLED_ROOT	(1 << 2)
+
 #define mnt_fs_is_regular(_f)	(!(mnt_fs_is_pseudofs(_f) \
 				   || mnt_fs_is_netfs(_f) \
 				   || mnt_fs_is_swaparea(_f)))
 
+/*
+ * Strings of the parsed entries. The table allocates the strings from its
+ * current arena and every entry references the arena with its strings, so the
+ * entries may outlive the table.
+ */
+struct libmnt_arena {
+	int		refcount;	/* reference counter */
+	size_t		size;		/* size of the data */
+	size_t		used;		/* already allocated bytes */
+	char		data[];
+};
+
 /*
  * mtab/fstab/mountinfo file
  */
@@ -253,8 +279,16 @@ struct libmnt_table {
 
 	struct list_head	ents;	/* list of entries (libmnt_fs) */
 	void		*userdata;
+
+	int		use_index;	/* see mnt_table_enable_index() */
+	int		refresh;	/* see mnt_table_enable_refresh() */
+	struct libmnt_tabidx *idx;	/* lookup index or NULL */
+
+	struct libmnt_arena *arena;	/* strings of the parsed entries */
 };
 
+extern void mnt_table_reset_index(struct libmnt_table *tb);
+
 extern struct libmnt_table *__mnt_new_table_from_file(const char *filename, int fmt, int empty_for_enoent);
 
 /*
@@ -412,6 +446,8 @@ extern int __mnt_fs_set_source_ptr(struct libmnt_fs *fs, char *source)
 			__attribute__((nonnull(1)));
 extern int __mnt_fs_set_fstype_ptr(struct libmnt_fs *fs, char *fstype)
 			__attribute__((nonnull(1)));
+extern void __mnt_fs_free_string(struct libmnt_fs *fs, char *str)
+			__attribute__((nonnull(1)));
 
 /* context.c */
 extern struct libmnt_context *mnt_copy_context(struct libmnt_context *o);
@@ -469,6 +505,9 @@ extern int mnt_context_is_veritydev(struct libmnt_context *cxt)
 extern int mnt_context_setup_veritydev(struct libmnt_context *cxt);
 extern int mnt_context_deferred_delete_veritydev(struct libmnt_context *cxt);
 
+/* tab_parse.c */
+extern void mnt_unref_arena(struct libmnt_arena *ar);
+
 /* tab_update.c */
 extern int mnt_update_set_filename(struct libmnt_update *upd,
 				   const char *filename, int userspace_only);
@@ -115,6 +115,9 @@ int mnt_reset_table(struct libmnt_table *tb)
 		mnt_table_remove_fs(tb, fs);
 	}
 
+	mnt_unref_arena(tb->arena);
+	tb->arena = NULL;
+
 	tb->nents = 0;
 	return 0;
 }
@@ -167,6 +170,7 @@ void mnt_free_table(struct libmnt_table *tb)
 		return;
 
 	mnt_reset_table(tb);
+	mnt_table_reset_index(tb);
 	DBG(TAB, ul_debugobj(tb, "free [refcount=%d]", tb->refcount));
 
 	mnt_unref_cache(tb->cache);
@@ -381,6 +385,7 @@ int mnt_table_set_cache(struct libmnt_table *tb, struct libmnt_cache *mpc)
 	mnt_ref_cache(mpc);			/* new */
 	mnt_unref_cache(tb->cache);		/* old */
 	tb->cache = mpc;
+	mnt_table_reset_index(tb);
 	return 0;
 }
 
@@ -452,6 +457,7 @@ int mnt_table_add_fs(struct libmnt_table *tb, struct libmnt_fs *fs)
 	list_add_tail(&fs->ents, &tb->ents);
 	fs->tab = tb;
 	tb->nents++;
+	mnt_table_reset_index(tb);
 
 	DBG(TAB, ul_debugobj(tb, "add entry: %s %s",
 			mnt_fs_get_source(fs), mnt_fs_get_target(fs)));
@@ -471,6 +477,7 @@ static int __table_insert_fs(
 
 	fs->tab = tb;
 	tb->nents++;
+	mnt_table_reset_index(tb);
 
 	DBG(TAB, ul_debugobj(tb, "insert entry: %s %s",
 			mnt_fs_get_source(fs), mnt_fs_get_target(fs)));
@@ -542,6 +549,7 @@ int mnt_table_move_fs(struct libmnt_table *src, struct libmnt_table *dst,
 	/* remove from source */
 	list_del_init(&fs->ents);
 	src->nents--;
+	mnt_table_reset_index(src);
 
 	/* insert to the destination */
 	return __table_insert_fs(dst, before, pos, fs);
@@ -569,6 +577,7 @@ int mnt_table_remove_fs(struct libmnt_table *tb, struct libmnt_fs *fs)
 
 	mnt_unref_fs(fs);
 	tb->nents--;
+	mnt_table_reset_index(tb);
 	return 0;
 }
 
@@ -927,6 +936,304 @@ int mnt_table_set_iter(struct libmnt_table *tb, struct libmnt_iter *itr, struct
 	return 0;
 }
 
+/*
+ * Lookup index
+ *
+ * The index is a hash of the table entries by devno and by source path. It's
+ * built on the first mnt_table_find_devno() or mnt_table_find_srcpath() and
+ * dropped on any change of the table. The canonicalized source paths are
+ * indexed later, only if the lookup needs them.
+ *
+ * Every slot points to the first and the last entry with the same key, so
+ * the lookup returns the same entry as the iteration in both directions.
+ */
+struct libmnt_tabidx_slot {
+	size_t			hash;
+	struct libmnt_fs	*first;
+	struct libmnt_fs	*last;
+	size_t			first_pos;	/* position of the entries in table */
+	size_t			last_pos;
+};
+
+struct libmnt_tabidx {
+	size_t			nslots;		/* always power of 2 */
+	size_t			nents;
+
+	struct libmnt_tabidx_slot *devnos;	/* by mnt_fs_get_devno() */
+	struct libmnt_tabidx_slot *paths;	/* by srcpath, streq_paths() */
+	struct libmnt_tabidx_slot *pseudo;	/* by srcpath for pseudo fs, strcmp() */
+	struct libmnt_tabidx_slot *cnpaths;	/* by canonicalized srcpath or NULL */
+
+	int			ntags;		/* number of entries with TAG= source */
+};
+
+/* returns the slot for the key (or the empty slot where to add the key) */
+static struct libmnt_tabidx_slot *index_get_slot(
+			struct libmnt_tabidx *idx,
+			struct libmnt_tabidx_slot *slots,
+			size_t hash,
+			int (*cmp)(struct libmnt_fs *, const void *),
+			const void *key)
+{
+	size_t mask = idx->nslots - 1, i;
+
+	for (i = hash & mask; slots[i].first; i = (i + 1) & mask) {
+		if (slots[i].hash == hash && cmp(slots[i].first, key) == 0)
+			return &slots[i];
+	}
+	return &slots[i];
+}
+
+static void index_add(struct libmnt_tabidx *idx,
+		      struct libmnt_tabidx_slot *slots,
+		      size_t hash,
+		      int (*cmp)(struct libmnt_fs *, const void *),
+		      const void *key,
+		      struct libmnt_fs *fs, size_t pos)
+{
+	struct libmnt_tabidx_slot *sl = index_get_slot(idx, slots, hash, cmp, key);
+
+	if (!sl->first) {
+		sl->hash = hash;
+		sl->first = fs;
+		sl->first_pos = pos;
+	}
+	sl->last = fs;
+	sl->last_pos = pos;
+}
+
+static struct libmnt_fs *index_find(struct libmnt_tabidx *idx,
+				    struct libmnt_tabidx_slot *slots,
+				    size_t hash,
+				    int (*cmp)(struct libmnt_fs *, const void *),
+				    const void *key,
+				    int direction, size_t *pos)
+{
+	struct libmnt_tabidx_slot *sl = index_get_slot(idx, slots, hash, cmp, key);
+
+	if (!sl->first)
+		return NULL;
+	if (pos)
+		*pos = direction == MNT_ITER_FORWARD ? sl->first_pos : sl->last_pos;
+	return direction == MNT_ITER_FORWARD ? sl->first : sl->last;
+}
+
+static size_t hash_devno(dev_t devno)
+{
+	uint64_t x = (uint64_t) devno * 0x9E3779B97F4A7C15ULL;
+
+	return (size_t) (x ^ (x >> 32));
+}
+
+static int cmp_devno(struct libmnt_fs *fs, const void *key)
+{
+	return mnt_fs_get_devno(fs) != *((const dev_t *) key);
+}
+
+static int cmp_path(struct libmnt_fs *fs, const void *key)
+{
+	return !streq_paths(mnt_fs_get_srcpath(fs), key);
+}
+
+static int cmp_str(struct libmnt_fs *fs, const void *key)
+{
+	return strcmp(mnt_fs_get_srcpath(fs), key);
+}
+
+static int cmp_cnpath(struct libmnt_fs *fs, const void *key)
+{
+	/* canonicalized path is in the cache */
+	const char *p = mnt_resolve_path(mnt_fs_get_srcpath(fs), fs->tab->cache);
+
+	return !p || strcmp(p, key);
+}
+
+/* drops the lookup index, it will be re-created on the next lookup */
+void mnt_table_reset_index(struct libmnt_table *tb)
+{
+	struct libmnt_tabidx *idx = tb->idx;
+
+	if (!idx)
+		return;
+
+	DBG(TAB, ul_debugobj(tb, "drop index"));
+	free(idx->devnos);
+	free(idx->paths);
+	free(idx->pseudo);
+	free(idx->cnpaths);
+	free(idx);
+	tb->idx = NULL;
+}
+
+static struct libmnt_tabidx *table_get_index(struct libmnt_table *tb)
+{
+	struct libmnt_tabidx *idx;
+	struct libmnt_iter itr;
+	struct libmnt_fs *fs;
+	size_t pos = 0;
+
+	if (!tb->use_index)
+		return NULL;
+	if (tb->idx)
+		return tb->idx;
+
+	idx = calloc(1, sizeof(*idx));
+	if (!idx)
+		return NULL;
+
+	idx->nents = tb->nents;
+	idx->nslots = 64;
+	while (idx->nslots < idx->nents * 2)
+		idx->nslots <<= 1;
+
+	idx->devnos = calloc(idx->nslots, sizeof(struct libmnt_tabidx_slot));
+	idx->paths = calloc(idx->nslots, sizeof(struct libmnt_tabidx_slot));
+	idx->pseudo = calloc(idx->nslots, sizeof(struct libmnt_tabidx_slot));
+	if (!idx->devnos || !idx->paths || !idx->pseudo) {
+		tb->idx = idx;
+		mnt_table_reset_index(tb);
+		return NULL;
+	}
+
+	DBG(TAB, ul_debugobj(tb, "create index [entries=%zu, slots=%zu]",
+				idx->nents, idx->nslots));
+
+	mnt_reset_iter(&itr, MNT_ITER_FORWARD);
+	while (mnt_table_next_fs(tb, &itr, &fs) == 0) {
+		dev_t devno = mnt_fs_get_devno(fs);
+		const char *p = mnt_fs_get_srcpath(fs);
+
+		index_add(idx, idx->devnos, hash_devno(devno), cmp_devno, &devno, fs, pos);
+
+		if (!p)
+			;
+		else if (mnt_fs_is_pseudofs(fs))
+			index_add(idx, idx->pseudo, ul_hash_str(p, UL_HASH_INIT),
+					cmp_str, p, fs, pos);
+		else
+			index_add(idx, idx->paths, ul_hash_path(p, UL_HASH_INIT),
+					cmp_path, p, fs, pos);
+
+		if (mnt_fs_get_tag(fs, NULL, NULL) == 0)
+			idx->ntags++;
+		pos++;
+	}
+
+	tb->idx = idx;
+	return idx;
+}
+
+/* canonicalized source paths, used as the last attempt by mnt_table_find_srcpath() */
+static struct libmnt_tabidx_slot *index_get_cnpaths(struct libmnt_table *tb,
+						    struct libmnt_tabidx *idx)
+{
+	struct libmnt_iter itr;
+	struct libmnt_fs *fs;
+	size_t pos = 0;
+
+	if (idx->cnpaths)
+		return idx->cnpaths;
+
+	idx->cnpaths = calloc(idx->nslots, sizeof(struct libmnt_tabidx_slot));
+	if (!idx->cnpaths)
+		return NULL;
+
+	DBG(TAB, ul_debugobj(tb, "create canonical paths index"));
+
+	mnt_reset_iter(&itr, MNT_ITER_FORWARD);
+	while (mnt_table_next_fs(tb, &itr, &fs) == 0) {
+		const char *p = NULL;
+
+		if (!mnt_fs_is_netfs(fs) && !mnt_fs_is_pseudofs(fs)) {
+			p = mnt_fs_get_srcpath(fs);
+			if (p)
+				p = mnt_resolve_path(p, tb->cache);
+		}
+		if (p)
+			index_add(idx, idx->cnpaths, ul_hash_str(p, UL_HASH_INIT),
+					cmp_cnpath, p, fs, pos);
+		pos++;
+	}
+	return idx->cnpaths;
+}
+
+/* returns the entry with srcpath equal to @path as compared by mnt_fs_streq_srcpath() */
+static struct libmnt_fs *index_find_srcpath(struct libmnt_tabidx *idx,
+					    const char *path, int direction)
+{
+	struct libmnt_fs *fs, *ps;
+	size_t pos = 0, ps_pos = 0;
+
+	fs = index_find(idx, idx->paths, ul_hash_path(path, UL_HASH_INIT),
+			cmp_path, path, direction, &pos);
+	ps = index_find(idx, idx->pseudo, ul_hash_str(path, UL_HASH_INIT),
+			cmp_str, path, direction, &ps_pos);
+	if (!fs || !ps)
+		return fs ? fs : ps;
+
+	if (direction == MNT_ITER_FORWARD)
+		return pos < ps_pos ? fs : ps;
+	return pos > ps_pos ? fs : ps;
+}
+
+/**
+ * mnt_table_enable_index:
+ * @tb: tab pointer
+ * @enable: TRUE or FALSE
+ *
+ * Enables hash index for mnt_table_find_devno() and mnt_table_find_srcpath()
+ * (and so for mnt_table_find_source() and mnt_table_find_tag()). The index is
+ * created on the first lookup and dropped when the table is modified (add,
+ * remove or move entry, new cache, new entry source or fstype). It's useful
+ * when the application does many lookups in a huge table (for example a
+ * lookup for every block device in mountinfo).
+ *
+ * The lookup results are the same as without the index, but the entries must
+ * not be modified by other means than by libmount functions when the index is
+ * enabled.
+ *
+ * Returns: 0 on success or negative number in case of error.
+ *
+ * Since: 2.37
+ */
+int mnt_table_enable_index(struct libmnt_table *tb, int enable)
+{
+	if (!tb)
+		return -EINVAL;
+
+	DBG(TAB, ul_debugobj(tb, "index: %s", enable ? "ENABLED" : "DISABLED"));
+	tb->use_index = enable ? 1 : 0;
+	if (!enable)
+		mnt_table_reset_index(tb);
+	return 0;
+}
+
+/**
+ * mnt_table_enable_refresh:
+ * @tb: tab pointer
+ * @enable: TRUE or FALSE
+ *
+ * Enables mnt_table_refresh() for the table. The parser keeps a copy of the
+ * raw line for every entry parsed from a file, and mnt_table_refresh() uses
+ * the lines to detect unchanged entries. The entries parsed when the refresh
+ * is disabled are always reparsed by the first mnt_table_refresh() call.
+ *
+ * mnt_table_refresh() enables it automatically.
+ *
+ * Returns: 0 on success or negative number in case of error.
+ *
+ * Since: 2.37
+ */
+int mnt_table_enable_refresh(struct libmnt_table *tb, int enable)
+{
+	if (!tb)
+		return -EINVAL;
+
+	DBG(TAB, ul_debugobj(tb, "refresh: %s", enable ? "ENABLED" : "DISABLED"));
+	tb->refresh = enable ? 1 : 0;
+	return 0;
+}
+
 /**
  * mnt_table_find_mountpoint:
  * @tb: tab pointer
@@ -1044,15 +1351,16 @@ struct libmnt_fs *mnt_table_find_target(struct libmnt_table *tb, const char *pat
 	 */
 	mnt_reset_iter(&itr, direction);
 	while(mnt_table_next_fs(tb, &itr, &fs) == 0) {
+		const char *tgt = mnt_fs_get_target(fs);
 		char *p;
 
-		if (!fs->target
+		if (!tgt
 		    || mnt_fs_is_swaparea(fs)
 		    || mnt_fs_is_kernel(fs)
-		    || (*fs->target == '/' && *(fs->target + 1) == '\0'))
+		    || (*tgt == '/' && *(tgt + 1) == '\0'))
 		       continue;
 
-		p = mnt_resolve_target(fs->target, tb->cache);
+		p = mnt_resolve_target(tgt, tb->cache);
 		/* both canonicalized, strcmp() is fine here */
 		if (p && strcmp(cn, p) == 0)
 			return fs;
@@ -1082,6 +1390,7 @@ struct libmnt_fs *mnt_table_find_target(struct libmnt_table *tb, const char *pat
  */
 struct libmnt_fs *mnt_table_find_srcpath(struct libmnt_table *tb, const char *path, int direction)
 {
+	struct libmnt_tabidx *idx;
 	struct libmnt_iter itr;
 	struct libmnt_fs *fs = NULL;
 	int ntags = 0, nents;
@@ -1095,6 +1404,22 @@ struct libmnt_fs *mnt_table_find_srcpath(struct libmnt_table *tb, const char *pa
 
 	DBG(TAB, ul_debugobj(tb, "lookup SRCPATH: '%s'", path));
 
+	idx = table_get_index(tb);
+	if (idx) {
+		fs = index_find_srcpath(idx, path, direction);
+#ifdef HAVE_BTRFS_SUPPORT
+		/* btrfs default subvolume is evaluated by the iteration below */
+		if (fs && fs->fstype && !strcmp(fs->fstype, "btrfs"))
+			goto native;
+#endif
+		if (fs)
+			return fs;
+		ntags = idx->ntags;
+		goto canonical;
+	}
+#ifdef HAVE_BTRFS_SUPPORT
+native:
+#endif
 	/* native paths */
 	mnt_reset_iter(&itr, direction);
 
@@ -1127,7 +1452,7 @@ struct libmnt_fs *mnt_table_find_srcpath(struct libmnt_table *tb, const char *pa
 		if (mnt_fs_get_tag(fs, NULL, NULL) == 0)
 			ntags++;
 	}
-
+canonical:
 	if (!path || !tb->cache || !(cn = mnt_resolve_path(path, tb->cache)))
 		return NULL;
 
@@ -1136,7 +1461,11 @@ struct libmnt_fs *mnt_table_find_srcpath(struct libmnt_table *tb, const char *pa
 	nents = mnt_table_get_nents(tb);
 
 	/* canonicalized paths in struct libmnt_table */
-	if (ntags < nents) {
+	if (ntags < nents && idx) {
+		fs = index_find_srcpath(idx, cn, direction);
+		if (fs)
+			return fs;
+	} else if (ntags < nents) {
 		mnt_reset_iter(&itr, direction);
 		while(mnt_table_next_fs(tb, &itr, &fs) == 0) {
 			if (mnt_fs_streq_srcpath(fs, cn))
@@ -1179,6 +1508,9 @@ struct libmnt_fs *mnt_table_find_srcpath(struct libmnt_table *tb, const char *pa
 	}
 
 	/* non-canonicalized paths in struct libmnt_table */
+	if (ntags <= nents && idx && index_get_cnpaths(tb, idx))
+		return index_find(idx, idx->cnpaths, ul_hash_str(cn, UL_HASH_INIT),
+				  cmp_cnpath, cn, direction, NULL);
 	if (ntags <= nents) {
 		mnt_reset_iter(&itr, direction);
 		while(mnt_table_next_fs(tb, &itr, &fs) == 0) {
@@ -1374,6 +1706,7 @@ struct libmnt_fs *mnt_table_find_pair(struct libmnt_table *tb, const char *sourc
 struct libmnt_fs *mnt_table_find_devno(struct libmnt_table *tb,
 				       dev_t devno, int direction)
 {
+	struct libmnt_tabidx *idx;
 	struct libmnt_fs *fs = NULL;
 	struct libmnt_iter itr;
 
@@ -1384,6 +1717,11 @@ struct libmnt_fs *mnt_table_find_devno(struct libmnt_table *tb,
 
 	DBG(TAB, ul_debugobj(tb, "lookup DEVNO: %d", (int) devno));
 
+	idx = table_get_index(tb);
+	if (idx)
+		return index_find(idx, idx->devnos, hash_devno(devno),
+				  cmp_devno, &devno, direction, NULL);
+
 	mnt_reset_iter(&itr, direction);
 
 	while(mnt_table_next_fs(tb, &itr, &fs) == 0) {
@@ -1987,7 +2325,7 @@ done:
 	return rc;
 }
 
-static int test_find(struct libmnt_test *ts, int argc, char *argv[], int dr)
+static int test_find(struct libmnt_test *ts, int argc, char *argv[], int dr, int idx)
 {
 	struct libmnt_table *tb;
 	struct libmnt_fs *fs = NULL;
@@ -2013,10 +2351,19 @@ static int test_find(struct libmnt_test *ts, int argc, char *argv[], int dr)
 	mnt_table_set_cache(tb, mpc);
 	mnt_unref_cache(mpc);
 
+	if (idx)
+		mnt_table_enable_index(tb, 1);
+
 	if (strcasecmp(find, "source") == 0)
 		fs = mnt_table_find_source(tb, what, dr);
 	else if (strcasecmp(find, "target") == 0)
 		fs = mnt_table_find_target(tb, what, dr);
+	else if (strcasecmp(find, "devno") == 0) {
+		unsigned int maj, min;
+
+		if (sscanf(what, "%u:%u", &maj, &min) == 2)
+			fs = mnt_table_find_devno(tb, makedev(maj, min), dr);
+	}
 
 	if (!fs)
 		fprintf(stderr, "%s: not found %s '%s'\n", file, find, what);
@@ -2031,12 +2378,22 @@ done:
 
 static int test_find_bw(struct libmnt_test *ts, int argc, char *argv[])
 {
-	return test_find(ts, argc, argv, MNT_ITER_BACKWARD);
+	return test_find(ts, argc, argv, MNT_ITER_BACKWARD, 0);
 }
 
 static int test_find_fw(struct libmnt_test *ts, int argc, char *argv[])
 {
-	return test_find(ts, argc, argv, MNT_ITER_FORWARD);
+	return test_find(ts, argc, argv, MNT_ITER_FORWARD, 0);
+}
+
+static int test_find_index_bw(struct libmnt_test *ts, int argc, char *argv[])
+{
+	return test_find(ts, argc, argv, MNT_ITER_BACKWARD, 1);
+}
+
+static int test_find_index_fw(struct libmnt_test *ts, int argc, char *argv[])
+{
+	return test_find(ts, argc, argv, MNT_ITER_FORWARD, 1);
 }
 
 static int test_find_pair(struct libmnt_test *ts, int argc, char *argv[])
@@ -2189,8 +2546,10 @@ int main(int argc, char *argv[])
 {
 	struct libmnt_test tss[] = {
 	{ "--parse",    test_parse,        "<file> [--comments] parse and print tab" },
-	{ "--find-forward",  test_find_fw, "<file> <source|target> <string>" },
-	{ "--find-backward", test_find_bw, "<file> <source|target> <string>" },
+	{ "--find-forward",  test_find_fw, "<file> <source|target|devno> <string>" },
+	{ "--find-backward", test_find_bw, "<file> <source|target|devno> <string>" },
+	{ "--find-index-forward",  test_find_index_fw, "<file> <source|target|devno> <string>" },
+	{ "--find-index-backward", test_find_index_bw, "<file> <source|target|devno> <string>" },
 	{ "--uniq-target",   test_uniq,    "<file>" },
 	{ "--find-pair",     test_find_pair, "<file> <source> <target>" },
 	{ "--find-fs",       test_find_idx, "<file> <target>" },
@@ -16,6 +16,7 @@
  * @short_description: compare changes in the list of the mounted filesystems
  */
 #include "mountP.h"
+#include "strutils.h"
 
 struct tabdiff_entry {
 	int	oper;			/* MNT_TABDIFF_* flags; */
@@ -26,11 +27,29 @@ struct tabdiff_entry {
 	struct list_head changes;
 };
 
+/*
+ * Open-addressing hash table used to join the tables. The buffers are reused
+ * for the next mnt_diff_tables() call.
+ */
+struct tabdiff_slot {
+	size_t	hash;
+	void	*data;			/* libmnt_fs or tabdiff_entry */
+};
+
+struct tabdiff_idx {
+	struct tabdiff_slot *slots;
+	size_t nslots;			/* always power of 2 */
+};
+
 struct libmnt_tabdiff {
 	int nchanges;			/* number of changes */
 
 	struct list_head changes;	/* list with modified entries */
 	struct list_head unused;	/* list with unused entries */
+
+	struct tabdiff_idx old_idx;	/* old table entries by source and target */
+	struct tabdiff_idx new_idx;	/* new table entries by source and target */
+	struct tabdiff_idx mnt_idx;	/* MOUNT changes by ID */
 };
 
 /**
@@ -82,7 +101,15 @@ void mnt_free_tabdiff(struct libmnt_tabdiff *df)
 			                  struct tabdiff_entry, changes);
 		free_tabdiff_entry(de);
 	}
+	while (!list_empty(&df->unused)) {
+		struct tabdiff_entry *de = list_entry(df->unused.next,
+			                  struct tabdiff_entry, changes);
+		free_tabdiff_entry(de);
+	}
 
+	free(df->old_idx.slots);
+	free(df->new_idx.slots);
+	free(df->mnt_idx.slots);
 	free(df);
 }
 
@@ -186,19 +213,142 @@ static int tabdiff_add_entry(struct libmnt_tabdiff *df, struct libmnt_fs *old,
 	return 0;
 }
 
-static struct tabdiff_entry *tabdiff_get_mount(struct libmnt_tabdiff *df,
-					       const char *src,
-					       int id)
+/* prepare empty @idx for @n items */
+static int tabdiff_idx_init(struct tabdiff_idx *idx, size_t n)
+{
+	size_t sz = 64;
+
+	while (sz < n * 2)
+		sz <<= 1;
+
+	if (sz > idx->nslots) {
+		struct tabdiff_slot *x = realloc(idx->slots, sz * sizeof(*x));
+		if (!x)
+			return -ENOMEM;
+		idx->slots = x;
+		idx->nslots = sz;
+	}
+	memset(idx->slots, 0, idx->nslots * sizeof(struct tabdiff_slot));
+	return 0;
+}
+
+static void tabdiff_idx_add(struct tabdiff_idx *idx, size_t h, void *data)
+{
+	size_t mask = idx->nslots - 1, i;
+
+	for (i = h & mask; idx->slots[i].data; i = (i + 1) & mask);
+
+	idx->slots[i].hash = h;
+	idx->slots[i].data = data;
+}
+
+/*
+ * Returns the next item with @h hash, *@i is the probing position and has to
+ * be initialized to (size_t) -1. The items are returned in the order in which
+ * they have been added.
+ */
+static void *tabdiff_idx_next(struct tabdiff_idx *idx, size_t h, size_t *i)
+{
+	size_t mask = idx->nslots - 1;
+
+	*i = *i == (size_t) -1 ? h & mask : (*i + 1) & mask;
+
+	for (; idx->slots[*i].data; *i = (*i + 1) & mask) {
+		if (idx->slots[*i].hash == h)
+			return idx->slots[*i].data;
+	}
+	return NULL;
+}
+
+static size_t tabdiff_hash_pair(const char *src, const char *tgt)
+{
+	return ul_hash_path(tgt, ul_hash_path(src, UL_HASH_INIT) * UL_HASH_PRIME);
+}
+
+static size_t tabdiff_hash_id(int id)
+{
+	return (size_t) id * 2654435761U;
+}
+
+static int tabdiff_idx_table(struct tabdiff_idx *idx, struct libmnt_table *tb)
+{
+	struct libmnt_iter itr;
+	struct libmnt_fs *fs;
+	int rc;
+
+	rc = tabdiff_idx_init(idx, mnt_table_get_nents(tb));
+	if (rc)
+		return rc;
+
+	mnt_reset_iter(&itr, MNT_ITER_FORWARD);
+	while (mnt_table_next_fs(tb, &itr, &fs) == 0) {
+		const char *src = mnt_fs_get_source(fs),
+			   *tgt = mnt_fs_get_target(fs);
+
+		/* mnt_table_find_pair() ignores incomplete entries too */
+		if (!src || !*src || !tgt || !*tgt)
+			continue;
+		tabdiff_idx_add(idx, tabdiff_hash_pair(src, tgt), fs);
+	}
+	return 0;
+}
+
+/*
+ * Like mnt_table_find_pair(tb, src, tgt, MNT_ITER_FORWARD), but uses the
+ * index. The index contains only entries with the same paths (redundant
+ * slashes ignored), so the full table is searched (for canonicalized
+ * paths) only if there is no such entry and the table has a cache.
+ */
+static struct libmnt_fs *tabdiff_find_pair(struct tabdiff_idx *idx,
+					   struct libmnt_table *tb,
+					   const char *src, const char *tgt)
+{
+	struct libmnt_fs *fs;
+	size_t h, i = (size_t) -1;
+
+	if (!src || !*src || !tgt || !*tgt)
+		return NULL;
+
+	h = tabdiff_hash_pair(src, tgt);
+	while ((fs = tabdiff_idx_next(idx, h, &i))) {
+		if (mnt_fs_match_target(fs, tgt, tb->cache) &&
+		    mnt_fs_match_source(fs, src, tb->cache))
+			return fs;
+	}
+
+	return tb->cache ? mnt_table_find_pair(tb, src, tgt, MNT_ITER_FORWARD) : NULL;
+}
+
+static int tabdiff_idx_mounts(struct libmnt_tabdiff *df)
 {
 	struct list_head *p;
+	int rc;
 
-	assert(df);
+	rc = tabdiff_idx_init(&df->mnt_idx, df->nchanges);
+	if (rc)
+		return rc;
 
 	list_for_each(p, &df->changes) {
 		struct tabdiff_entry *de;
 
 		de = list_entry(p, struct tabdiff_entry, changes);
+		if (de->oper == MNT_TABDIFF_MOUNT && de->new_fs)
+			tabdiff_idx_add(&df->mnt_idx,
+				tabdiff_hash_id(mnt_fs_get_id(de->new_fs)), de);
+	}
+	return 0;
+}
 
+static struct tabdiff_entry *tabdiff_get_mount(struct libmnt_tabdiff *df,
+					       const char *src,
+					       int id)
+{
+	struct tabdiff_entry *de;
+	size_t i = (size_t) -1;
+
+	assert(df);
+
+	while ((de = tabdiff_idx_next(&df->mnt_idx, tabdiff_hash_id(id), &i))) {
 		if (de->oper == MNT_TABDIFF_MOUNT && de->new_fs &&
 		    mnt_fs_get_id(de->new_fs) == id) {
 
@@ -222,6 +372,10 @@ static struct tabdiff_entry *tabdiff_get_mount(struct libmnt_tabdiff *df,
  * Compares @old_tab and @new_tab, the result is stored in @df and accessible by
  * mnt_tabdiff_next_change().
  *
+ * The entries are paired by source and target (see mnt_table_find_pair()) and
+ * moved filesystems by source and mount ID. Both tables are indexed by hash
+ * tables, so the function is linear to the number of entries.
+ *
  * Returns: number of changes, negative number in case of error.
  */
 int mnt_diff_tables(struct libmnt_tabdiff *df, struct libmnt_table *old_tab,
@@ -229,7 +383,7 @@ int mnt_diff_tables(struct libmnt_tabdiff *df, struct libmnt_table *old_tab,
 {
 	struct libmnt_fs *fs;
 	struct libmnt_iter itr;
-	int no, nn;
+	int no, nn, rc;
 
 	if (!df || !old_tab || !new_tab)
 		return -EINVAL;
@@ -260,13 +414,19 @@ int mnt_diff_tables(struct libmnt_tabdiff *df, struct libmnt_table *old_tab,
 		goto done;
 	}
 
+	rc = tabdiff_idx_table(&df->old_idx, old_tab);
+	if (!rc)
+		rc = tabdiff_idx_table(&df->new_idx, new_tab);
+	if (rc)
+		return rc;
+
 	/* search newly mounted or modified */
 	while(mnt_table_next_fs(new_tab, &itr, &fs) == 0) {
 		struct libmnt_fs *o_fs;
 		const char *src = mnt_fs_get_source(fs),
 			   *tgt = mnt_fs_get_target(fs);
 
-		o_fs = mnt_table_find_pair(old_tab, src, tgt, MNT_ITER_FORWARD);
+		o_fs = tabdiff_find_pair(&df->old_idx, old_tab, src, tgt);
 		if (!o_fs)
 			/* 'fs' is not in the old table -- so newly mounted */
 			tabdiff_add_entry(df, NULL, fs, MNT_TABDIFF_MOUNT);
@@ -282,13 +442,17 @@ int mnt_diff_tables(struct libmnt_tabdiff *df, struct libmnt_table *old_tab,
 		}
 	}
 
+	rc = tabdiff_idx_mounts(df);
+	if (rc)
+		return rc;
+
 	/* search umounted or moved */
 	mnt_reset_iter(&itr, MNT_ITER_FORWARD);
 	while(mnt_table_next_fs(old_tab, &itr, &fs) == 0) {
 		const char *src = mnt_fs_get_source(fs),
 			   *tgt = mnt_fs_get_target(fs);
 
-		if (!mnt_table_find_pair(new_tab, src, tgt, MNT_ITER_FORWARD)) {
+		if (!tabdiff_find_pair(&df->new_idx, new_tab, src, tgt)) {
 			struct tabdiff_entry *de;
 
 			de = tabdiff_get_mount(df, src,	mnt_fs_get_id(fs));
@@ -308,27 +472,12 @@ done:
 
 #ifdef TEST_PROGRAM
 
-static int test_diff(struct libmnt_test *ts, int argc, char *argv[])
+#include "monotonic.h"
+
+static void print_diff(struct libmnt_tabdiff *diff, struct libmnt_iter *itr)
 {
-	struct libmnt_table *tb_old, *tb_new;
-	struct libmnt_tabdiff *diff;
-	struct libmnt_iter *itr;
 	struct libmnt_fs *old, *new;
-	int rc = -1, change;
-
-	tb_old = mnt_new_table_from_file(argv[1]);
-	tb_new = mnt_new_table_from_file(argv[2]);
-	diff = mnt_new_tabdiff();
-	itr = mnt_new_iter(MNT_ITER_FORWARD);
-
-	if (!tb_old || !tb_new || !diff || !itr) {
-		warnx("failed to allocate resources");
-		goto done;
-	}
-
-	rc = mnt_diff_tables(diff, tb_old, tb_new);
-	if (rc < 0)
-		goto done;
+	int change;
 
 	while(mnt_tabdiff_next_change(diff, itr, &old, &new, &change) == 0) {
 
@@ -354,7 +503,193 @@ static int test_diff(struct libmnt_test *ts, int argc, char *argv[])
 			printf("unknown change!\n");
 		}
 	}
+}
+
+static int test_diff(struct libmnt_test *ts, int argc, char *argv[])
+{
+	struct libmnt_table *tb_old, *tb_new;
+	struct libmnt_tabdiff *diff;
+	struct libmnt_iter *itr;
+	int rc = -1;
+
+	tb_old = mnt_new_table_from_file(argv[1]);
+	tb_new = mnt_new_table_from_file(argv[2]);
+	diff = mnt_new_tabdiff();
+	itr = mnt_new_iter(MNT_ITER_FORWARD);
+
+	if (!tb_old || !tb_new || !diff || !itr) {
+		warnx("failed to allocate resources");
+		goto done;
+	}
+
+	rc = mnt_diff_tables(diff, tb_old, tb_new);
+	if (rc < 0)
+		goto done;
+
+	print_diff(diff, itr);
+	rc = 0;
+done:
+	mnt_unref_table(tb_old);
+	mnt_unref_table(tb_new);
+	mnt_free_tabdiff(diff);
+	mnt_free_iter(itr);
+	return rc;
+}
+
+static int test_refresh(struct libmnt_test *ts, int argc, char *argv[])
+{
+	struct libmnt_table *tb;
+	struct libmnt_tabdiff *diff;
+	struct libmnt_iter *itr;
+	FILE *f = NULL;
+	int rc = -1;
+
+	tb = mnt_new_table();
+	diff = mnt_new_tabdiff();
+	itr = mnt_new_iter(MNT_ITER_FORWARD);
+
+	if (!tb || !diff || !itr) {
+		warnx("failed to allocate resources");
+		goto done;
+	}
+
+	/* --refresh-reparse: the first refresh reparses all lines */
+	mnt_table_enable_refresh(tb, strcmp(argv[0], "--refresh") == 0);
+	rc = mnt_table_parse_file(tb, argv[1]);
+	if (rc) {
+		warnx("%s: parse failed", argv[1]);
+		goto done;
+	}
+
+	f = fopen(argv[2], "r" UL_CLOEXECSTR);
+	if (!f) {
+		warn("%s: open failed", argv[2]);
+		rc = -1;
+		goto done;
+	}
+
+	rc = mnt_table_refresh(tb, f, argv[2], diff);
+	if (rc < 0)
+		goto done;
+
+	print_diff(diff, itr);
+	rc = 0;
+done:
+	if (f)
+		fclose(f);
+	mnt_unref_table(tb);
+	mnt_free_tabdiff(diff);
+	mnt_free_iter(itr);
+	return rc;
+}
+
+/*
+ * Generates synthetic mountinfo like table, @gen is the generation of the
+ * table -- every 100th entry is different in each generation.
+ */
+static struct libmnt_table *bench_new_table(int nents, int gen)
+{
+	struct libmnt_table *tb = mnt_new_table();
+	int i;
+
+	if (!tb)
+		return NULL;
+
+	for (i = 0; i < nents; i++) {
+		struct libmnt_fs *fs;
+		char src[64], tgt[64];
+		int ch = gen && i % 100 == 0 ? (i / 100) % 4 : -1;
+
+		if (ch == 0)
+			continue;			/* umounted */
+
+		fs = mnt_new_fs();
+		if (!fs)
+			goto err;
+
+		snprintf(src, sizeof(src), "/dev/mapper/vg-lv%d", i);
+		if (ch == 1)
+			snprintf(tgt, sizeof(tgt), "/var/lib/moved/%d", i);
+		else
+			snprintf(tgt, sizeof(tgt), "/var/lib/containers/%d", i);
+
+		fs->id = i + 1;
+		fs->parent = 1;
+		if (mnt_fs_set_source(fs, src) ||
+		    mnt_fs_set_target(fs, tgt) ||
+		    mnt_fs_set_fstype(fs, "ext4") ||
+		    mnt_fs_set_options(fs, ch == 2 ? "ro,relatime" : "rw,relatime") ||
+		    mnt_table_add_fs(tb, fs)) {
+			mnt_unref_fs(fs);
+			goto err;
+		}
+		mnt_unref_fs(fs);
+	}
+
+	/* newly mounted */
+	for (i = 0; gen && i < nents / 100; i++) {
+		struct libmnt_fs *fs = mnt_new_fs();
+		char tgt[64];
+
+		if (!fs)
+			goto err;
+		snprintf(tgt, sizeof(tgt), "/run/new/%d", i);
+		fs->id = nents + i + 1;
+		if (mnt_fs_set_source(fs, "tmpfs") ||
+		    mnt_fs_set_target(fs, tgt) ||
+		    mnt_fs_set_fstype(fs, "tmpfs") ||
+		    mnt_table_add_fs(tb, fs)) {
+			mnt_unref_fs(fs);
+			goto err;
+		}
+		mnt_unref_fs(fs);
+	}
+	return tb;
+err:
+	mnt_unref_table(tb);
+	return NULL;
+}
+
+static int test_bench(struct libmnt_test *ts, int argc, char *argv[])
+{
+	struct libmnt_table *tb_old, *tb_new;
+	struct libmnt_tabdiff *diff;
+	struct libmnt_iter *itr;
+	struct timeval start, end;
+	int rc = -1, change, nents = 50000, n[5] = { 0 };
+
+	if (argc > 1)
+		nents = atoi(argv[1]);
+
+	tb_old = bench_new_table(nents, 0);
+	tb_new = bench_new_table(nents, 1);
+	diff = mnt_new_tabdiff();
+	itr = mnt_new_iter(MNT_ITER_FORWARD);
+
+	if (!tb_old || !tb_new || !diff || !itr) {
+		warnx("failed to allocate resources");
+		goto done;
+	}
+
+	gettime_monotonic(&start);
+	rc = mnt_diff_tables(diff, tb_old, tb_new);
+	gettime_monotonic(&end);
+	if (rc < 0)
+		goto done;
+
+	while (mnt_tabdiff_next_change(diff, itr, NULL, NULL, &change) == 0) {
+		if (change > 0 && change < (int) ARRAY_SIZE(n))
+			n[change]++;
+	}
 
+	printf("entries:  %d/%d\n", mnt_table_get_nents(tb_old),
+				    mnt_table_get_nents(tb_new));
+	printf("changes:  %d (mount=%d umount=%d move=%d remount=%d)\n", rc,
+			n[MNT_TABDIFF_MOUNT], n[MNT_TABDIFF_UMOUNT],
+			n[MNT_TABDIFF_MOVE], n[MNT_TABDIFF_REMOUNT]);
+	printf("time:     %ld usec\n",
+			(long) ((end.tv_sec - start.tv_sec) * 1000000
+			        + (end.tv_usec - start.tv_usec)));
 	rc = 0;
 done:
 	mnt_unref_table(tb_old);
@@ -368,6 +703,9 @@ int main(int argc, char *argv[])
 {
 	struct libmnt_test tss[] = {
 		{ "--diff", test_diff, "<old> <new> prints change" },
+		{ "--refresh", test_refresh, "<old> <new> refresh table, prints change" },
+		{ "--refresh-reparse", test_refresh, "<old> <new> refresh table parsed without lines" },
+		{ "--bench", test_bench, "[<nents>] diff synthetic tables (default 50000 entries)" },
 		{ NULL }
 	};
 
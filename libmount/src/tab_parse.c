@@ -27,12 +27,31 @@
 #include "pathnames.h"
 #include "strutils.h"
 
+/* mangled PATH_DELETED_SUFFIX */
+#define MANGLED_DELETED_SUFFIX	"\\040(deleted)"
+
+/* size of the arena for the parsed strings if the file size is unknown */
+#define MNT_ARENA_MINSIZ	((size_t) 16 * 1024)
+#define MNT_ARENA_MAXSIZ	((size_t) 1024 * 1024)
+
+/* index of the already parsed entries, used by mnt_table_refresh() */
+struct libmnt_refresh_slot {
+	uint64_t		hash;	/* zero for already used entry */
+	struct libmnt_fs	*fs;
+};
+
 struct libmnt_parser {
 	FILE	*f;		/* fstab, mtab, swaps or mountinfo ... */
 	const char *filename;	/* file name or NULL */
 	char	*buf;		/* buffer (the current line content) */
 	size_t	bufsiz;		/* size of the buffer */
 	size_t	line;		/* current line */
+
+	struct libmnt_refresh_slot *slots;	/* NULL or refresh index */
+	size_t	nslots;				/* always power of 2 */
+	struct libmnt_fs *reused;		/* unchanged entry for the line */
+
+	size_t	arenasz;	/* size for the next arena or zero */
 };
 
 static void parser_cleanup(struct libmnt_parser *pa)
@@ -40,9 +59,56 @@ static void parser_cleanup(struct libmnt_parser *pa)
 	if (!pa)
 		return;
 	free(pa->buf);
+	free(pa->slots);
 	memset(pa, 0, sizeof(*pa));
 }
 
+/* FNV-1a, zero is reserved for "no hash" */
+static uint64_t hash_line(const char *s)
+{
+	uint64_t h = 14695981039346656037ULL;
+
+	for (; *s; s++)
+		h = (h ^ (unsigned char) *s) * 1099511628211ULL;
+	return h ? h : 1;
+}
+
+/* returns 1 if @fs has been already returned by parser_lookup_line() */
+static int parser_is_reused(struct libmnt_parser *pa, struct libmnt_fs *fs)
+{
+	size_t mask = pa->nslots - 1, i;
+
+	if (!fs->linehash)
+		return 0;
+	for (i = fs->linehash & mask; pa->slots[i].fs; i = (i + 1) & mask) {
+		if (pa->slots[i].fs == fs)
+			return pa->slots[i].hash == 0;
+	}
+	return 0;
+}
+
+/*
+ * Returns an unused entry parsed from the same line or NULL. The entry is
+ * marked as used. The hash is used to find candidates only, the line has to
+ * match byte by byte.
+ */
+static struct libmnt_fs *parser_lookup_line(struct libmnt_parser *pa,
+					    uint64_t h, const char *s, size_t sz)
+{
+	size_t mask = pa->nslots - 1, i;
+
+	for (i = h & mask; pa->slots[i].fs; i = (i + 1) & mask) {
+		struct libmnt_fs *fs = pa->slots[i].fs;
+
+		if (pa->slots[i].hash == h && fs->line && fs->linesz == sz
+		    && memcmp(fs->line, s, sz) == 0) {
+			pa->slots[i].hash = 0;
+			return pa->slots[i].fs;
+		}
+	}
+	return NULL;
+}
+
 static const char *next_s32(const char *s, int *num, int *rc)
 {
 	char *end = NULL;
@@ -89,40 +155,129 @@ static inline const char *skip_nonspearator(const char *p)
 	return p;
 }
 
+void mnt_unref_arena(struct libmnt_arena *ar)
+{
+	if (ar && --ar->refcount <= 0)
+		free(ar);
+}
+
 /*
- * Parses one line from {fs,m}tab
+ * Returns @sz bytes from the table arena for strings of the entry @fs. The
+ * entry references the arena, all its strings have to be stored in the
+ * returned buffer. The new arena is allocated if the current one is too
+ * small; the size is pa->arenasz (the file size) or twice the previous size
+ * up to MNT_ARENA_MAXSIZ (e.g. /proc files).
  */
-static int mnt_parse_table_line(struct libmnt_fs *fs, const char *s)
+static char *arena_alloc(struct libmnt_parser *pa, struct libmnt_table *tb,
+			 struct libmnt_fs *fs, size_t sz)
 {
-	int rc = 0;
+	struct libmnt_arena *ar = tb->arena;
+
+	assert(!fs->arena);
+
+	if (!ar || ar->size - ar->used < sz) {
+		size_t size = pa->arenasz ? pa->arenasz :
+			      ar ? min(ar->size * 2, MNT_ARENA_MAXSIZ) :
+			      MNT_ARENA_MINSIZ;
+
+		if (size < sz)
+			size = sz;
+		ar = malloc(sizeof(*ar) + size);
+		if (!ar)
+			return NULL;
+
+		DBG(TAB, ul_debugobj(tb, "new arena [size=%zu]", size));
+		ar->refcount = 1;
+		ar->size = size;
+		ar->used = 0;
+
+		mnt_unref_arena(tb->arena);
+		tb->arena = ar;
+		pa->arenasz = 0;
+	}
+
+	ar->refcount++;
+	fs->arena = ar;
+	return ar->data + ar->used;
+}
+
+/* returns the unused rest of the buffer from arena_alloc() to the arena */
+static void arena_commit(struct libmnt_fs *fs, const char *end)
+{
+	fs->arena->used = end - fs->arena->data;
+}
+
+/*
+ * Copies the next field from @s to the @buf and moves @buf behind the copy,
+ * the field is not unmangled. The @end is set to the end of the field and
+ * @mangled to 1 if the field contains a \ooo sequence.
+ *
+ * Returns: the copy or NULL if the field is empty.
+ */
+static char *next_field(const char *s, const char **end, char **buf,
+			int *mangled)
+{
+	const char *e = skip_nonspearator(s);
+	size_t sz = e - s;
+	char *res = *buf;
+
+	*end = e;
+	if (!sz)
+		return NULL;
+
+	memcpy(res, s, sz);
+	res[sz] = '\0';
+	*buf = res + sz + 1;
+
+	*mangled = memchr(res, '\\', sz) != NULL;
+	return res;
+}
+
+/* like next_field(), but the field is unmangled if necessary */
+static char *next_field_unmangled(const char *s, const char **end, char **buf)
+{
+	int mangled = 0;
+	char *res = next_field(s, end, buf, &mangled);
+
+	if (mangled)
+		unmangle_string(res);
+	return res;
+}
+
+/*
+ * Parses one line from {fs,m}tab, the strings are stored to @buf
+ */
+static int mnt_parse_table_line(struct libmnt_fs *fs, const char *s, char **buf)
+{
+	int rc = 0, mangled = 0;
 	char *p = NULL;
 
 	fs->passno = fs->freq = 0;
 
 	/* (1) source */
-	p = unmangle(s, &s);
+	p = next_field_unmangled(s, &s, buf);
 	if (!p || (rc = __mnt_fs_set_source_ptr(fs, p))) {
 		DBG(TAB, ul_debug("tab parse error: [source]"));
-		free(p);
 		goto fail;
 	}
 
 	s = skip_separator(s);
 
 	/* (2) target */
-	fs->target = unmangle(s, &s);
+	fs->target = next_field(s, &s, buf, &mangled);
 	if (!fs->target) {
 		DBG(TAB, ul_debug("tab parse error: [target]"));
 		goto fail;
 	}
+	if (mangled)
+		fs->mangled |= MNT_FS_MANGLED_TARGET;
 
 	s = skip_separator(s);
 
 	/* (3) FS type */
-	p = unmangle(s, &s);
+	p = next_field_unmangled(s, &s, buf);
 	if (!p || (rc = __mnt_fs_set_fstype_ptr(fs, p))) {
 		DBG(TAB, ul_debug("tab parse error: [fstype]"));
-		free(p);
 		goto fail;
 	}
 
@@ -172,11 +327,11 @@ fail:
 
 
 /*
- * Parses one line from a mountinfo file
+ * Parses one line from a mountinfo file, the strings are stored to @buf
  */
-static int mnt_parse_mountinfo_line(struct libmnt_fs *fs, const char *s)
+static int mnt_parse_mountinfo_line(struct libmnt_fs *fs, const char *s, char **buf)
 {
-	int rc = 0;
+	int rc = 0, mangled = 0;
 	unsigned int maj, min;
 	char *p;
 
@@ -210,25 +365,30 @@ static int mnt_parse_mountinfo_line(struct libmnt_fs *fs, const char *s)
 	s = skip_separator(s);
 
 	/* (4) mountroot */
-	fs->root = unmangle(s, &s);
+	fs->root = next_field(s, &s, buf, &mangled);
 	if (!fs->root) {
 		DBG(TAB, ul_debug("tab parse error: [mountroot]"));
 		goto fail;
 	}
+	if (mangled)
+		fs->mangled |= MNT_FS_MANGLED_ROOT;
 
 	s = skip_separator(s);
 
 	/* (5) target */
-	fs->target = unmangle(s, &s);
+	fs->target = next_field(s, &s, buf, &mangled);
 	if (!fs->target) {
 		DBG(TAB, ul_debug("tab parse error: [target]"));
 		goto fail;
 	}
+	if (mangled) {
+		fs->mangled |= MNT_FS_MANGLED_TARGET;
 
-	/* remove "\040(deleted)" suffix */
-	p = (char *) endswith(fs->target, PATH_DELETED_SUFFIX);
-	if (p && *p)
-		*p = '\0';
+		/* remove "\040(deleted)" suffix */
+		p = (char *) endswith(fs->target, MANGLED_DELETED_SUFFIX);
+		if (p && *p)
+			*p = '\0';
+	}
 
 	s = skip_separator(s);
 
@@ -245,16 +405,20 @@ static int mnt_parse_mountinfo_line(struct libmnt_fs *fs, const char *s)
 		DBG(TAB, ul_debug("mountinfo parse error: separator not found"));
 		return -EINVAL;
 	}
-	if (p > s + 1)
-		fs->opt_fields = strndup(s + 1, p - s - 1);
+	if (p > s + 1) {
+		size_t sz = p - s - 1;
+
+		fs->opt_fields = memcpy(*buf, s + 1, sz);
+		fs->opt_fields[sz] = '\0';
+		*buf += sz + 1;
+	}
 
 	s = skip_separator(p + 3);
 
 	/* (8) FS type */
-	p = unmangle(s, &s);
+	p = next_field_unmangled(s, &s, buf);
 	if (!p || (rc = __mnt_fs_set_fstype_ptr(fs, p))) {
 		DBG(TAB, ul_debug("tab parse error: [fstype]"));
-		free(p);
 		goto fail;
 	}
 
@@ -269,10 +433,9 @@ static int mnt_parse_mountinfo_line(struct libmnt_fs *fs, const char *s)
 		}
 	} else {
 		s = skip_separator(s);
-		p = unmangle(s, &s);
+		p = next_field_unmangled(s, &s, buf);
 		if (!p || (rc = __mnt_fs_set_source_ptr(fs, p))) {
 			DBG(TAB, ul_debug("tab parse error: [regular source]"));
-			free(p);
 			goto fail;
 		}
 	}
@@ -538,7 +701,9 @@ static int mnt_table_parse_next(struct libmnt_parser *pa,
 				struct libmnt_table *tb,
 				struct libmnt_fs *fs)
 {
-	char *s;
+	char *s, *buf;
+	uint64_t h = 0;
+	size_t sz;
 	int rc;
 
 	assert(tb);
@@ -591,20 +756,43 @@ next_line:
 		if (tb->fmt == MNT_FMT_SWAPS)
 			goto next_line;			/* skip swap header */
 	}
+	if (tb->fmt == MNT_FMT_SWAPS && strncmp(s, "Filename\t", 9) == 0)
+		goto next_line;				/* skip swap header */
+
+	sz = strlen(s);
+	if (tb->refresh) {
+		h = hash_line(s);
+		if (pa->slots) {
+			pa->reused = parser_lookup_line(pa, h, s, sz);
+			if (pa->reused)
+				return 0;		/* unchanged line */
+		}
+	}
+
+	/* the strings are never longer than the line */
+	buf = arena_alloc(pa, tb, fs, tb->refresh ? (sz + 1) * 2 : sz + 1);
+	if (!buf)
+		return -ENOMEM;
+
+	if (tb->refresh) {
+		/* keep the line for mnt_table_refresh() */
+		fs->line = memcpy(buf, s, sz + 1);
+		fs->linesz = sz;
+		fs->linehash = h;
+		buf += sz + 1;
+	}
 
 	switch (tb->fmt) {
 	case MNT_FMT_FSTAB:
-		rc = mnt_parse_table_line(fs, s);
+		rc = mnt_parse_table_line(fs, s, &buf);
 		break;
 	case MNT_FMT_MOUNTINFO:
-		rc = mnt_parse_mountinfo_line(fs, s);
+		rc = mnt_parse_mountinfo_line(fs, s, &buf);
 		break;
 	case MNT_FMT_UTAB:
 		rc = mnt_parse_utab_line(fs, s);
 		break;
 	case MNT_FMT_SWAPS:
-		if (strncmp(s, "Filename\t", 9) == 0)
-			goto next_line;			/* skip swap header */
 		rc = mnt_parse_swaps_line(fs, s);
 		break;
 	default:
@@ -612,6 +800,7 @@ next_line:
 		break;
 	}
 
+	arena_commit(fs, buf);
 	if (rc == 0)
 		return 0;
 err:
@@ -708,6 +897,7 @@ int mnt_table_parse_stream(struct libmnt_table *tb, FILE *f, const char *filenam
 	int flags = 0;
 	pid_t tid = -1;
 	struct libmnt_parser pa = { .line = 0 };
+	struct stat st;
 
 	assert(tb);
 	assert(f);
@@ -720,6 +910,10 @@ int mnt_table_parse_stream(struct libmnt_table *tb, FILE *f, const char *filenam
 	pa.filename = filename;
 	pa.f = f;
 
+	/* the parsed strings are never longer than the file */
+	if (fstat(fileno(f), &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0)
+		pa.arenasz = ((size_t) st.st_size + 1) * (tb->refresh ? 2 : 1);
+
 	/* necessary for /proc/mounts only, the /proc/self/mountinfo
 	 * parser sets the flag properly
 	 */
@@ -781,6 +975,161 @@ err:
 	return rc;
 }
 
+/**
+ * mnt_table_refresh:
+ * @tb: table previously parsed from the same file
+ * @f: file stream (e.g. rewinded /proc/self/mountinfo)
+ * @filename: filename used for debug and error messages
+ * @df: diff handler or NULL
+ *
+ * Re-reads the file and updates @tb. The entries for unchanged lines are
+ * reused (the lines are compared by hash and content), only new or modified
+ * lines are parsed and the entries for removed lines are removed from the
+ * table. The order of the entries follows the file.
+ *
+ * The lines are kept only if enabled by mnt_table_enable_refresh() before the
+ * table is parsed, otherwise the first refresh reparses all the file. The
+ * function enables the refresh for @tb.
+ *
+ * If @df is not NULL then the changes are stored to the @df and accessible
+ * by mnt_tabdiff_next_change() in the same way as after mnt_diff_tables().
+ * Note that the changes are detected from the modified lines only.
+ *
+ * The function is designed for kernel files (mountinfo, swaps) where the
+ * whole file is regenerated after a change; the table entries must not be
+ * modified by the application and the table comments are not supported.
+ *
+ * Returns: number of changes (or 0 if @df is NULL), negative number in case
+ * of error.
+ *
+ * Since: 2.37
+ */
+int mnt_table_refresh(struct libmnt_table *tb, FILE *f, const char *filename,
+		      struct libmnt_tabdiff *df)
+{
+	struct libmnt_table *rm = NULL, *add = NULL;
+	struct libmnt_fs **ents = NULL, *fs;
+	struct libmnt_iter itr;
+	struct libmnt_parser pa = { .line = 0 };
+	size_t i, nents = 0, nallocs = 0;
+	int rc = -ENOMEM, flags = 0;
+	pid_t tid = -1;
+
+	if (!tb || !f || !filename || tb->comms)
+		return -EINVAL;
+
+	DBG(TAB, ul_debugobj(tb, "%s: start refresh [entries=%d]",
+				filename, mnt_table_get_nents(tb)));
+
+	pa.filename = filename;
+	pa.f = f;
+
+	if (strcmp(filename, _PATH_PROC_MOUNTS) == 0)
+		flags = MNT_FS_KERNEL;
+
+	tb->refresh = 1;
+
+	rm = mnt_new_table();
+	add = mnt_new_table();
+	if (!rm || !add)
+		goto done;
+
+	/* index the current entries by line hash */
+	pa.nslots = 64;
+	while (pa.nslots < (size_t) tb->nents * 2)
+		pa.nslots <<= 1;
+	pa.slots = calloc(pa.nslots, sizeof(struct libmnt_refresh_slot));
+	if (!pa.slots)
+		goto done;
+
+	mnt_reset_iter(&itr, MNT_ITER_FORWARD);
+	while (mnt_table_next_fs(tb, &itr, &fs) == 0) {
+		size_t mask = pa.nslots - 1;
+
+		if (!fs->linehash)
+			continue;
+		for (i = fs->linehash & mask; pa.slots[i].fs; i = (i + 1) & mask);
+		pa.slots[i].hash = fs->linehash;
+		pa.slots[i].fs = fs;
+	}
+
+	/* read the file, the new entries are added to @add table */
+	while (!feof(f)) {
+		if (nents == nallocs) {
+			struct libmnt_fs **x;
+
+			nallocs += 256;
+			x = realloc(ents, nallocs * sizeof(struct libmnt_fs *));
+			if (!x) {
+				rc = -ENOMEM;
+				goto done;
+			}
+			ents = x;
+		}
+
+		fs = mnt_new_fs();
+		if (!fs) {
+			rc = -ENOMEM;
+			goto done;
+		}
+
+		pa.reused = NULL;
+		rc = mnt_table_parse_next(&pa, tb, fs);
+
+		if (rc == 0 && pa.reused) {
+			ents[nents++] = pa.reused;
+			mnt_unref_fs(fs);
+			continue;
+		}
+
+		if (rc == 0 && tb->fltrcb && tb->fltrcb(fs, tb->fltrcb_data))
+			rc = 1;	/* filtered out by callback... */
+
+		if (rc == 0) {
+			rc = mnt_table_add_fs(add, fs);
+			fs->flags |= flags;
+
+			if (rc == 0 && tb->fmt == MNT_FMT_MOUNTINFO) {
+				rc = kernel_fs_postparse(tb, fs, &tid, filename);
+				if (rc)
+					mnt_table_remove_fs(add, fs);
+			}
+			if (rc == 0)
+				ents[nents++] = fs;
+		}
+		mnt_unref_fs(fs);
+
+		if (rc < 0 && !feof(f))
+			goto done;
+	}
+
+	/* not reused entries have been removed from the file */
+	mnt_reset_iter(&itr, MNT_ITER_FORWARD);
+	while (mnt_table_next_fs(tb, &itr, &fs) == 0) {
+		if (!parser_is_reused(&pa, fs))
+			mnt_table_move_fs(tb, rm, 0, NULL, fs);
+	}
+
+	rc = df ? mnt_diff_tables(df, rm, add) : 0;
+
+	/* sort the entries in the file order */
+	for (i = 0; i < nents; i++)
+		mnt_table_move_fs(ents[i]->tab, tb, 0, NULL, ents[i]);
+
+	DBG(TAB, ul_debugobj(tb, "%s: stop refresh (%d entries, %d removed, %d new)",
+				filename, mnt_table_get_nents(tb),
+				mnt_table_get_nents(rm),
+				mnt_table_get_nents(add)));
+done:
+	if (rc < 0)
+		DBG(TAB, ul_debugobj(tb, "%s: refresh error (rc=%d)", filename, rc));
+	free(ents);
+	mnt_unref_table(rm);
+	mnt_unref_table(add);
+	parser_cleanup(&pa);
+	return rc;
+}
+
 /**
  * mnt_table_parse_file:
  * @tb: tab pointer
@@ -25,6 +25,9 @@
 #include <getopt.h>
 #include <stdio.h>
 #include <string.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <pthread.h>
 
 #include "c.h"
 #include "nls.h"
@@ -39,8 +42,19 @@
    calling.
 
    Window size depends on page size.
-   e.g. 128MB on x86_64. ( = N_PAGES_IN_WINDOW * 4096 ). */
-#define N_PAGES_IN_WINDOW ((size_t)(32 * 1024))
+   e.g. 128MB on x86_64. ( = N_PAGES_IN_WINDOW * 4096 ).
+
+   On 64-bit systems the address space is not a problem, so
+   use a larger window to reduce number of syscalls. The window
+   is halved if mmap() fails with ENOMEM. */
+#if SIZE_MAX > UINT32_MAX
+# define N_PAGES_IN_WINDOW ((size_t)(256 * 1024))
+#else
+# define N_PAGES_IN_WINDOW ((size_t)(32 * 1024))
+#endif
+#define N_PAGES_IN_WINDOW_MIN ((size_t)(256))
+
+#define FINCORE_MAX_THREADS	64
 
 
 struct colinfo {
@@ -54,7 +68,8 @@ enum {
 	COL_PAGES,
 	COL_SIZE,
 	COL_FILE,
-	COL_RES
+	COL_RES,
+	COL_EXTENTS
 };
 
 static struct colinfo infos[] = {
@@ -62,20 +77,51 @@ static struct colinfo infos[] = {
 	[COL_RES]    = { "RES",      5, SCOLS_FL_RIGHT, N_("file data resident in memory in bytes")},
 	[COL_SIZE]   = { "SIZE",     5, SCOLS_FL_RIGHT, N_("size of the file")},
 	[COL_FILE]   = { "FILE",     4, 0, N_("file name")},
+	[COL_EXTENTS] = { "EXTENTS", 0.2, SCOLS_FL_WRAP, N_("ranges of resident pages")},
 };
 
 static int columns[ARRAY_SIZE(infos) * 2] = {-1};
 static size_t ncolumns;
 
+struct fincore_file {
+	char *name;
+	off_t size;			/* file size, sum of sizes for directories */
+	off_t count_incore;
+	char *extents;			/* resident pages, e.g. "0-15,30" */
+	size_t extlen;			/* used length of extents */
+	size_t extsz;			/* allocated size of extents */
+
+	size_t parent;			/* index of the directory + 1, or 0 */
+	int rc;				/* <0 error, 0 success, 1 ignore */
+	unsigned int is_dir : 1;
+
+	struct libscols_line *ln;	/* output line */
+};
+
 struct fincore_control {
 	const size_t pagesize;
 
 	struct libscols_table *tb;		/* output */
 
+	struct fincore_file *files;		/* in order of output */
+	size_t nfiles;
+	size_t next_file;			/* first not yet processed file */
+	size_t nthreads;
+
 	unsigned int bytes : 1,
 		     noheadings : 1,
 		     raw : 1,
-		     json : 1;
+		     json : 1,
+		     recursive : 1,
+		     extents : 1;		/* EXTENTS column requested */
+};
+
+/* per-thread mincore() state */
+struct fincore_state {
+	unsigned char *vec;
+	size_t vecsz;				/* window size in pages */
+
+	off_t run_start;			/* first page of the current extent, or -1 */
 };
 
 
@@ -107,18 +153,22 @@ static const struct colinfo *get_column_info(int num)
 }
 
 static int add_output_data(struct fincore_control *ctl,
-			   const char *name,
-			   off_t file_size,
-			   off_t count_incore)
+			   struct fincore_file *f)
 {
 	size_t i;
 	char *tmp;
-	struct libscols_line *ln;
+	struct libscols_line *ln, *parent = NULL;
+	const char *name = f->name;
+	off_t file_size = f->size;
+	off_t count_incore = f->count_incore;
 
 	assert(ctl);
 	assert(ctl->tb);
 
-	ln = scols_table_new_line(ctl->tb, NULL);
+	if (f->parent)
+		parent = ctl->files[f->parent - 1].ln;
+
+	ln = f->ln = scols_table_new_line(ctl->tb, parent);
 	if (!ln)
 		err(EXIT_FAILURE, _("failed to allocate output line"));
 
@@ -151,6 +201,13 @@ static int add_output_data(struct fincore_control *ctl,
 				tmp = size_to_human_string(SIZE_SUFFIX_1LETTER, file_size);
 			rc = scols_line_refer_data(ln, i, tmp);
 			break;
+		case COL_EXTENTS:
+			if (f->extents) {
+				rc = scols_line_refer_data(ln, i, f->extents);
+				f->extents = NULL;
+				f->extlen = f->extsz = 0;
+			}
+			break;
 		default:
 			return -EINVAL;
 		}
@@ -162,41 +219,111 @@ static int add_output_data(struct fincore_control *ctl,
 	return 0;
 }
 
+static void add_extent(struct fincore_file *f, off_t first, off_t last)
+{
+	size_t len = f->extlen;
+	char buf[2 * sizeof(stringify_value(INT64_MAX)) + 2];
+	int n;
+
+	if (first == last)
+		n = snprintf(buf, sizeof(buf), "%s%jd", len ? "," : "",
+				(intmax_t) first);
+	else
+		n = snprintf(buf, sizeof(buf), "%s%jd-%jd", len ? "," : "",
+				(intmax_t) first, (intmax_t) last);
+
+	if (len + n + 1 > f->extsz) {
+		f->extsz = max(f->extsz * 2, len + n + 1);
+		f->extents = xrealloc(f->extents, f->extsz);
+	}
+	memcpy(f->extents + len, buf, n + 1);
+	f->extlen += n;
+}
+
+/*
+ * Only the least significant bit of the mincore() vector bytes is defined,
+ * the other bits are reserved. Count the bits for 8 pages at once; the
+ * multiplication sums the masked bytes into the most significant byte.
+ */
+#define RESIDENT_MASK	0x0101010101010101ULL
+
+static off_t count_resident(const unsigned char *vec, size_t n)
+{
+	off_t count = 0;
+	size_t i = 0;
+
+	for (; i + sizeof(uint64_t) <= n; i += sizeof(uint64_t)) {
+		uint64_t w;
+
+		memcpy(&w, vec + i, sizeof(w));
+		count += ((w & RESIDENT_MASK) * RESIDENT_MASK) >> 56;
+	}
+	for (; i < n; i++)
+		count += vec[i] & 0x1;
+
+	return count;
+}
+
+static void find_extents(struct fincore_state *st, struct fincore_file *f,
+			 const unsigned char *vec, size_t n, off_t first_page)
+{
+	size_t i = 0;
+
+	while (i < n) {
+		/* skip 8 pages with the same state */
+		if (i + sizeof(uint64_t) <= n && i % sizeof(uint64_t) == 0) {
+			uint64_t w;
+
+			memcpy(&w, vec + i, sizeof(w));
+			w &= RESIDENT_MASK;
+			if ((w == 0 && st->run_start < 0) ||
+			    (w == RESIDENT_MASK && st->run_start >= 0)) {
+				i += sizeof(uint64_t);
+				continue;
+			}
+		}
+		if ((vec[i] & 0x1) && st->run_start < 0)
+			st->run_start = first_page + i;
+		else if (!(vec[i] & 0x1) && st->run_start >= 0) {
+			add_extent(f, st->run_start, first_page + i - 1);
+			st->run_start = -1;
+		}
+		i++;
+	}
+}
+
 static int do_mincore(struct fincore_control *ctl,
+		      struct fincore_state *st,
+		      struct fincore_file *f,
 		      void *window, const size_t len,
-		      const char *name,
-		      off_t *count_incore)
+		      off_t first_page)
 {
-	static unsigned char vec[N_PAGES_IN_WINDOW];
-	int n = (len / ctl->pagesize) + ((len % ctl->pagesize)? 1: 0);
+	size_t n = (len / ctl->pagesize) + ((len % ctl->pagesize)? 1: 0);
 
-	if (mincore (window, len, vec) < 0) {
-		warn(_("failed to do mincore: %s"), name);
+	if (mincore (window, len, st->vec) < 0) {
+		warn(_("failed to do mincore: %s"), f->name);
 		return -errno;
 	}
 
-	while (n > 0)
-	{
-		if (vec[--n] & 0x1)
-		{
-			vec[n] = 0;
-			(*count_incore)++;
-		}
-	}
+	f->count_incore += count_resident(st->vec, n);
+
+	if (ctl->extents)
+		find_extents(st, f, st->vec, n, first_page);
 
 	return 0;
 }
 
 static int fincore_fd (struct fincore_control *ctl,
-		       int fd,
-		       const char *name,
-		       off_t file_size,
-		       off_t *count_incore)
+		       struct fincore_state *st,
+		       struct fincore_file *f,
+		       int fd)
 {
-	size_t window_size = N_PAGES_IN_WINDOW * ctl->pagesize;
-	off_t file_offset, len;
+	size_t window_size = st->vecsz * ctl->pagesize;
+	off_t file_offset, file_size = f->size, len;
 	int rc = 0;
 
+	st->run_start = -1;
+
 	for (file_offset = 0; file_offset < file_size; file_offset += len) {
 		void  *window = NULL;
 
@@ -205,19 +332,29 @@ static int fincore_fd (struct fincore_control *ctl,
 			len = window_size;
 
 		window = mmap(window, len, PROT_NONE, MAP_PRIVATE, fd, file_offset);
+		if (window == MAP_FAILED && errno == ENOMEM
+		    && window_size > N_PAGES_IN_WINDOW_MIN * ctl->pagesize) {
+			/* try smaller window */
+			window_size /= 2;
+			len = 0;
+			continue;
+		}
 		if (window == MAP_FAILED) {
 			rc = -EINVAL;
-			warn(_("failed to do mmap: %s"), name);
+			warn(_("failed to do mmap: %s"), f->name);
 			break;
 		}
 
-		rc = do_mincore(ctl, window, len, name, count_incore);
+		rc = do_mincore(ctl, st, f, window, len,
+				file_offset / ctl->pagesize);
+		munmap (window, len);
 		if (rc)
 			break;
-
-		munmap (window, len);
 	}
 
+	if (!rc && st->run_start >= 0)
+		add_extent(f, st->run_start,
+			   (file_size - 1) / ctl->pagesize);
 	return rc;
 }
 
@@ -225,34 +362,160 @@ static int fincore_fd (struct fincore_control *ctl,
  * Returns: <0 on error, 0 success, 1 ignore.
  */
 static int fincore_name(struct fincore_control *ctl,
-			const char *name,
-			struct stat *sb,
-			off_t *count_incore)
+			struct fincore_state *st,
+			struct fincore_file *f)
 {
+	struct stat sb;
 	int fd;
 	int rc = 0;
 
-	if ((fd = open (name, O_RDONLY)) < 0) {
-		warn(_("failed to open: %s"), name);
+	if ((fd = open (f->name, O_RDONLY)) < 0) {
+		warn(_("failed to open: %s"), f->name);
 		return -errno;
 	}
 
-	if (fstat (fd, sb) < 0) {
-		warn(_("failed to do fstat: %s"), name);
+	if (fstat (fd, &sb) < 0) {
+		warn(_("failed to do fstat: %s"), f->name);
 		close (fd);
 		return -errno;
 	}
 
-	if (S_ISDIR(sb->st_mode))
+	f->size = sb.st_size;
+
+	if (S_ISDIR(sb.st_mode))
 		rc = 1;			/* ignore */
 
-	else if (sb->st_size)
-		rc = fincore_fd(ctl, fd, name, sb->st_size, count_incore);
+	else if (sb.st_size)
+		rc = fincore_fd(ctl, st, f, fd);
 
 	close (fd);
 	return rc;
 }
 
+static void *fincore_thread(void *data)
+{
+	struct fincore_control *ctl = data;
+	struct fincore_state st = { .vecsz = N_PAGES_IN_WINDOW };
+
+	st.vec = xmalloc(st.vecsz);
+
+	for (;;) {
+		size_t i = __sync_fetch_and_add(&ctl->next_file, 1);
+		struct fincore_file *f;
+
+		if (i >= ctl->nfiles)
+			break;
+		f = &ctl->files[i];
+		if (!f->is_dir)
+			f->rc = fincore_name(ctl, &st, f);
+	}
+
+	free(st.vec);
+	return NULL;
+}
+
+static void fincore_files(struct fincore_control *ctl)
+{
+	pthread_t threads[FINCORE_MAX_THREADS];
+	size_t i, n = min(ctl->nthreads, ctl->nfiles);
+
+	ctl->next_file = 0;
+
+	/* the main thread is the first worker */
+	for (i = 1; i < n; i++) {
+		if (pthread_create(&threads[i], NULL, fincore_thread, ctl) != 0) {
+			n = i;
+			break;
+		}
+	}
+	fincore_thread(ctl);
+
+	for (i = 1; i < n; i++)
+		pthread_join(threads[i], NULL);
+}
+
+static size_t add_file(struct fincore_control *ctl, const char *name,
+		       size_t parent)
+{
+	struct fincore_file *f;
+
+	if (ctl->nfiles % 256 == 0)
+		ctl->files = xrealloc(ctl->files,
+				(ctl->nfiles + 256) * sizeof(struct fincore_file));
+
+	f = &ctl->files[ctl->nfiles++];
+	memset(f, 0, sizeof(*f));
+	f->name = xstrdup(name);
+	f->parent = parent;
+
+	return ctl->nfiles;
+}
+
+/*
+ * Add regular files and subdirectories of the directory, directories are
+ * not followed by symlinks.
+ */
+static int add_directory(struct fincore_control *ctl, const char *name,
+			 size_t parent)
+{
+	struct dirent **list = NULL;
+	size_t dir;
+	int i, n, rc = 0;
+
+	n = scandir(name, &list, NULL, alphasort);
+	if (n < 0) {
+		warn(_("failed to open directory: %s"), name);
+		return -errno;
+	}
+
+	dir = add_file(ctl, name, parent);
+	ctl->files[dir - 1].is_dir = 1;
+
+	for (i = 0; i < n; i++) {
+		const char *d_name = list[i]->d_name;
+		char *path = NULL;
+		struct stat sb;
+
+		if (!strcmp(d_name, ".") || !strcmp(d_name, ".."))
+			goto next;
+
+		xasprintf(&path, "%s%s%s", name,
+			  *name && name[strlen(name) - 1] == '/' ? "" : "/",
+			  d_name);
+
+		if (lstat(path, &sb) != 0) {
+			warn(_("failed to do lstat: %s"), path);
+			rc = -errno;
+		} else if (S_ISDIR(sb.st_mode)) {
+			if (add_directory(ctl, path, dir) < 0)
+				rc = -EINVAL;
+		} else if (S_ISREG(sb.st_mode))
+			add_file(ctl, path, dir);
+		free(path);
+	next:
+		free(list[i]);
+	}
+	free(list);
+	return rc;
+}
+
+/* add sizes and pages of the files to the directories */
+static void rollup_directories(struct fincore_control *ctl)
+{
+	size_t i = ctl->nfiles;
+
+	while (i > 0) {
+		struct fincore_file *f = &ctl->files[--i];
+
+		if (f->parent && f->rc == 0) {
+			struct fincore_file *dir = &ctl->files[f->parent - 1];
+
+			dir->size += f->size;
+			dir->count_incore += f->count_incore;
+		}
+	}
+}
+
 static void __attribute__((__noreturn__)) usage(void)
 {
 	FILE *out = stdout;
@@ -267,6 +530,8 @@ static void __attribute__((__noreturn__)) usage(void)
 	fputs(_(" -n, --noheadings      don't print headings\n"), out);
 	fputs(_(" -o, --output <list>   output columns\n"), out);
 	fputs(_(" -r, --raw             use raw output format\n"), out);
+	fputs(_(" -R, --recursive       count files in directories recursively\n"), out);
+	fputs(_("     --threads <num>   number of threads to count files in parallel\n"), out);
 
 	fputs(USAGE_SEPARATOR, out);
 	printf(USAGE_HELP_OPTIONS(23));
@@ -287,9 +552,13 @@ int main(int argc, char ** argv)
 	size_t i;
 	int rc = EXIT_SUCCESS;
 	char *outarg = NULL;
+	enum {
+		OPT_THREADS = CHAR_MAX + 1
+	};
 
 	struct fincore_control ctl = {
-		.pagesize = getpagesize()
+		.pagesize = getpagesize(),
+		.nthreads = 1
 	};
 
 	static const struct option longopts[] = {
@@ -300,6 +569,8 @@ int main(int argc, char ** argv)
 		{ "help",	no_argument, NULL, 'h' },
 		{ "json",       no_argument, NULL, 'J' },
 		{ "raw",        no_argument, NULL, 'r' },
+		{ "recursive",  no_argument, NULL, 'R' },
+		{ "threads",    required_argument, NULL, OPT_THREADS },
 		{ NULL, 0, NULL, 0 },
 	};
 
@@ -308,7 +579,7 @@ int main(int argc, char ** argv)
 	textdomain(PACKAGE);
 	close_stdout_atexit();
 
-	while ((c = getopt_long (argc, argv, "bno:JrVh", longopts, NULL)) != -1) {
+	while ((c = getopt_long (argc, argv, "bno:JrRVh", longopts, NULL)) != -1) {
 		switch (c) {
 		case 'b':
 			ctl.bytes = 1;
@@ -325,6 +596,17 @@ int main(int argc, char ** argv)
 		case 'r':
 			ctl.raw = 1;
 			break;
+		case 'R':
+			ctl.recursive = 1;
+			break;
+		case OPT_THREADS:
+			ctl.nthreads = strtou32_or_err(optarg, _("invalid threads argument"));
+			if (!ctl.nthreads) {
+				long n = sysconf(_SC_NPROCESSORS_ONLN);
+				ctl.nthreads = n > 0 ? n : 1;
+			}
+			ctl.nthreads = min(ctl.nthreads, (size_t) FINCORE_MAX_THREADS);
+			break;
 		case 'V':
 			print_version(EXIT_SUCCESS);
 		case 'h':
@@ -365,7 +647,14 @@ int main(int argc, char ** argv)
 		const struct colinfo *col = get_column_info(i);
 		struct libscols_column *cl;
 
-		cl = scols_table_new_column(ctl.tb, col->name, col->whint, col->flags);
+		int flags = col->flags;
+
+		if (get_column_id(i) == COL_FILE && ctl.recursive)
+			flags |= SCOLS_FL_TREE;
+		if (get_column_id(i) == COL_EXTENTS)
+			ctl.extents = 1;
+
+		cl = scols_table_new_column(ctl.tb, col->name, col->whint, flags);
 		if (!cl)
 			err(EXIT_FAILURE, _("failed to allocate output column"));
 
@@ -374,6 +663,7 @@ int main(int argc, char ** argv)
 
 			switch (id) {
 			case COL_FILE:
+			case COL_EXTENTS:
 				scols_column_set_json_type(cl, SCOLS_JSON_STRING);
 				break;
 			case COL_SIZE:
@@ -391,11 +681,25 @@ int main(int argc, char ** argv)
 	for(; optind < argc; optind++) {
 		char *name = argv[optind];
 		struct stat sb;
-		off_t count_incore = 0;
 
-		switch (fincore_name(&ctl, name, &sb, &count_incore)) {
+		if (ctl.recursive && stat(name, &sb) == 0 && S_ISDIR(sb.st_mode)) {
+			if (add_directory(&ctl, name, 0) != 0)
+				rc = EXIT_FAILURE;
+		} else
+			add_file(&ctl, name, 0);
+	}
+
+	fincore_files(&ctl);
+
+	if (ctl.recursive)
+		rollup_directories(&ctl);
+
+	for (i = 0; i < ctl.nfiles; i++) {
+		struct fincore_file *f = &ctl.files[i];
+
+		switch (f->rc) {
 		case 0:
-			add_output_data(&ctl, name, sb.st_size, count_incore);
+			add_output_data(&ctl, f);
 			break;
 		case 1:
 			break; /* ignore */
@@ -403,10 +707,13 @@ int main(int argc, char ** argv)
 			rc = EXIT_FAILURE;
 			break;
 		}
+		free(f->name);
+		free(f->extents);
 	}
 
 	scols_print_table(ctl.tb);
 	scols_unref_table(ctl.tb);
+	free(ctl.files);
 
 	return rc;
 }
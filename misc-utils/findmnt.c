@@ -825,6 +825,10 @@ static struct libmnt_table *parse_tabfiles(char **files,
 	}
 	mnt_table_set_parser_errcb(tb, parser_errcb);
 
+	/* keep lines for mnt_table_refresh() in poll_table() */
+	if (flags & FL_POLL)
+		mnt_table_enable_refresh(tb, 1);
+
 	do {
 		/* NULL means that libmount will use default paths */
 		const char *path = nfiles ? *files++ : NULL;
@@ -1084,16 +1088,9 @@ static int poll_table(struct libmnt_table *tb, const char *tabfile,
 	FILE *f = NULL;
 	int rc = -1;
 	struct libmnt_iter *itr = NULL;
-	struct libmnt_table *tb_new;
 	struct libmnt_tabdiff *diff = NULL;
 	struct pollfd fds[1];
 
-	tb_new = mnt_new_table();
-	if (!tb_new) {
-		warn(_("failed to initialize libmount table"));
-		goto done;
-	}
-
 	itr = mnt_new_iter(direction);
 	if (!itr) {
 		warn(_("failed to initialize libmount iterator"));
@@ -1108,7 +1105,6 @@ static int poll_table(struct libmnt_table *tb, const char *tabfile,
 
 	/* cache is unnecessary to detect changes */
 	mnt_table_set_cache(tb, NULL);
-	mnt_table_set_cache(tb_new, NULL);
 
 	f = fopen(tabfile, "r");
 	if (!f) {
@@ -1116,13 +1112,12 @@ static int poll_table(struct libmnt_table *tb, const char *tabfile,
 		goto done;
 	}
 
-	mnt_table_set_parser_errcb(tb_new, parser_errcb);
+	mnt_table_set_parser_errcb(tb, parser_errcb);
 
 	fds[0].fd = fileno(f);
 	fds[0].events = POLLPRI;
 
 	while (1) {
-		struct libmnt_table *tmp;
 		struct libmnt_fs *old, *new;
 		int change, count;
 
@@ -1134,10 +1129,9 @@ static int poll_table(struct libmnt_table *tb, const char *tabfile,
 			goto done;
 		}
 
+		/* re-read the file, only the modified lines are parsed */
 		rewind(f);
-		rc = mnt_table_parse_stream(tb_new, f, tabfile);
-		if (!rc)
-			rc = mnt_diff_tables(diff, tb, tb_new);
+		rc = mnt_table_refresh(tb, f, tabfile, diff);
 		if (rc < 0)
 			goto done;
 
@@ -1167,14 +1161,8 @@ static int poll_table(struct libmnt_table *tb, const char *tabfile,
 				goto done;
 		}
 
-		/* swap tables */
-		tmp = tb;
-		tb = tb_new;
-		tb_new = tmp;
-
 		/* remove already printed lines to reduce memory usage */
 		scols_table_remove_lines(table);
-		mnt_reset_table(tb_new);
 
 		if (count && (flags & FL_FIRSTONLY))
 			break;
@@ -1182,7 +1170,6 @@ static int poll_table(struct libmnt_table *tb, const char *tabfile,
 
 	rc = 0;
 done:
-	mnt_unref_table(tb_new);
 	mnt_free_tabdiff(diff);
 	mnt_free_iter(itr);
 	if (f)
@@ -31,6 +31,9 @@
 #include <dirent.h>
 #include <fcntl.h>
 #include <errno.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <sys/syscall.h>
 #ifdef HAVE_PCRE
 # define PCRE2_CODE_UNIT_WIDTH 8
 # include <pcre2.h>
@@ -39,31 +42,131 @@
 #include "c.h"
 #include "xalloc.h"
 #include "nls.h"
+#include "strutils.h"
+#include "fileutils.h"
 #include "closestream.h"
 
-#define NHASH   (1<<17)  /* Must be a power of 2! */
-#define NBUF    64
+#define HEADSZ	(4 * 1024)	/* size of the first and last block for the quick digest */
+#define IOBUFSZ	(1024 * 1024)	/* read buffer to calculate digest and compare files */
+#define ARENASZ	(1024 * 1024)	/* size of the arena block */
+#define DIRBUFSZ	(256 * 1024)	/* getdents64() buffer */
 
-struct hardlink_file;
+#define NO_DIR	((size_t) -1)
 
-struct hardlink_hash {
-	struct hardlink_hash *next;
-	struct hardlink_file *chain;
-	off_t size;
-	time_t mtime;
+/*
+ * Simple memory arena for the file records and names; the memory is never
+ * released before exit and the allocated chunks are never moved.
+ */
+struct hardlink_arena_blk {
+	struct hardlink_arena_blk *next;
+	char data[];
+};
+
+struct hardlink_arena {
+	struct hardlink_arena_blk *blocks;
+	char *cur;		/* free space in the current block */
+	size_t left;
+	size_t size;		/* allocated memory */
+	size_t used;		/* used memory */
+};
+
+/*
+ * Directory entry read by the walk threads. The entries are processed after
+ * the walk in the same order as they have been returned by the directory, so
+ * the result does not depend on the threads.
+ */
+enum {
+	HL_ENT_OTHER = 0,	/* not a regular file or directory */
+	HL_ENT_FAILED,		/* cannot stat */
+	HL_ENT_EXCLUDED,	/* matches --exclude */
+	HL_ENT_OTHERDEV,	/* on different filesystem, not read */
+	HL_ENT_EMPTY,		/* empty regular file */
+	HL_ENT_FILE,		/* regular file */
+	HL_ENT_DIR		/* directory */
+};
+
+struct hardlink_entry {
+	union {
+		struct hardlink_file *file;	/* HL_ENT_FILE */
+		size_t dir;			/* HL_ENT_DIR */
+		const char *name;		/* others */
+	} u;
+	unsigned char type;
 };
 
-struct hardlink_dir {
-	struct hardlink_dir *next;
-	char name[];
+/*
+ * The path of the file or directory is not stored as one string, but as a
+ * reference to the parent directory and the name in the directory.
+ */
+struct hardlink_dirent {
+	size_t parent;		/* index to hardlink_ctl->dirents or NO_DIR */
+	const char *name;
+
+	struct hardlink_entry *ents;	/* content of the directory */
+	size_t nents;
+	unsigned int failed:1;		/* cannot open */
 };
 
+/*
+ * Regular file found by the directory walk. The files are linked after the
+ * walk is finished; see dedup_files() for more details.
+ */
 struct hardlink_file {
-	struct hardlink_file *next;
+	size_t idx;		/* the order in which the file has been found */
+	size_t dir;		/* index to hardlink_ctl->dirents */
+	const char *name;	/* name in the directory (or path if dir is NO_DIR) */
 	ino_t ino;
 	dev_t dev;
-	unsigned int cksum;
-	char name[];
+	off_t size;
+	uint64_t mtime_ns;
+	uint64_t ctime_ns;	/* for --cache */
+	mode_t mode;
+	uid_t uid;
+	gid_t gid;
+
+	struct hardlink_file *same;	/* first found file with the same inode */
+
+	uint64_t head[2];	/* digest of the first and last block */
+	uint64_t digest[2];	/* digest of the whole content */
+
+	unsigned int
+		has_head:1,	/* head[] is valid */
+		has_digest:1,	/* digest[] is valid */
+		failed:1,	/* cannot read the file */
+		linked:1;	/* already replaced by link */
+};
+
+/*
+ * The --cache file is header followed by array of entries sorted by dev and
+ * inode. The file is mmap-ed and the entries are not copied, it's valid only
+ * on the same architecture (see 'bom').
+ */
+#define HARDLINK_CACHE_MAGIC	"HLCACHE"
+#define HARDLINK_CACHE_VERSION	1
+#define HARDLINK_CACHE_BOM	0x01020304
+
+struct hardlink_cache_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t bom;
+	uint32_t entsz;
+	uint32_t reserved;
+	uint64_t nents;
+};
+
+#define HARDLINK_CACHE_HEAD	(1 << 0)	/* head[] is valid */
+#define HARDLINK_CACHE_DIGEST	(1 << 1)	/* digest[] is valid */
+
+struct hardlink_cache_ent {
+	uint64_t dev;
+	uint64_t ino;
+	uint64_t size;
+	uint64_t mtime_ns;
+	uint64_t ctime_ns;
+	uint64_t head[2];
+	uint64_t digest[2];
+	uint32_t flags;
+	uint32_t reserved;
 };
 
 struct hardlink_dynstr {
@@ -71,11 +174,56 @@ struct hardlink_dynstr {
 	size_t alloc;
 };
 
+struct hardlink_ctl;
+
+/* directory walk thread */
+struct hardlink_walker {
+	struct hardlink_ctl *ctl;
+	pthread_t thread;
+	struct hardlink_arena records;	/* struct hardlink_file */
+	struct hardlink_arena names;	/* file and directory names */
+	struct hardlink_dynstr path;
+	char *buf;			/* getdents64() buffer */
+#ifdef HAVE_PCRE
+	pcre2_match_data *match_data;
+#endif
+};
+
 struct hardlink_ctl {
-	struct hardlink_dir *dirs;
-	struct hardlink_hash *hps[NHASH];
-	char iobuf1[BUFSIZ];
-	char iobuf2[BUFSIZ];
+	struct hardlink_dirent *dirents;	/* all directories */
+	size_t ndirents;
+	size_t ndirallocs;
+	struct hardlink_file **files;	/* all regular files */
+	size_t nfiles;
+	size_t nallocs;
+	/* directory walk */
+	struct hardlink_walker *walkers;	/* ctl->nthreads walkers */
+	pthread_mutex_t lock;		/* protects dirents[] and queue[] */
+	pthread_cond_t cond;
+	size_t *queue;			/* directories to read */
+	size_t nqueue;
+	size_t nqueueallocs;
+	size_t nbusy;			/* number of walkers reading directory */
+#ifdef HAVE_PCRE
+	pcre2_code *re;
+#endif
+	/* index of files by inode (open addressing, linear probing) */
+	struct hardlink_file **inodes;
+	size_t ninodes;			/* number of slots, power of 2 */
+	size_t ninodes_used;
+	char *iobuf1;
+	char *iobuf2;
+	struct hardlink_dynstr path1;
+	struct hardlink_dynstr path2;
+	unsigned int nthreads;		/* number of walk and hashing threads */
+	/* --cache */
+	const char *cachefile;
+	void *cachemap;
+	size_t cachesz;
+	const struct hardlink_cache_ent *cache;
+	size_t ncache;
+	unsigned long long ncached;	/* digests from cache */
+	unsigned long long nerrors;	/* unreadable files */
 	/* summary counters */
 	unsigned long long ndirs;
 	unsigned long long nobjects;
@@ -90,16 +238,21 @@ struct hardlink_ctl {
 	unsigned int
 		no_link:1,
 		content_only:1,
+		memory_stats:1,
 		force:1;
 };
 /* ctl is in global scope due use in atexit() */
 struct hardlink_ctl global_ctl;
 
-__attribute__ ((always_inline))
-static inline unsigned int hash(off_t size, time_t mtime)
-{
-	return (size ^ mtime) & (NHASH - 1);
-}
+/* set of files for hashing threads */
+struct hardlink_job {
+	struct hardlink_ctl *ctl;
+	struct hardlink_file **files;
+	size_t nfiles;
+	size_t next;			/* next file to hash */
+	int full;			/* calculate digest of the whole file */
+	pthread_mutex_t lock;
+};
 
 __attribute__ ((always_inline))
 static inline int stcmp(struct stat *st1, struct stat *st2, int content_scope)
@@ -128,6 +281,10 @@ static void print_summary(void)
 	printf(_("Objects:       %9lld\n"), ctl->nobjects);
 	printf(_("Regular files: %9lld\n"), ctl->nregfiles);
 	printf(_("Comparisons:   %9lld\n"), ctl->ncomp);
+	if (ctl->cachefile)
+		printf(_("Cached:        %9lld\n"), ctl->ncached);
+	if (ctl->nerrors)
+		printf(_("Read errors:   %9lld\n"), ctl->nerrors);
 	printf(  "%s%9lld\n", (ctl->no_link ?
 	       _("Would link:    ") :
 	       _("Linked:        ")), ctl->nlinks);
@@ -136,6 +293,29 @@ static void print_summary(void)
 	       _("Saved:        ")), ctl->nsaved);
 }
 
+static void print_memory_stats(void)
+{
+	struct hardlink_ctl const *const ctl = &global_ctl;
+	size_t i, records = 0, names = 0, namesz = 0;
+
+	if (!ctl->memory_stats)
+		return;
+
+	for (i = 0; ctl->walkers && i < ctl->nthreads; i++) {
+		records += ctl->walkers[i].records.size;
+		names += ctl->walkers[i].names.used;
+		namesz += ctl->walkers[i].names.size;
+	}
+
+	printf(_("File records:  %9zu (%zu bytes)\n"), ctl->nfiles,
+			records + ctl->nallocs * sizeof(struct hardlink_file *));
+	printf(_("Dir records:   %9zu (%zu bytes)\n"), ctl->ndirents,
+			ctl->ndirallocs * sizeof(struct hardlink_dirent));
+	printf(_("Names:         %9zu (%zu bytes allocated)\n"), names, namesz);
+	printf(_("Inode index:   %9zu (%zu slots, %zu bytes)\n"), ctl->ninodes_used,
+			ctl->ninodes, ctl->ninodes * sizeof(struct hardlink_file *));
+}
+
 static void __attribute__((__noreturn__)) usage(void)
 {
 	fputs(USAGE_HEADER, stdout);
@@ -151,6 +331,9 @@ static void __attribute__((__noreturn__)) usage(void)
 	puts(_(" -vv                    print every hardlinked file and summary"));
 	puts(_(" -f, --force            force hardlinking across filesystems"));
 	puts(_(" -x, --exclude <regex>  exclude files matching pattern"));
+	puts(_("     --memory-stats     print memory usage summary"));
+	puts(_("     --cache <file>     use and update cache of file digests"));
+	puts(_("     --threads <num>    number of threads to walk directories and read files"));
 
 	fputs(USAGE_SEPARATOR, stdout);
 	printf(USAGE_HELP_OPTIONS(16)); /* char offset to align option descriptions */
@@ -181,10 +364,1190 @@ static void growstr(struct hardlink_dynstr *str, size_t newlen)
 	str->buf = xrealloc(str->buf, str->alloc = add2(newlen, 1));
 }
 
-static void process_path(struct hardlink_ctl *ctl, const char *name)
+static void *arena_alloc(struct hardlink_arena *ar, size_t sz, size_t align)
+{
+	size_t pad = (align - ((uintptr_t) ar->cur & (align - 1))) & (align - 1);
+	char *p;
+
+	if (!ar->cur || ar->left < add2(sz, pad)) {
+		size_t blksz = sz > ARENASZ / 4 ? sz : ARENASZ;
+		struct hardlink_arena_blk *blk = xmalloc(add2(sizeof(*blk), blksz));
+
+		blk->next = ar->blocks;
+		ar->blocks = blk;
+		ar->size += blksz;
+		if (blksz != ARENASZ) {
+			/* large chunk, keep the current block */
+			ar->used += sz;
+			return blk->data;
+		}
+		ar->cur = blk->data;
+		ar->left = blksz;
+		pad = 0;
+	}
+
+	p = ar->cur + pad;
+	ar->cur += pad + sz;
+	ar->left -= pad + sz;
+	ar->used += sz;
+	return p;
+}
+
+static void arena_free(struct hardlink_arena *ar)
+{
+	while (ar->blocks) {
+		struct hardlink_arena_blk *blk = ar->blocks;
+
+		ar->blocks = blk->next;
+		free(blk);
+	}
+	ar->cur = NULL;
+	ar->left = 0;
+}
+
+static const char *arena_strdup(struct hardlink_arena *ar, const char *str)
+{
+	size_t len = strlen(str);
+	char *p = arena_alloc(ar, add2(len, 1), 1);
+
+	memcpy(p, str, len + 1);
+	return p;
+}
+
+/* the @name has to be persistent; must be called with ctl->lock when walking */
+static size_t add_dirent(struct hardlink_ctl *ctl, size_t parent, const char *name)
+{
+	struct hardlink_dirent *de;
+
+	if (ctl->ndirents == ctl->ndirallocs) {
+		ctl->ndirallocs = ctl->ndirallocs ? ctl->ndirallocs * 2 : 256;
+		ctl->dirents = xrealloc(ctl->dirents,
+			ctl->ndirallocs * sizeof(struct hardlink_dirent));
+	}
+	de = &ctl->dirents[ctl->ndirents];
+	memset(de, 0, sizeof(*de));
+	de->parent = parent;
+	de->name = name;
+	return ctl->ndirents++;
+}
+
+/* appends path of the directory @id to @str, returns the new length */
+static size_t dir_path(struct hardlink_ctl const *ctl, size_t id,
+		       struct hardlink_dynstr *str, size_t len)
+{
+	const struct hardlink_dirent *de = &ctl->dirents[id];
+	size_t namelen = strlen(de->name);
+
+	if (de->parent != NO_DIR) {
+		len = dir_path(ctl, de->parent, str, len);
+		growstr(str, add2(len, 1));
+		str->buf[len++] = '/';
+	}
+	growstr(str, add2(len, namelen));
+	memcpy(str->buf + len, de->name, namelen + 1);
+	return len + namelen;
+}
+
+/* composes the full path of the file to @str */
+static const char *file_path(struct hardlink_ctl const *ctl,
+			     struct hardlink_file const *fl,
+			     struct hardlink_dynstr *str)
+{
+	size_t len = 0, namelen = strlen(fl->name);
+
+	if (fl->dir != NO_DIR) {
+		len = dir_path(ctl, fl->dir, str, 0);
+		growstr(str, add2(len, 1));
+		str->buf[len++] = '/';
+	}
+	growstr(str, add2(len, namelen));
+	memcpy(str->buf + len, fl->name, namelen + 1);
+	return str->buf;
+}
+
+static inline size_t hash_inode(dev_t dev, ino_t ino)
+{
+	uint64_t h = ((uint64_t) dev * 0x9e3779b97f4a7c15ULL) ^ ino;
+
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdULL;
+	h ^= h >> 33;
+	return h;
+}
+
+/*
+ * Adds @fl to the index of the inodes. Returns the first found file with the
+ * same inode or NULL.
+ */
+static struct hardlink_file *index_inode(struct hardlink_ctl *ctl,
+					 struct hardlink_file *fl)
+{
+	size_t i, mask;
+
+	/* keep the load factor below 1/2 */
+	if ((ctl->ninodes_used + 1) * 2 > ctl->ninodes) {
+		struct hardlink_file **old = ctl->inodes;
+		size_t n, oldsz = ctl->ninodes;
+
+		ctl->ninodes = oldsz ? oldsz * 2 : 1024;
+		ctl->inodes = xcalloc(ctl->ninodes, sizeof(struct hardlink_file *));
+		mask = ctl->ninodes - 1;
+
+		for (n = 0; n < oldsz; n++) {
+			if (!old[n])
+				continue;
+			i = hash_inode(old[n]->dev, old[n]->ino) & mask;
+			while (ctl->inodes[i])
+				i = (i + 1) & mask;
+			ctl->inodes[i] = old[n];
+		}
+		free(old);
+	}
+
+	mask = ctl->ninodes - 1;
+	i = hash_inode(fl->dev, fl->ino) & mask;
+
+	for (; ctl->inodes[i]; i = (i + 1) & mask) {
+		if (ctl->inodes[i]->ino == fl->ino && ctl->inodes[i]->dev == fl->dev)
+			return ctl->inodes[i];
+	}
+	ctl->inodes[i] = fl;
+	ctl->ninodes_used++;
+	return NULL;
+}
+
+static inline uint64_t rotl64(uint64_t x, int r)
+{
+	return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t fmix64(uint64_t k)
+{
+	k ^= k >> 33;
+	k *= 0xff51afd7ed558ccdULL;
+	k ^= k >> 33;
+	k *= 0xc4ceb9fe1a85ec53ULL;
+	k ^= k >> 33;
+	return k;
+}
+
+/*
+ * MurmurHash3 x64 128-bit (public domain, Austin Appleby). The @h is the seed
+ * and result, so it's possible to hash data in more chunks.
+ */
+static void murmur3_128(const void *data, size_t len, uint64_t h[2])
+{
+	const unsigned char *p = data, *tail;
+	const uint64_t c1 = 0x87c37b91114253d5ULL;
+	const uint64_t c2 = 0x4cf5ad432745937fULL;
+	uint64_t h1 = h[0], h2 = h[1], k1, k2;
+	size_t i, nblocks = len / 16;
+
+	for (i = 0; i < nblocks; i++, p += 16) {
+		memcpy(&k1, p, sizeof(k1));
+		memcpy(&k2, p + 8, sizeof(k2));
+
+		k1 *= c1; k1 = rotl64(k1, 31); k1 *= c2; h1 ^= k1;
+		h1 = rotl64(h1, 27); h1 += h2; h1 = h1 * 5 + 0x52dce729;
+
+		k2 *= c2; k2 = rotl64(k2, 33); k2 *= c1; h2 ^= k2;
+		h2 = rotl64(h2, 31); h2 += h1; h2 = h2 * 5 + 0x38495ab5;
+	}
+
+	tail = p;
+	k1 = k2 = 0;
+
+	switch (len & 15) {
+	case 15: k2 ^= ((uint64_t) tail[14]) << 48;	/* fallthrough */
+	case 14: k2 ^= ((uint64_t) tail[13]) << 40;	/* fallthrough */
+	case 13: k2 ^= ((uint64_t) tail[12]) << 32;	/* fallthrough */
+	case 12: k2 ^= ((uint64_t) tail[11]) << 24;	/* fallthrough */
+	case 11: k2 ^= ((uint64_t) tail[10]) << 16;	/* fallthrough */
+	case 10: k2 ^= ((uint64_t) tail[ 9]) << 8;	/* fallthrough */
+	case  9: k2 ^= ((uint64_t) tail[ 8]);
+		 k2 *= c2; k2 = rotl64(k2, 33); k2 *= c1; h2 ^= k2;
+		 /* fallthrough */
+	case  8: k1 ^= ((uint64_t) tail[ 7]) << 56;	/* fallthrough */
+	case  7: k1 ^= ((uint64_t) tail[ 6]) << 48;	/* fallthrough */
+	case  6: k1 ^= ((uint64_t) tail[ 5]) << 40;	/* fallthrough */
+	case  5: k1 ^= ((uint64_t) tail[ 4]) << 32;	/* fallthrough */
+	case  4: k1 ^= ((uint64_t) tail[ 3]) << 24;	/* fallthrough */
+	case  3: k1 ^= ((uint64_t) tail[ 2]) << 16;	/* fallthrough */
+	case  2: k1 ^= ((uint64_t) tail[ 1]) << 8;	/* fallthrough */
+	case  1: k1 ^= ((uint64_t) tail[ 0]);
+		 k1 *= c1; k1 = rotl64(k1, 31); k1 *= c2; h1 ^= k1;
+	}
+
+	h1 ^= len; h2 ^= len;
+	h1 += h2; h2 += h1;
+	h1 = fmix64(h1); h2 = fmix64(h2);
+	h1 += h2; h2 += h1;
+
+	h[0] = h1;
+	h[1] = h2;
+}
+
+static int read_all_at(int fd, char *buf, size_t count, off_t off)
+{
+	while (count > 0) {
+		ssize_t ret = pread(fd, buf, count, off);
+
+		if (ret <= 0) {
+			if (ret < 0 && (errno == EAGAIN || errno == EINTR))
+				continue;
+			if (ret == 0)
+				errno = EIO;	/* truncated underneath us */
+			return -1;
+		}
+		count -= ret;
+		buf += ret;
+		off += ret;
+	}
+	return 0;
+}
+
+/* called from hashing threads, @path is the path of @fl */
+static void read_failed(struct hardlink_ctl *ctl, struct hardlink_file *fl,
+			struct hardlink_dynstr *path)
+{
+	warn(_("cannot read %s"), path->buf);
+	fl->failed = 1;
+	__sync_fetch_and_add(&ctl->nerrors, 1);
+}
+
+/*
+ * Calculates the quick digest (first and last block, or the whole file
+ * for small files) or digest of the whole file content. The function is
+ * called from hashing threads.
+ */
+static void hash_file(struct hardlink_ctl *ctl, struct hardlink_file *fl, int full,
+		      char *buf, struct hardlink_dynstr *path)
+{
+	uint64_t *h = full ? fl->digest : fl->head;
+	off_t off;
+	int fd;
+
+	h[0] = h[1] = 0;
+
+	fd = open(file_path(ctl, fl, path), O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		fl->failed = 1;
+		return;
+	}
+
+	if (!full && fl->size > 2 * HEADSZ) {
+		if (read_all_at(fd, buf, HEADSZ, 0) ||
+		    read_all_at(fd, buf + HEADSZ, HEADSZ, fl->size - HEADSZ))
+			read_failed(ctl, fl, path);
+		else {
+			murmur3_128(buf, 2 * HEADSZ, h);
+			fl->has_head = 1;
+		}
+		close(fd);
+		return;
+	}
+
+#ifdef HAVE_POSIX_FADVISE
+	posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+	for (off = 0; off < fl->size; off += IOBUFSZ) {
+		size_t sz = fl->size - off > IOBUFSZ ? IOBUFSZ : fl->size - off;
+
+		if (read_all_at(fd, buf, sz, off)) {
+			read_failed(ctl, fl, path);
+			break;
+		}
+		murmur3_128(buf, sz, h);
+	}
+	close(fd);
+
+	if (fl->failed)
+		return;
+	if (full)
+		fl->has_digest = 1;
+	else {
+		/* small files are fully hashed by the quick digest */
+		memcpy(fl->digest, fl->head, sizeof(fl->digest));
+		fl->has_head = fl->has_digest = 1;
+	}
+}
+
+static void *hash_thread(void *data)
+{
+	struct hardlink_job *job = data;
+	struct hardlink_dynstr path = { NULL, 0 };
+	char *buf = xmalloc(IOBUFSZ);
+
+	while (1) {
+		size_t i;
+
+		pthread_mutex_lock(&job->lock);
+		i = job->next++;
+		pthread_mutex_unlock(&job->lock);
+
+		if (i >= job->nfiles)
+			break;
+		hash_file(job->ctl, job->files[i], job->full, buf, &path);
+	}
+	free(path.buf);
+	free(buf);
+	return NULL;
+}
+
+/* calculates digests for all files in @job by ctl->nthreads threads */
+static void hash_files(struct hardlink_ctl *ctl, struct hardlink_job *job)
+{
+	pthread_t *threads;
+	size_t i, n = ctl->nthreads;
+
+	if (!job->nfiles)
+		return;
+	if (n > job->nfiles)
+		n = job->nfiles;
+	if (n <= 1) {
+		hash_thread(job);
+		return;
+	}
+
+	threads = xcalloc(n, sizeof(pthread_t));
+	for (i = 0; i < n; i++) {
+		if (pthread_create(&threads[i], NULL, hash_thread, job) != 0)
+			err(EXIT_FAILURE, _("cannot create thread"));
+	}
+	for (i = 0; i < n; i++)
+		pthread_join(threads[i], NULL);
+	free(threads);
+}
+
+/*
+ * Adds @files to the @job, every inode is read only once and files with
+ * digest from --cache are not read at all.
+ */
+static void job_add(struct hardlink_job *job, struct hardlink_file **files, size_t n)
+{
+	size_t i;
+
+	job->files = xrealloc(job->files, (job->nfiles + n) * sizeof(struct hardlink_file *));
+	for (i = 0; i < n; i++) {
+		struct hardlink_file *fl = files[i];
+
+		if (fl->same || (job->full ? fl->has_digest : fl->has_head))
+			continue;
+		job->files[job->nfiles++] = fl;
+	}
+}
+
+/* copies digests to the other files with the same inode */
+static void copy_digests(struct hardlink_file **files, size_t nfiles)
+{
+	size_t i;
+
+	for (i = 0; i < nfiles; i++) {
+		struct hardlink_file *fl = files[i];
+
+		if (!fl->same)
+			continue;
+		memcpy(fl->head, fl->same->head, sizeof(fl->head));
+		memcpy(fl->digest, fl->same->digest, sizeof(fl->digest));
+		fl->has_head = fl->same->has_head;
+		fl->has_digest = fl->same->has_digest;
+		fl->failed = fl->same->failed;
+	}
+}
+
+/* files with the same attributes could be linked */
+static int cmp_attrs(const struct hardlink_file *x, const struct hardlink_file *y)
+{
+	if (x->dev != y->dev)
+		return x->dev < y->dev ? -1 : 1;
+	if (x->size != y->size)
+		return x->size < y->size ? -1 : 1;
+	if (global_ctl.content_only)
+		return 0;
+	/* compare seconds only, like stcmp() */
+	if (x->mtime_ns / 1000000000 != y->mtime_ns / 1000000000)
+		return x->mtime_ns < y->mtime_ns ? -1 : 1;
+	if (x->mode != y->mode)
+		return x->mode < y->mode ? -1 : 1;
+	if (x->uid != y->uid)
+		return x->uid < y->uid ? -1 : 1;
+	if (x->gid != y->gid)
+		return x->gid < y->gid ? -1 : 1;
+	return 0;
+}
+
+static int cmp_files_attrs(const void *a, const void *b)
+{
+	const struct hardlink_file *x = *(struct hardlink_file * const *) a,
+				   *y = *(struct hardlink_file * const *) b;
+	int rc = cmp_attrs(x, y);
+
+	if (rc)
+		return rc;
+	return x->idx < y->idx ? -1 : 1;
+}
+
+static int cmp_digests(const uint64_t *x, const uint64_t *y)
+{
+	if (x[0] != y[0])
+		return x[0] < y[0] ? -1 : 1;
+	if (x[1] != y[1])
+		return x[1] < y[1] ? -1 : 1;
+	return 0;
+}
+
+static int cmp_files_head(const void *a, const void *b)
+{
+	const struct hardlink_file *x = *(struct hardlink_file * const *) a,
+				   *y = *(struct hardlink_file * const *) b;
+	int rc = cmp_digests(x->head, y->head);
+
+	if (rc)
+		return rc;
+	return x->idx < y->idx ? -1 : 1;
+}
+
+static int cmp_files_digest(const void *a, const void *b)
+{
+	const struct hardlink_file *x = *(struct hardlink_file * const *) a,
+				   *y = *(struct hardlink_file * const *) b;
+	int rc = cmp_digests(x->digest, y->digest);
+
+	if (rc)
+		return rc;
+	return x->idx < y->idx ? -1 : 1;
+}
+
+/* returns size of the group of files equal to @files[0] by @cmp */
+static size_t group_size(struct hardlink_file **files, size_t nfiles,
+			 int (*cmp)(const struct hardlink_file *,
+				    const struct hardlink_file *))
+{
+	size_t i;
+
+	for (i = 1; i < nfiles; i++) {
+		if (cmp(files[0], files[i]) != 0)
+			break;
+	}
+	return i;
+}
+
+static int cmp_head(const struct hardlink_file *x, const struct hardlink_file *y)
+{
+	return x->failed || y->failed || cmp_digests(x->head, y->head);
+}
+
+static int cmp_digest(const struct hardlink_file *x, const struct hardlink_file *y)
+{
+	return x->failed || y->failed || cmp_digests(x->digest, y->digest);
+}
+
+/* returns 0 if the files have the same content */
+static int compare_files(struct hardlink_ctl *ctl, int fd1, int fd2, off_t size)
+{
+	off_t off;
+
+	for (off = 0; off < size; off += IOBUFSZ) {
+		size_t sz = size - off > IOBUFSZ ? IOBUFSZ : size - off;
+
+		if (read_all_at(fd1, ctl->iobuf1, sz, off) ||
+		    read_all_at(fd2, ctl->iobuf2, sz, off) ||
+		    memcmp(ctl->iobuf1, ctl->iobuf2, sz) != 0)
+			return 1;
+	}
+	return 0;
+}
+
+/*
+ * Verifies that @master and @fl (with the same digest) are still the same and
+ * replaces @fl with link to the @master. Returns 0 if linked, 1 if @master
+ * cannot be used (changed, different content or too many links) and -1 on
+ * another error.
+ */
+static int link_file(struct hardlink_ctl *ctl, struct hardlink_file *master,
+		     struct hardlink_file *fl)
 {
 	struct stat st, st2, st3;
-	const size_t namelen = strlen(name);
+	const char *n1, *n2;
+	int fd, fd2, rc;
+
+	n1 = file_path(ctl, master, &ctl->path1);
+	n2 = file_path(ctl, fl, &ctl->path2);
+
+	if (lstat(n2, &st) || !S_ISREG(st.st_mode) ||
+	    st.st_ino != fl->ino || st.st_dev != fl->dev)
+		return -1;
+	if (lstat(n1, &st2) || !S_ISREG(st2.st_mode) ||
+	    stcmp(&st, &st2, ctl->content_only) ||
+	    st2.st_ino == st.st_ino ||
+	    st2.st_dev != st.st_dev)
+		return 1;
+
+	fd = open(n2, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return -1;
+	fd2 = open(n1, O_RDONLY | O_CLOEXEC);
+	if (fd2 < 0) {
+		close(fd);
+		return 1;
+	}
+	if (fstat(fd2, &st2) || !S_ISREG(st2.st_mode) || st2.st_size == 0) {
+		close(fd);
+		close(fd2);
+		return 1;
+	}
+
+	ctl->ncomp++;
+	rc = compare_files(ctl, fd, fd2, st.st_size);
+	close(fd);
+	close(fd2);
+	if (rc)
+		return 1;
+
+	if (lstat(n2, &st3)) {
+		warn(_("cannot stat %s"), n2);
+		return -1;
+	}
+	st3.st_atime = st.st_atime;
+	if (stcmp(&st, &st3, 0)) {
+		warnx(_("file %s changed underneath us"), n2);
+		return -1;
+	}
+
+	if (!ctl->no_link) {
+		const char *suffix =
+		    ".$$$___cleanit___$$$";
+		const size_t suffixlen = strlen(suffix);
+		size_t n2len = strlen(n2);
+		struct hardlink_dynstr nam2 = { NULL, 0 };
+
+		growstr(&nam2, add2(n2len, suffixlen));
+		memcpy(nam2.buf, n2, n2len);
+		memcpy(&nam2.buf[n2len], suffix,
+		       suffixlen + 1);
+		/* First create a temporary link to n1 under a new name */
+		if (link(n1, nam2.buf)) {
+			rc = errno == EMLINK ? 1 : -1;
+			warn(_("failed to hardlink %s to %s (create temporary link as %s failed)"),
+				n1, n2, nam2.buf);
+			free(nam2.buf);
+			return rc;
+		}
+		/* Then rename into place over the existing n2 */
+		if (rename(nam2.buf, n2)) {
+			warn(_("failed to hardlink %s to %s (rename temporary link to %s failed)"),
+				n1, n2, n2);
+			/* Something went wrong, try to remove the now redundant temporary link */
+			if (unlink(nam2.buf))
+				warn(_("failed to remove temporary link %s"), nam2.buf);
+			free(nam2.buf);
+			return -1;
+		}
+		free(nam2.buf);
+	}
+	ctl->nlinks++;
+	if (st3.st_nlink > 1) {
+		/* We actually did not save anything this time, since the link second argument
+		   had some other links as well.  */
+		if (ctl->verbose > 1)
+			printf(_(" %s %s to %s\n"),
+				(ctl->no_link ? _("Would link") : _("Linked")),
+				n1, n2);
+	} else {
+		ctl->nsaved += ((st.st_size + 4095) / 4096) * 4096;
+		if (ctl->verbose > 1)
+			printf(_(" %s %s to %s, %s %jd\n"),
+				(ctl->no_link ? _("Would link") : _("Linked")),
+				n1, n2,
+				(ctl->no_link ? _("would save") : _("saved")),
+				(intmax_t)st.st_size);
+	}
+	fl->linked = 1;
+	return 0;
+}
+
+/*
+ * Links files with the same digest. The files are sorted in the order in
+ * which they have been found, every file is linked to the current master
+ * (the first file by default). The file is ignored if it's already linked
+ * to any previous not-replaced file. If the master cannot be used anymore
+ * (e.g. too many links) the file becomes the new master.
+ */
+static void link_files(struct hardlink_ctl *ctl, struct hardlink_file **files, size_t nfiles)
+{
+	struct hardlink_file **seen, *master = files[0];
+	size_t i, nseen = 16, mask;
+
+	/* not-replaced inodes, open addressing by inode number */
+	while (nseen < nfiles * 2)
+		nseen <<= 1;
+	mask = nseen - 1;
+	seen = xcalloc(nseen, sizeof(struct hardlink_file *));
+
+	for (i = 0; i < nfiles; i++) {
+		struct hardlink_file *fl = files[i];
+		size_t x;
+
+		for (x = fl->ino & mask; seen[x]; x = (x + 1) & mask) {
+			if (seen[x]->ino == fl->ino)
+				break;
+		}
+		if (seen[x])
+			continue;	/* same inode as previous file */
+
+		if (fl != master && link_file(ctl, master, fl) == 1)
+			master = fl;
+		if (!fl->linked)
+			seen[x] = fl;
+	}
+	free(seen);
+}
+
+/*
+ * Deduplication pipeline:
+ *
+ *  1) the files are grouped by size (and mtime, mode and owner if not
+ *     --content)
+ *  2) the digest of the first and last block is calculated for the groups
+ *  3) the digest of the whole content is calculated for the files with the
+ *     same quick digest
+ *  4) the files with the same digest are compared byte-by-byte and linked
+ *
+ * The digests are calculated by ctl->nthreads threads, the files with the
+ * same inode (see index_inode()) are read only once.
+ */
+static void dedup_files(struct hardlink_ctl *ctl)
+{
+	struct hardlink_file **files = ctl->files;
+	struct hardlink_job job = { .ctl = ctl };
+	size_t i, n, k, nfiles = ctl->nfiles;
+
+	if (!nfiles)
+		return;
+
+	/* group by attributes and calculate quick digest */
+	pthread_mutex_init(&job.lock, NULL);
+	qsort(files, nfiles, sizeof(struct hardlink_file *), cmp_files_attrs);
+
+	for (i = 0; i < nfiles; i += n) {
+		n = group_size(files + i, nfiles - i, cmp_attrs);
+		if (n > 1)
+			job_add(&job, files + i, n);
+	}
+	hash_files(ctl, &job);
+	copy_digests(files, nfiles);
+
+	/* calculate the full digest for files with the same quick digest */
+	job.nfiles = job.next = 0;
+	job.full = 1;
+
+	for (i = 0; i < nfiles; i += n) {
+		n = group_size(files + i, nfiles - i, cmp_attrs);
+		if (n < 2)
+			continue;
+		qsort(files + i, n, sizeof(struct hardlink_file *), cmp_files_head);
+
+		for (k = i; k < i + n; ) {
+			size_t x = group_size(files + k, i + n - k, cmp_head);
+
+			if (x > 1 && files[k]->size > 2 * HEADSZ)
+				job_add(&job, files + k, x);
+			k += x;
+		}
+	}
+	hash_files(ctl, &job);
+	copy_digests(files, nfiles);
+
+	/* compare and link */
+	for (i = 0; i < nfiles; i += n) {
+		n = group_size(files + i, nfiles - i, cmp_attrs);
+		if (n < 2)
+			continue;
+		for (k = i; k < i + n; ) {
+			size_t x = group_size(files + k, i + n - k, cmp_head);
+			size_t y;
+
+			if (x < 2) {
+				k += x;
+				continue;
+			}
+			qsort(files + k, x, sizeof(struct hardlink_file *), cmp_files_digest);
+			for (y = k; y < k + x; ) {
+				size_t z = group_size(files + y, k + x - y, cmp_digest);
+
+				if (z > 1)
+					link_files(ctl, files + y, z);
+				y += z;
+			}
+			k += x;
+		}
+	}
+
+	pthread_mutex_destroy(&job.lock);
+	free(job.files);
+}
+
+static inline uint64_t timespec_ns(time_t sec, long nsec)
+{
+	return (uint64_t) sec * 1000000000ULL + nsec;
+}
+
+static void cache_load(struct hardlink_ctl *ctl)
+{
+	const struct hardlink_cache_header *hdr;
+	struct stat st;
+	int fd;
+
+	fd = open(ctl->cachefile, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		if (errno != ENOENT)
+			warn(_("cannot open %s"), ctl->cachefile);
+		return;
+	}
+	if (fstat(fd, &st) || (size_t) st.st_size < sizeof(*hdr))
+		goto bad;
+
+	ctl->cachesz = st.st_size;
+	ctl->cachemap = mmap(NULL, ctl->cachesz, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (ctl->cachemap == MAP_FAILED) {
+		ctl->cachemap = NULL;
+		warn(_("cannot mmap %s"), ctl->cachefile);
+		close(fd);
+		return;
+	}
+	close(fd);
+
+	hdr = ctl->cachemap;
+	if (memcmp(hdr->magic, HARDLINK_CACHE_MAGIC, sizeof(HARDLINK_CACHE_MAGIC)) != 0
+	    || hdr->version != HARDLINK_CACHE_VERSION
+	    || hdr->bom != HARDLINK_CACHE_BOM
+	    || hdr->entsz != sizeof(struct hardlink_cache_ent)
+	    || hdr->nents > (ctl->cachesz - sizeof(*hdr)) / sizeof(struct hardlink_cache_ent)
+	    || sizeof(*hdr) + hdr->nents * sizeof(struct hardlink_cache_ent) != ctl->cachesz) {
+		munmap(ctl->cachemap, ctl->cachesz);
+		ctl->cachemap = NULL;
+		fd = -1;
+		goto bad;
+	}
+
+	ctl->cache = (const struct hardlink_cache_ent *) (hdr + 1);
+	ctl->ncache = hdr->nents;
+	return;
+bad:
+	warnx(_("%s: invalid cache file, ignore"), ctl->cachefile);
+	if (fd >= 0)
+		close(fd);
+}
+
+static int cmp_cache_ent(const void *a, const void *b)
+{
+	const struct hardlink_cache_ent *x = a, *y = b;
+
+	if (x->dev != y->dev)
+		return x->dev < y->dev ? -1 : 1;
+	if (x->ino != y->ino)
+		return x->ino < y->ino ? -1 : 1;
+	return 0;
+}
+
+/* sets digests from cache if the file has not been modified */
+static void cache_lookup(struct hardlink_ctl *ctl, struct hardlink_file *fl)
+{
+	const struct hardlink_cache_ent *ent;
+	struct hardlink_cache_ent key = {
+		.dev = fl->dev,
+		.ino = fl->ino
+	};
+
+	ent = bsearch(&key, ctl->cache, ctl->ncache, sizeof(key), cmp_cache_ent);
+	if (!ent || ent->size != (uint64_t) fl->size
+		 || ent->mtime_ns != fl->mtime_ns
+		 || ent->ctime_ns != fl->ctime_ns)
+		return;
+
+	if (ent->flags & HARDLINK_CACHE_HEAD) {
+		memcpy(fl->head, ent->head, sizeof(fl->head));
+		fl->has_head = 1;
+	}
+	if (ent->flags & HARDLINK_CACHE_DIGEST) {
+		memcpy(fl->digest, ent->digest, sizeof(fl->digest));
+		fl->has_digest = 1;
+	}
+	if (fl->has_head || fl->has_digest)
+		ctl->ncached++;
+}
+
+/*
+ * Writes digests of all files (except replaced files) to the cache. The old
+ * cache is replaced, so the cache contains only files from the last run.
+ */
+static void cache_save(struct hardlink_ctl *ctl)
+{
+	struct hardlink_cache_header hdr = {
+		.magic = HARDLINK_CACHE_MAGIC,
+		.version = HARDLINK_CACHE_VERSION,
+		.bom = HARDLINK_CACHE_BOM,
+		.entsz = sizeof(struct hardlink_cache_ent)
+	};
+	struct hardlink_cache_ent *ents;
+	char *tmp;
+	FILE *f;
+	int fd;
+	size_t i;
+
+	ents = xcalloc(ctl->nfiles ? ctl->nfiles : 1, sizeof(*ents));
+
+	for (i = 0; i < ctl->nfiles; i++) {
+		struct hardlink_file *fl = ctl->files[i];
+		struct hardlink_cache_ent *ent = &ents[hdr.nents];
+
+		if ((fl->linked && !ctl->no_link) || fl->failed || fl->same ||
+		    !(fl->has_head || fl->has_digest))
+			continue;
+		ent->dev = fl->dev;
+		ent->ino = fl->ino;
+		ent->size = fl->size;
+		ent->mtime_ns = fl->mtime_ns;
+		ent->ctime_ns = fl->ctime_ns;
+		if (fl->has_head) {
+			memcpy(ent->head, fl->head, sizeof(ent->head));
+			ent->flags |= HARDLINK_CACHE_HEAD;
+		}
+		if (fl->has_digest) {
+			memcpy(ent->digest, fl->digest, sizeof(ent->digest));
+			ent->flags |= HARDLINK_CACHE_DIGEST;
+		}
+		hdr.nents++;
+	}
+	qsort(ents, hdr.nents, sizeof(*ents), cmp_cache_ent);
+
+	xasprintf(&tmp, "%s.XXXXXX", ctl->cachefile);
+	fd = mkstemp_cloexec(tmp);
+	if (fd < 0 || !(f = fdopen(fd, "w" UL_CLOEXECSTR))) {
+		warn(_("cannot create %s"), tmp);
+		if (fd >= 0) {
+			close(fd);
+			unlink(tmp);
+		}
+		goto done;
+	}
+
+	if (fwrite(&hdr, sizeof(hdr), 1, f) != 1 ||
+	    fwrite(ents, sizeof(*ents), hdr.nents, f) != hdr.nents ||
+	    close_stream(f) != 0) {
+		warn(_("cannot write %s"), tmp);
+		unlink(tmp);
+	} else if (rename(tmp, ctl->cachefile)) {
+		warn(_("cannot rename %s to %s"), tmp, ctl->cachefile);
+		unlink(tmp);
+	}
+done:
+	free(tmp);
+	free(ents);
+}
+
+static struct hardlink_file *new_file(struct hardlink_arena *records,
+				      struct stat *st, size_t dir, const char *name)
+{
+	struct hardlink_file *fl;
+
+	fl = arena_alloc(records, sizeof(*fl), sizeof(void *));
+	memset(fl, 0, sizeof(*fl));
+	fl->dir = dir;
+	fl->name = name;
+	fl->ino = st->st_ino;
+	fl->dev = st->st_dev;
+	fl->size = st->st_size;
+	fl->mode = st->st_mode;
+	fl->uid = st->st_uid;
+	fl->gid = st->st_gid;
+#ifdef HAVE_STRUCT_STAT_ST_MTIM_TV_NSEC
+	fl->mtime_ns = timespec_ns(st->st_mtim.tv_sec, st->st_mtim.tv_nsec);
+	fl->ctime_ns = timespec_ns(st->st_ctim.tv_sec, st->st_ctim.tv_nsec);
+#else
+	fl->mtime_ns = timespec_ns(st->st_mtime, 0);
+	fl->ctime_ns = timespec_ns(st->st_ctime, 0);
+#endif
+	return fl;
+}
+
+static void add_file(struct hardlink_ctl *ctl, struct hardlink_file *fl)
+{
+	fl->idx = ctl->nfiles;
+	fl->same = index_inode(ctl, fl);
+
+	if (ctl->cache && !fl->same)
+		cache_lookup(ctl, fl);
+
+	if (ctl->nfiles == ctl->nallocs) {
+		ctl->nallocs = ctl->nallocs ? ctl->nallocs * 2 : 1024;
+		ctl->files = xrealloc(ctl->files,
+			ctl->nallocs * sizeof(struct hardlink_file *));
+	}
+	ctl->files[ctl->nfiles++] = fl;
+}
+
+/* must be called with ctl->lock */
+static void push_dir(struct hardlink_ctl *ctl, size_t id)
+{
+	if (ctl->nqueue == ctl->nqueueallocs) {
+		ctl->nqueueallocs = ctl->nqueueallocs ? ctl->nqueueallocs * 2 : 256;
+		ctl->queue = xrealloc(ctl->queue, ctl->nqueueallocs * sizeof(size_t));
+	}
+	ctl->queue[ctl->nqueue++] = id;
+}
+
+/* name returned by the directory */
+struct hardlink_name {
+	uint64_t ino;
+	const char *name;
+	size_t pos;			/* position in the directory */
+	unsigned char type;		/* DT_* */
+};
+
+static int cmp_names_ino(const void *a, const void *b)
+{
+	const struct hardlink_name *x = a, *y = b;
+
+	if (x->ino != y->ino)
+		return x->ino < y->ino ? -1 : 1;
+	return x->pos < y->pos ? -1 : 1;
+}
+
+static int is_excluded(struct hardlink_walker *wk __attribute__((__unused__)),
+		       const char *name __attribute__((__unused__)))
+{
+#ifdef HAVE_PCRE
+	struct hardlink_ctl *ctl = wk->ctl;
+
+	return ctl->re && pcre2_match(ctl->re, /* compiled regex */
+			(PCRE2_SPTR) name, strlen(name), 0, /* start at offset 0 */
+			0, /* default options */
+			wk->match_data, /* block for storing the result */
+			NULL) /* use default match context */
+		>= 0;
+#else
+	return 0;
+#endif
+}
+
+static void add_name(struct hardlink_walker *wk, struct hardlink_name **names,
+		     size_t *nnames, size_t *nallocs,
+		     const char *name, uint64_t ino, unsigned char type)
+{
+	struct hardlink_name *nm;
+
+	if (!name[0])
+		return;
+	if (name[0] == '.' && (!name[1] || !strcmp(name, "..")))
+		return;
+
+	if (*nnames == *nallocs) {
+		*nallocs = *nallocs ? *nallocs * 2 : 64;
+		*names = xrealloc(*names, *nallocs * sizeof(struct hardlink_name));
+	}
+	nm = &(*names)[*nnames];
+	nm->ino = ino;
+	nm->name = arena_strdup(&wk->names, name);
+	nm->type = type;
+	nm->pos = (*nnames)++;
+}
+
+/* reads all names from the directory, returns -1 on error */
+static int read_names(struct hardlink_walker *wk, int fd,
+		      struct hardlink_name **names, size_t *nnames)
+{
+	size_t nallocs = 0;
+#ifdef SYS_getdents64
+	struct linux_dirent64 {
+		uint64_t d_ino;
+		int64_t d_off;
+		unsigned short d_reclen;
+		unsigned char d_type;
+		char d_name[];
+	} *d;
+
+	while (1) {
+		long n = syscall(SYS_getdents64, fd, wk->buf, DIRBUFSZ);
+		long off;
+
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < 0)
+			return *nnames ? 0 : -1;
+		if (n == 0)
+			break;
+		for (off = 0; off < n; off += d->d_reclen) {
+			d = (struct linux_dirent64 *) (wk->buf + off);
+			add_name(wk, names, nnames, &nallocs, d->d_name, d->d_ino, d->d_type);
+		}
+	}
+#else
+	struct dirent *d;
+	DIR *dir;
+	int dfd = dup(fd);
+
+	if (dfd < 0 || !(dir = fdopendir(dfd))) {
+		if (dfd >= 0)
+			close(dfd);
+		return -1;
+	}
+	while ((d = readdir(dir)))
+		add_name(wk, names, nnames, &nallocs, d->d_name, d->d_ino,
+# ifdef _DIRENT_HAVE_D_TYPE
+				d->d_type
+# else
+				DT_UNKNOWN
+# endif
+				);
+	closedir(dir);
+#endif
+	return 0;
+}
+
+/*
+ * Reads directory @id. The entries are stat-ed in inode order (to reduce
+ * seeks on rotating disks) and relative to the directory file descriptor.
+ * The subdirectories are added to the queue.
+ */
+static void walk_dir(struct hardlink_walker *wk, size_t id)
+{
+	struct hardlink_ctl *ctl = wk->ctl;
+	struct hardlink_name *names = NULL;
+	struct hardlink_entry *ents = NULL;
+	size_t i, nnames = 0;
+	int fd, rc;
+
+	pthread_mutex_lock(&ctl->lock);
+	dir_path(ctl, id, &wk->path, 0);
+	pthread_mutex_unlock(&ctl->lock);
+
+	fd = open(wk->path.buf, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (fd < 0 || (rc = read_names(wk, fd, &names, &nnames)) != 0) {
+		if (fd >= 0)
+			close(fd);
+		pthread_mutex_lock(&ctl->lock);
+		ctl->dirents[id].failed = 1;
+		pthread_mutex_unlock(&ctl->lock);
+		return;
+	}
+
+	if (nnames) {
+		ents = xcalloc(nnames, sizeof(struct hardlink_entry));
+		qsort(names, nnames, sizeof(struct hardlink_name), cmp_names_ino);
+	}
+
+	for (i = 0; i < nnames; i++) {
+		struct hardlink_name *nm = &names[i];
+		struct hardlink_entry *ent = &ents[nm->pos];
+		struct stat st;
+
+		ent->u.name = nm->name;
+
+		if (is_excluded(wk, nm->name)) {
+			ent->type = HL_ENT_EXCLUDED;
+			continue;
+		}
+		/* only regular files and directories are interesting */
+		if (nm->type != DT_UNKNOWN && nm->type != DT_REG && nm->type != DT_DIR) {
+			ent->type = HL_ENT_OTHER;
+			continue;
+		}
+		if (fstatat(fd, nm->name, &st, AT_SYMLINK_NOFOLLOW) != 0) {
+			ent->type = HL_ENT_FAILED;
+			continue;
+		}
+		if (st.st_dev != ctl->dev && !ctl->force)
+			ent->type = HL_ENT_OTHERDEV;
+		else if (S_ISDIR(st.st_mode))
+			ent->type = HL_ENT_DIR;
+		else if (S_ISREG(st.st_mode) && st.st_size == 0)
+			ent->type = HL_ENT_EMPTY;
+		else if (S_ISREG(st.st_mode)) {
+			ent->type = HL_ENT_FILE;
+			ent->u.file = new_file(&wk->records, &st, id, nm->name);
+		} else
+			ent->type = HL_ENT_OTHER;
+	}
+	close(fd);
+
+	pthread_mutex_lock(&ctl->lock);
+	for (i = 0; i < nnames; i++) {
+		struct hardlink_entry *ent = &ents[i];
+
+		if (ent->type != HL_ENT_DIR)
+			continue;
+		ent->u.dir = add_dirent(ctl, id, ent->u.name);
+		push_dir(ctl, ent->u.dir);
+	}
+	ctl->dirents[id].ents = ents;
+	ctl->dirents[id].nents = nnames;
+	pthread_cond_broadcast(&ctl->cond);
+	pthread_mutex_unlock(&ctl->lock);
+
+	free(names);
+}
+
+static void *walk_thread(void *data)
+{
+	struct hardlink_walker *wk = data;
+	struct hardlink_ctl *ctl = wk->ctl;
+
+	pthread_mutex_lock(&ctl->lock);
+	while (1) {
+		size_t id;
+
+		while (!ctl->nqueue && ctl->nbusy)
+			pthread_cond_wait(&ctl->cond, &ctl->lock);
+		if (!ctl->nqueue)
+			break;		/* nothing to read and nobody is reading */
+
+		id = ctl->queue[--ctl->nqueue];
+		ctl->nbusy++;
+		pthread_mutex_unlock(&ctl->lock);
+
+		walk_dir(wk, id);
+
+		pthread_mutex_lock(&ctl->lock);
+		ctl->nbusy--;
+		if (!ctl->nbusy && !ctl->nqueue)
+			pthread_cond_broadcast(&ctl->cond);
+	}
+	pthread_mutex_unlock(&ctl->lock);
+	return NULL;
+}
+
+/* reads all queued directories by ctl->nthreads threads */
+static void walk_dirs(struct hardlink_ctl *ctl)
+{
+	size_t i;
+
+	if (!ctl->nqueue)
+		return;
+	if (ctl->nthreads == 1) {
+		walk_thread(&ctl->walkers[0]);
+		return;
+	}
+	for (i = 0; i < ctl->nthreads; i++) {
+		if (pthread_create(&ctl->walkers[i].thread, NULL,
+				   walk_thread, &ctl->walkers[i]) != 0)
+			err(EXIT_FAILURE, _("cannot create thread"));
+	}
+	for (i = 0; i < ctl->nthreads; i++)
+		pthread_join(ctl->walkers[i].thread, NULL);
+}
+
+static void __attribute__((__noreturn__)) otherdev_err(const char *name)
+{
+	errx(EXIT_FAILURE, _("%s is on different filesystem than the rest "
+			     "(use -f option to override)."), name);
+}
+
+/* command line argument */
+static void process_arg(struct hardlink_ctl *ctl, const char *name,
+			size_t **stack, size_t *nstack)
+{
+	struct stat st;
 
 	ctl->nobjects++;
 	if (lstat(name, &st))
@@ -192,197 +1555,96 @@ static void process_path(struct hardlink_ctl *ctl, const char *name)
 
 	if (st.st_dev != ctl->dev && !ctl->force) {
 		if (ctl->dev)
-			errx(EXIT_FAILURE,
-			     _("%s is on different filesystem than the rest "
-			       "(use -f option to override)."), name);
+			otherdev_err(name);
 		ctl->dev = st.st_dev;
 	}
 	if (S_ISDIR(st.st_mode)) {
-		struct hardlink_dir *dp = xmalloc(add3(sizeof(*dp), namelen, 1));
-		memcpy(dp->name, name, namelen + 1);
-		dp->next = ctl->dirs;
-		ctl->dirs = dp;
+		size_t id = add_dirent(ctl, NO_DIR, name);
 
-	} else if (S_ISREG(st.st_mode)) {
-		int fd, i;
-		struct hardlink_file *fp, *fp2;
-		struct hardlink_hash *hp;
-		const char *n1, *n2;
-		unsigned int buf[NBUF];
-		int cksumsize = sizeof(buf);
-		unsigned int cksum;
-		time_t mtime = ctl->content_only ? 0 : st.st_mtime;
-		unsigned int hsh = hash(st.st_size, mtime);
-		off_t fsize;
+		push_dir(ctl, id);
+		*stack = xrealloc(*stack, (*nstack + 1) * sizeof(size_t));
+		(*stack)[(*nstack)++] = id;
 
+	} else if (S_ISREG(st.st_mode)) {
 		ctl->nregfiles++;
 		if (ctl->verbose > 1)
 			printf("%s\n", name);
 
-		fd = open(name, O_RDONLY);
-		if (fd < 0)
-			return;
+		/* empty files are never linked */
+		if (st.st_size)
+			add_file(ctl, new_file(&ctl->walkers[0].records, &st, NO_DIR, name));
+	}
+}
+
+/*
+ * Processes the directories read by walk_dirs(). The directories are
+ * processed in the same order as by the serial walk (depth-first, the last
+ * found directory first) to keep the result (the file which is used as
+ * master) deterministic.
+ */
+static void process_dirs(struct hardlink_ctl *ctl, size_t *stack, size_t nstack,
+			 size_t nallocs)
+{
+	struct hardlink_dynstr nam1 = { NULL, 0 };
 
-		if ((size_t)st.st_size < sizeof(buf)) {
-			cksumsize = st.st_size;
-			memset(((char *)buf) + cksumsize, 0,
-			       (sizeof(buf) - cksumsize) % sizeof(buf[0]));
-		}
-		if (read(fd, buf, cksumsize) != cksumsize) {
-			close(fd);
-			return;
-		}
-		cksumsize = (cksumsize + sizeof(buf[0]) - 1) / sizeof(buf[0]);
-		for (i = 0, cksum = 0; i < cksumsize; i++) {
-			if (cksum + buf[i] < cksum)
-				cksum += buf[i] + 1;
-			else
-				cksum += buf[i];
-		}
-		for (hp = ctl->hps[hsh]; hp; hp = hp->next) {
-			if (hp->size == st.st_size && hp->mtime == mtime)
-				break;
-		}
-		if (!hp) {
-			hp = xmalloc(sizeof(*hp));
-			hp->size = st.st_size;
-			hp->mtime = mtime;
-			hp->chain = NULL;
-			hp->next = ctl->hps[hsh];
-			ctl->hps[hsh] = hp;
-		}
-		for (fp = hp->chain; fp; fp = fp->next) {
-			if (fp->cksum == cksum)
-				break;
-		}
-		for (fp2 = fp; fp2 && fp2->cksum == cksum; fp2 = fp2->next) {
-			if (fp2->ino == st.st_ino && fp2->dev == st.st_dev) {
-				close(fd);
-				return;
-			}
+	while (nstack) {
+		struct hardlink_dirent *de = &ctl->dirents[stack[--nstack]];
+		size_t i, nam1baselen = 0;
+
+		if (de->failed)
+			continue;
+		ctl->ndirs++;
+
+		if (ctl->verbose) {
+			nam1baselen = dir_path(ctl, stack[nstack], &nam1, 0);
+			growstr(&nam1, add2(nam1baselen, 1));
+			nam1.buf[nam1baselen++] = '/';
+			nam1.buf[nam1baselen] = 0;
 		}
-		for (fp2 = fp; fp2 && fp2->cksum == cksum; fp2 = fp2->next) {
 
-			if (!lstat(fp2->name, &st2) && S_ISREG(st2.st_mode) &&
-			    !stcmp(&st, &st2, ctl->content_only) &&
-			    st2.st_ino != st.st_ino &&
-			    st2.st_dev == st.st_dev) {
+		for (i = 0; i < de->nents; i++) {
+			struct hardlink_entry *ent = &de->ents[i];
 
-				int fd2 = open(fp2->name, O_RDONLY);
-				if (fd2 < 0)
-					continue;
+			if (ent->type == HL_ENT_EXCLUDED) {
+				if (ctl->verbose)
+					printf(_("Skipping %s%s\n"), nam1.buf, ent->u.name);
+				continue;
+			}
+			ctl->nobjects++;
 
-				if (fstat(fd2, &st2) || !S_ISREG(st2.st_mode)
-				    || st2.st_size == 0) {
-					close(fd2);
-					continue;
-				}
-				ctl->ncomp++;
-				lseek(fd, 0, SEEK_SET);
-
-				for (fsize = st.st_size; fsize > 0;
-				     fsize -= (off_t)sizeof(ctl->iobuf1)) {
-					ssize_t xsz;
-					ssize_t rsize = fsize > (ssize_t) sizeof(ctl->iobuf1) ?
-							(ssize_t) sizeof(ctl->iobuf1) : fsize;
-
-					if ((xsz = read(fd, ctl->iobuf1, rsize)) != rsize)
-						warn(_("cannot read %s"), name);
-					else if ((xsz = read(fd2, ctl->iobuf2, rsize)) != rsize)
-						warn(_("cannot read %s"), fp2->name);
-
-					if (xsz != rsize) {
-						close(fd);
-						close(fd2);
-						return;
-					}
-					if (memcmp(ctl->iobuf1, ctl->iobuf2, rsize) != 0)
-						break;
-				}
-				close(fd2);
-				if (fsize > 0)
-					continue;
-				if (lstat(name, &st3)) {
-					warn(_("cannot stat %s"), name);
-					close(fd);
-					return;
-				}
-				st3.st_atime = st.st_atime;
-				if (stcmp(&st, &st3, 0)) {
-					warnx(_("file %s changed underneath us"), name);
-					close(fd);
-					return;
-				}
-				n1 = fp2->name;
-				n2 = name;
-
-				if (!ctl->no_link) {
-					const char *suffix =
-					    ".$$$___cleanit___$$$";
-					const size_t suffixlen = strlen(suffix);
-					size_t n2len = strlen(n2);
-					struct hardlink_dynstr nam2 = { NULL, 0 };
-
-					growstr(&nam2, add2(n2len, suffixlen));
-					memcpy(nam2.buf, n2, n2len);
-					memcpy(&nam2.buf[n2len], suffix,
-					       suffixlen + 1);
-					/* First create a temporary link to n1 under a new name */
-					if (link(n1, nam2.buf)) {
-						warn(_("failed to hardlink %s to %s (create temporary link as %s failed)"),
-							n1, n2, nam2.buf);
-						free(nam2.buf);
-						continue;
-					}
-					/* Then rename into place over the existing n2 */
-					if (rename(nam2.buf, n2)) {
-						warn(_("failed to hardlink %s to %s (rename temporary link to %s failed)"),
-							n1, n2, n2);
-						/* Something went wrong, try to remove the now redundant temporary link */
-						if (unlink(nam2.buf))
-							warn(_("failed to remove temporary link %s"), nam2.buf);
-						free(nam2.buf);
-						continue;
-					}
-					free(nam2.buf);
-				}
-				ctl->nlinks++;
-				if (st3.st_nlink > 1) {
-					/* We actually did not save anything this time, since the link second argument
-					   had some other links as well.  */
-					if (ctl->verbose > 1)
-						printf(_(" %s %s to %s\n"),
-							(ctl->no_link ? _("Would link") : _("Linked")),
-							n1, n2);
-				} else {
-					ctl->nsaved += ((st.st_size + 4095) / 4096) * 4096;
-					if (ctl->verbose > 1)
-						printf(_(" %s %s to %s, %s %jd\n"),
-							(ctl->no_link ? _("Would link") : _("Linked")),
-							n1, n2,
-							(ctl->no_link ? _("would save") : _("saved")),
-							(intmax_t)st.st_size);
+			switch (ent->type) {
+			case HL_ENT_OTHERDEV:
+				nam1baselen = dir_path(ctl, stack[nstack], &nam1, 0);
+				growstr(&nam1, add3(nam1baselen, 1, strlen(ent->u.name)));
+				sprintf(nam1.buf + nam1baselen, "/%s", ent->u.name);
+				otherdev_err(nam1.buf);
+				break;
+			case HL_ENT_DIR:
+				if (nstack == nallocs) {
+					nallocs = nallocs ? nallocs * 2 : 256;
+					stack = xrealloc(stack, nallocs * sizeof(size_t));
 				}
-				close(fd);
-				return;
+				stack[nstack++] = ent->u.dir;
+				break;
+			case HL_ENT_EMPTY:
+			case HL_ENT_FILE:
+				ctl->nregfiles++;
+				if (ctl->verbose > 1)
+					printf("%s%s\n", nam1.buf,
+						ent->type == HL_ENT_FILE ?
+						ent->u.file->name : ent->u.name);
+				if (ent->type == HL_ENT_FILE)
+					add_file(ctl, ent->u.file);
+				break;
+			default:
+				break;
 			}
 		}
-		fp2 = xmalloc(add3(sizeof(*fp2), namelen, 1));
-		close(fd);
-		fp2->ino = st.st_ino;
-		fp2->dev = st.st_dev;
-		fp2->cksum = cksum;
-		memcpy(fp2->name, name, namelen + 1);
-
-		if (fp) {
-			fp2->next = fp->next;
-			fp->next = fp2;
-		} else {
-			fp2->next = hp->chain;
-			hp->chain = fp2;
-		}
-		return;
+		free(de->ents);
+		de->ents = NULL;
 	}
+	free(stack);
+	free(nam1.buf);
 }
 
 int main(int argc, char **argv)
@@ -392,19 +1654,27 @@ int main(int argc, char **argv)
 #ifdef HAVE_PCRE
 	int errornumber;
 	PCRE2_SIZE erroroffset;
-	pcre2_code *re = NULL;
 	PCRE2_SPTR exclude_pattern = NULL;
-	pcre2_match_data *match_data = NULL;
 #endif
-	struct hardlink_dynstr nam1 = { NULL, 0 };
 	struct hardlink_ctl *ctl = &global_ctl;
+	size_t *stack = NULL, nstack = 0;
+	long ncpus;
+
+	enum {
+		OPT_CACHE = CHAR_MAX + 1,
+		OPT_MEMSTATS,
+		OPT_THREADS
+	};
 
 	static const struct option longopts[] = {
+		{ "cache",      required_argument, NULL, OPT_CACHE },
 		{ "content",    no_argument, NULL, 'c' },
 		{ "dry-run",    no_argument, NULL, 'n' },
 		{ "exclude",    required_argument, NULL, 'x' },
 		{ "force",      no_argument, NULL, 'f' },
 		{ "help",       no_argument, NULL, 'h' },
+		{ "memory-stats", no_argument, NULL, OPT_MEMSTATS },
+		{ "threads",    required_argument, NULL, OPT_THREADS },
 		{ "verbose",    no_argument, NULL, 'v' },
 		{ "version",    no_argument, NULL, 'V' },
 		{ NULL, 0, NULL, 0 },
@@ -415,6 +1685,9 @@ int main(int argc, char **argv)
 	textdomain(PACKAGE);
 	close_stdout_atexit();
 
+	ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+	ctl->nthreads = ncpus > 0 ? ncpus : 1;
+
 	while ((ch = getopt_long(argc, argv, "cnvfx:Vh", longopts, NULL)) != -1) {
 		switch (ch) {
 		case 'n':
@@ -437,6 +1710,17 @@ int main(int argc, char **argv)
 			     _("option --exclude not supported (built without pcre2)"));
 #endif
 			break;
+		case OPT_CACHE:
+			ctl->cachefile = optarg;
+			break;
+		case OPT_MEMSTATS:
+			ctl->memory_stats = 1;
+			break;
+		case OPT_THREADS:
+			ctl->nthreads = strtou32_or_err(optarg, _("invalid threads argument"));
+			if (!ctl->nthreads)
+				errx(EXIT_FAILURE, _("invalid threads argument"));
+			break;
 		case 'V':
 			print_version(EXIT_SUCCESS);
 		case 'h':
@@ -453,79 +1737,80 @@ int main(int argc, char **argv)
 
 #ifdef HAVE_PCRE
 	if (exclude_pattern) {
-		re = pcre2_compile(exclude_pattern, /* the pattern */
+		ctl->re = pcre2_compile(exclude_pattern, /* the pattern */
 				   PCRE2_ZERO_TERMINATED, /* indicates pattern is zero-terminate */
 				   0, /* default options */
 				   &errornumber, &erroroffset, NULL); /* use default compile context */
-		if (!re) {
+		if (!ctl->re) {
 			PCRE2_UCHAR buffer[256];
 			pcre2_get_error_message(errornumber, buffer,
 						sizeof(buffer));
 			errx(EXIT_FAILURE, _("pattern error at offset %d: %s"),
 				(int)erroroffset, buffer);
 		}
-		match_data = pcre2_match_data_create_from_pattern(re, NULL);
 	}
 #endif
+	atexit(print_memory_stats);
 	atexit(print_summary);
 
+	if (ctl->cachefile)
+		cache_load(ctl);
+
+	ctl->walkers = xcalloc(ctl->nthreads, sizeof(struct hardlink_walker));
+	for (i = 0; (unsigned int) i < ctl->nthreads; i++) {
+		struct hardlink_walker *wk = &ctl->walkers[i];
+
+		wk->ctl = ctl;
+		wk->buf = xmalloc(DIRBUFSZ);
+#ifdef HAVE_PCRE
+		if (ctl->re)
+			wk->match_data = pcre2_match_data_create_from_pattern(ctl->re, NULL);
+#endif
+	}
+	pthread_mutex_init(&ctl->lock, NULL);
+	pthread_cond_init(&ctl->cond, NULL);
+
 	for (i = optind; i < argc; i++)
-		process_path(ctl, argv[i]);
-
-	while (ctl->dirs) {
-		DIR *dh;
-		struct dirent *di;
-		struct hardlink_dir *dp = ctl->dirs;
-		size_t nam1baselen = strlen(dp->name);
-
-		ctl->dirs = dp->next;
-		growstr(&nam1, add2(nam1baselen, 1));
-		memcpy(nam1.buf, dp->name, nam1baselen);
-		free(dp);
-		nam1.buf[nam1baselen++] = '/';
-		nam1.buf[nam1baselen] = 0;
-		dh = opendir(nam1.buf);
-
-		if (dh == NULL)
-			continue;
-		ctl->ndirs++;
+		process_arg(ctl, argv[i], &stack, &nstack);
 
-		while ((di = readdir(dh)) != NULL) {
-			if (!di->d_name[0])
-				continue;
-			if (di->d_name[0] == '.') {
-				if (!di->d_name[1] || !strcmp(di->d_name, ".."))
-					continue;
-			}
+	walk_dirs(ctl);
+	process_dirs(ctl, stack, nstack, nstack);
+
+	ctl->iobuf1 = xmalloc(IOBUFSZ);
+	ctl->iobuf2 = xmalloc(IOBUFSZ);
+
+	dedup_files(ctl);
+
+	if (ctl->cachefile) {
+		cache_save(ctl);
+		if (ctl->cachemap)
+			munmap(ctl->cachemap, ctl->cachesz);
+	}
+
+	for (i = 0; (unsigned int) i < ctl->nthreads; i++) {
+		struct hardlink_walker *wk = &ctl->walkers[i];
+
+		arena_free(&wk->records);
+		arena_free(&wk->names);
+		free(wk->path.buf);
+		free(wk->buf);
 #ifdef HAVE_PCRE
-			if (re && pcre2_match(re, /* compiled regex */
-					      (PCRE2_SPTR) di->d_name, strlen(di->d_name), 0, /* start at offset 0 */
-					      0, /* default options */
-					      match_data, /* block for storing the result */
-					      NULL) /* use default match context */
-			    >=0) {
-				if (ctl->verbose) {
-					nam1.buf[nam1baselen] = 0;
-					printf(_("Skipping %s%s\n"), nam1.buf, di->d_name);
-				}
-				continue;
-			}
+		pcre2_match_data_free(wk->match_data);
 #endif
-			{
-				size_t subdirlen;
-				growstr(&nam1,
-					add2(nam1baselen, subdirlen =
-					     strlen(di->d_name)));
-				memcpy(&nam1.buf[nam1baselen], di->d_name,
-				       add2(subdirlen, 1));
-			}
-			process_path(ctl, nam1.buf);
-		}
-		closedir(dh);
 	}
+	pthread_mutex_destroy(&ctl->lock);
+	pthread_cond_destroy(&ctl->cond);
+
+	free(ctl->files);
+	free(ctl->inodes);
+	free(ctl->dirents);
+	free(ctl->queue);
+	free(ctl->iobuf1);
+	free(ctl->iobuf2);
+	free(ctl->path1.buf);
+	free(ctl->path2.buf);
 #ifdef HAVE_PCRE
-	pcre2_code_free(re);
-	pcre2_match_data_free(match_data);
+	pcre2_code_free(ctl->re);
 #endif
 	return 0;
 }
@@ -114,6 +114,14 @@ void lsblk_unref_device(struct lsblk_device *dev)
 		free(dev->mountpoint);
 		free(dev->dedupkey);
 
+		if (dev->data) {
+			size_t i;
+
+			for (i = 0; i < dev->ndata; i++)
+				free(dev->data[i]);
+			free(dev->data);
+		}
+
 		ul_unref_path(dev->sysfs);
 
 		DBG(DEV, ul_debugobj(dev, " >> dealloc [%s]", dev->name));
@@ -29,6 +29,7 @@ static int is_active_swap(const char *filename)
 
 		mnt_table_set_parser_errcb(swaps, table_parser_errcb);
 		mnt_table_set_cache(swaps, mntcache);
+		mnt_table_enable_index(swaps, 1);
 
 		if (!lsblk->sysroot)
 			mnt_table_parse_swaps(swaps, NULL);
@@ -62,6 +63,7 @@ char *lsblk_device_get_mountpoint(struct lsblk_device *dev)
 
 		mnt_table_set_parser_errcb(mtab, table_parser_errcb);
 		mnt_table_set_cache(mtab, mntcache);
+		mnt_table_enable_index(mtab, 1);
 
 		if (!lsblk->sysroot)
 			mnt_table_parse_mtab(mtab, NULL);
@@ -3,6 +3,7 @@
 
 #ifdef HAVE_LIBUDEV
 # include <libudev.h>
+# include <pthread.h>
 #endif
 
 #include "c.h"
@@ -15,6 +16,7 @@
 
 #ifdef HAVE_LIBUDEV
 static struct udev *udev;
+static pthread_mutex_t udev_lock = PTHREAD_MUTEX_INITIALIZER;	/* libudev is not thread-safe */
 #endif
 
 void lsblk_device_free_properties(struct lsblk_devprop *p)
@@ -57,6 +59,8 @@ static struct lsblk_devprop *get_properties_by_udev(struct lsblk_device *ld)
 	if (ld->udev_requested)
 		return ld->properties;
 
+	pthread_mutex_lock(&udev_lock);
+
 	if (!udev)
 		udev = udev_new();	/* global handler */
 	if (!udev)
@@ -120,6 +124,7 @@ static struct lsblk_devprop *get_properties_by_udev(struct lsblk_device *ld)
 	}
 
 done:
+	pthread_mutex_unlock(&udev_lock);
 	ld->udev_requested = 1;
 
 	DBG(DEV, ul_debugobj(ld, " from udev"));
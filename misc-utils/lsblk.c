@@ -36,6 +36,7 @@
 #include <grp.h>
 #include <ctype.h>
 #include <assert.h>
+#include <pthread.h>
 
 #include <blkid.h>
 
@@ -60,6 +61,9 @@ UL_DEBUG_DEFINE_MASKNAMES(lsblk) = UL_DEBUG_EMPTY_MASKNAMES;
 #define LSBLK_EXIT_SOMEOK 64
 #define LSBLK_EXIT_ALLFAILED 32
 
+/* max number of threads to read devices data */
+#define LSBLK_MAX_THREADS 32
+
 static int column_id_to_number(int id);
 
 /* column IDs */
@@ -1040,6 +1044,27 @@ static char *device_get_data(
 	return str;
 }
 
+/*
+ * Returns true if the column does not depend on the device parent in the tree
+ * and the data may be read in more threads at once.
+ */
+static int is_prefetch_column(int id)
+{
+	switch (id) {
+	case COL_PKNAME:
+	case COL_RM:
+	case COL_OWNER:		/* getpwuid() and getgrgid() are not reentrant */
+	case COL_GROUP:
+	case COL_TARGET:	/* libmount tables and cache */
+	case COL_FSSIZE:
+	case COL_FSAVAIL:
+	case COL_FSUSED:
+	case COL_FSUSEPERC:
+		return 0;
+	}
+	return 1;
+}
+
 /*
  * Adds data for all wanted columns about the device to the smartcols table
  */
@@ -1104,7 +1129,11 @@ static void device_to_scols(
 		char *data;
 		int id = get_column_id(i);
 
-		if (lsblk->sort_id != id)
+		if (dev->data && is_prefetch_column(id)) {
+			data = dev->data[i] ? xstrdup(dev->data[i]) : NULL;
+			if (data && lsblk->sort_id == id && dev->sortdata != (uint64_t) -1)
+				set_sortdata_u64(ln, i, dev->sortdata);
+		} else if (lsblk->sort_id != id)
 			data = device_get_data(dev, parent, id, NULL);
 		else {
 			uint64_t sortdata = (uint64_t) -1;
@@ -1150,6 +1179,134 @@ static void devtree_to_scols(struct lsblk_devtree *tr, struct libscols_table *ta
 		device_to_scols(dev, NULL, tab, NULL);
 }
 
+/*
+ * Prefetch
+ *
+ * Reads sysfs attributes and blkid (or udev) properties for all devices in
+ * the tree by more threads, the results are stored in lsblk_device->data
+ * and used later by device_to_scols().
+ *
+ * The partitions share sysfs handler with the whole-disk, so the disk and all
+ * its partitions are always read by the same thread.
+ */
+struct lsblk_prefetch {
+	struct lsblk_device **devs;	/* sorted, partitions follow the disk */
+	size_t ndevs;
+
+	size_t *groups;			/* index of the first device of the disk */
+	size_t ngroups;
+
+	size_t next;			/* next group to read */
+};
+
+static void prefetch_device(struct lsblk_device *dev)
+{
+	size_t i;
+
+	dev->data = xcalloc(ncolumns, sizeof(char *));
+	dev->ndata = ncolumns;
+	dev->sortdata = (uint64_t) -1;
+
+	for (i = 0; i < ncolumns; i++) {
+		int id = get_column_id(i);
+
+		if (is_prefetch_column(id))
+			dev->data[i] = device_get_data(dev, NULL, id,
+					lsblk->sort_id == id ? &dev->sortdata : NULL);
+	}
+}
+
+static void *prefetch_thread(void *data)
+{
+	struct lsblk_prefetch *pf = data;
+	size_t g;
+
+	while ((g = __sync_fetch_and_add(&pf->next, 1)) < pf->ngroups) {
+		size_t i, end = g + 1 < pf->ngroups ? pf->groups[g + 1] : pf->ndevs;
+
+		for (i = pf->groups[g]; i < end; i++)
+			prefetch_device(pf->devs[i]);
+
+		/* Let's be careful with number of open files */
+		for (i = pf->groups[g]; i < end; i++)
+			ul_path_close_dirfd(pf->devs[i]->sysfs);
+	}
+	return NULL;
+}
+
+static struct lsblk_device *prefetch_get_disk(struct lsblk_device *dev)
+{
+	return dev->wholedisk ? dev->wholedisk : dev;
+}
+
+static int cmp_prefetch_devs(const void *a, const void *b)
+{
+	struct lsblk_device *x = *(struct lsblk_device * const *) a,
+			    *y = *(struct lsblk_device * const *) b;
+	uintptr_t dx = (uintptr_t) prefetch_get_disk(x),
+		  dy = (uintptr_t) prefetch_get_disk(y);
+
+	if (dx != dy)
+		return dx < dy ? -1 : 1;
+	return device_is_partition(x) - device_is_partition(y);
+}
+
+static void devtree_prefetch(struct lsblk_devtree *tr)
+{
+	struct lsblk_prefetch pf = { .ndevs = 0 };
+	struct lsblk_device *dev = NULL;
+	struct lsblk_iter itr;
+	pthread_t *threads;
+	size_t i, nthreads;
+	long ncpus;
+
+	lsblk_reset_iter(&itr, LSBLK_ITER_FORWARD);
+	while (lsblk_devtree_next_device(tr, &itr, &dev) == 0)
+		pf.ndevs++;
+	if (pf.ndevs < 2)
+		return;
+
+	pf.devs = xmalloc(pf.ndevs * sizeof(struct lsblk_device *));
+	pf.groups = xmalloc(pf.ndevs * sizeof(size_t));
+
+	i = 0;
+	lsblk_reset_iter(&itr, LSBLK_ITER_FORWARD);
+	while (lsblk_devtree_next_device(tr, &itr, &dev) == 0)
+		pf.devs[i++] = dev;
+
+	qsort(pf.devs, pf.ndevs, sizeof(struct lsblk_device *), cmp_prefetch_devs);
+
+	for (i = 0; i < pf.ndevs; i++) {
+		if (i == 0 || prefetch_get_disk(pf.devs[i]) != prefetch_get_disk(pf.devs[i - 1]))
+			pf.groups[pf.ngroups++] = i;
+	}
+
+	/* the most time is spent in I/O, use more threads than CPUs */
+	ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+	nthreads = ncpus > 0 ? (size_t) ncpus * 2 : 2;
+	nthreads = min(nthreads, (size_t) LSBLK_MAX_THREADS);
+	nthreads = min(nthreads, pf.ngroups);
+
+	DBG(DEV, ul_debug("prefetch %zu devices (%zu disks) by %zu threads",
+				pf.ndevs, pf.ngroups, nthreads));
+
+	/* the current thread is the first worker */
+	threads = xcalloc(nthreads, sizeof(pthread_t));
+	for (i = 1; i < nthreads; i++) {
+		if (pthread_create(&threads[i], NULL, prefetch_thread, &pf) != 0) {
+			nthreads = i;
+			break;
+		}
+	}
+	prefetch_thread(&pf);
+	for (i = 1; i < nthreads; i++)
+		pthread_join(threads[i], NULL);
+
+	free(threads);
+	free(pf.groups);
+	free(pf.devs);
+}
+
 static int ignore_empty(struct lsblk_device *dev)
 {
 	/* show all non-empty devices */
@@ -2225,6 +2382,8 @@ int main(int argc, char *argv[])
 					  EXIT_SUCCESS;		/* all success */
 	}
 
+	devtree_prefetch(tr);
+
 	if (lsblk->dedup_id > -1) {
 		devtree_set_dedupkeys(tr, lsblk->dedup_id);
 		lsblk_devtree_deduplicate_devices(tr);
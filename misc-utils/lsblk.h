@@ -115,6 +115,10 @@ struct lsblk_device {
 	char *filename;		/* path to device node */
 	char *dedupkey;		/* de-duplication key */
 
+	char **data;		/* prefetched columns data or NULL */
+	size_t ndata;
+	uint64_t sortdata;	/* prefetched sort data or (uint64_t) -1 */
+
 	struct path_cxt	*sysfs;
 
 	char *mountpoint;	/* device mountpoint */
@@ -29,6 +29,8 @@
 #include <assert.h>
 #include <dirent.h>
 #include <unistd.h>
+#include <ctype.h>
+#include <search.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 
@@ -89,6 +91,28 @@ static pid_t pid = 0;
 
 static struct libmnt_table *tab;		/* /proc/self/mountinfo */
 
+/*
+ * Opened files of a process, sorted by inode number. The map is read from
+ * /proc/<pid>/fd only once for each process that holds any lock.
+ */
+struct lock_file {
+	dev_t dev;
+	ino_t ino;
+	off_t size;
+	int fd;
+};
+
+struct lock_proc {
+	pid_t pid;
+	char *cmdname;
+
+	struct lock_file *files;
+	size_t nfiles;
+	unsigned int files_read :1;
+};
+
+static void *proc_tree;		/* struct lock_proc by PID */
+
 /* basic output flags */
 static int no_headings;
 static int no_inaccessible;
@@ -112,6 +136,10 @@ struct lock {
 	int id;
 };
 
+/* not blocked locks sorted by ID, see get_blocker() */
+static struct lock **lock_index;
+static size_t lock_index_sz;
+
 static void rem_lock(struct lock *lock)
 {
 	if (!lock)
@@ -155,63 +183,136 @@ static char *get_fallback_filename(dev_t dev)
 	return res;
 }
 
+static int cmp_proc(const void *a, const void *b)
+{
+	pid_t x = ((const struct lock_proc *) a)->pid,
+	      y = ((const struct lock_proc *) b)->pid;
+
+	return x < y ? -1 : x > y ? 1 : 0;
+}
+
+static void free_proc(void *data)
+{
+	struct lock_proc *proc = data;
+
+	free(proc->cmdname);
+	free(proc->files);
+	free(proc);
+}
+
+static struct lock_proc *get_proc(pid_t lock_pid)
+{
+	struct lock_proc key = { .pid = lock_pid }, *proc, **res;
+
+	res = tfind(&key, &proc_tree, cmp_proc);
+	if (res)
+		return *res;
+
+	proc = xcalloc(1, sizeof(*proc));
+	proc->pid = lock_pid;
+	proc->cmdname = proc_get_command_name(lock_pid);
+
+	if (!tsearch(proc, &proc_tree, cmp_proc))
+		err(EXIT_FAILURE, _("failed to allocate memory"));
+	return proc;
+}
+
+static int cmp_file(const void *a, const void *b)
+{
+	ino_t x = ((const struct lock_file *) a)->ino,
+	      y = ((const struct lock_file *) b)->ino;
+
+	return x < y ? -1 : x > y ? 1 : 0;
+}
+
 /*
- * Return the absolute path of a file from
- * a given inode number (and its size)
+ * Read (dev, inode) of all opened files of the process. We know the pid so
+ * we don't have to iterate the *entire* filesystem searching for the file.
  */
-static char *get_filename_sz(ino_t inode, pid_t lock_pid, size_t *size)
+static void read_proc_files(struct lock_proc *proc)
 {
-	struct stat sb;
+	char path[sizeof("/proc/fd/") + sizeof(stringify_value(INT_MAX))];
 	struct dirent *dp;
 	DIR *dirp;
-	size_t len;
 	int fd;
-	char path[PATH_MAX], sym[PATH_MAX], *ret = NULL;
 
-	*size = 0;
-	memset(path, 0, sizeof(path));
-	memset(sym, 0, sizeof(sym));
+	proc->files_read = 1;
 
-	/*
-	 * We know the pid so we don't have to
-	 * iterate the *entire* filesystem searching
-	 * for the damn file.
-	 */
-	sprintf(path, "/proc/%d/fd/", lock_pid);
+	snprintf(path, sizeof(path), "/proc/%d/fd/", proc->pid);
 	if (!(dirp = opendir(path)))
-		return NULL;
-
-	if ((len = strlen(path)) >= (sizeof(path) - 2))
-		goto out;
+		return;
 
-	if ((fd = dirfd(dirp)) < 0 )
+	if ((fd = dirfd(dirp)) < 0)
 		goto out;
 
 	while ((dp = readdir(dirp))) {
-		if (!strcmp(dp->d_name, ".") ||
-		    !strcmp(dp->d_name, ".."))
-			continue;
+		struct lock_file *f;
+		struct stat sb;
 
 		/* care only for numerical descriptors */
-		if (!strtol(dp->d_name, (char **) NULL, 10))
+		if (!isdigit((unsigned char) *dp->d_name))
 			continue;
-
-		if (!fstatat(fd, dp->d_name, &sb, 0)
-		    && inode != sb.st_ino)
+		if (fstatat(fd, dp->d_name, &sb, 0) != 0)
 			continue;
 
-		if ((len = readlinkat(fd, dp->d_name, sym, sizeof(sym) - 1)) < 1)
-			goto out;
-
-		*size = sb.st_size;
-		sym[len] = '\0';
+		if (proc->nfiles % 64 == 0)
+			proc->files = xrealloc(proc->files,
+				(proc->nfiles + 64) * sizeof(struct lock_file));
 
-		ret = xstrdup(sym);
-		break;
+		f = &proc->files[proc->nfiles++];
+		f->dev = sb.st_dev;
+		f->ino = sb.st_ino;
+		f->size = sb.st_size;
+		f->fd = (int) strtol(dp->d_name, NULL, 10);
 	}
+
+	if (proc->nfiles)
+		qsort(proc->files, proc->nfiles, sizeof(struct lock_file), cmp_file);
 out:
 	closedir(dirp);
-	return ret;
+}
+
+/*
+ * Return the absolute path of a file from
+ * a given device and inode number (and its size)
+ */
+static char *get_filename_sz(dev_t dev, ino_t inode, struct lock_proc *proc, size_t *size)
+{
+	struct lock_file key = { .ino = inode }, *f, *end;
+	char path[sizeof("/proc/fd/") + 2 * sizeof(stringify_value(INT_MAX))];
+	char sym[PATH_MAX];
+	ssize_t len;
+
+	*size = 0;
+
+	if (!proc->files_read)
+		read_proc_files(proc);
+	if (!proc->nfiles)
+		return NULL;
+
+	f = bsearch(&key, proc->files, proc->nfiles, sizeof(struct lock_file), cmp_file);
+	if (!f)
+		return NULL;
+
+	/* go to the first file with the inode, and prefer the same device
+	 * (st_dev may differ from the lock device, for example on btrfs) */
+	while (f > proc->files && (f - 1)->ino == inode)
+		f--;
+	for (end = f; end < proc->files + proc->nfiles && end->ino == inode; end++) {
+		if (end->dev == dev) {
+			f = end;
+			break;
+		}
+	}
+
+	snprintf(path, sizeof(path), "/proc/%d/fd/%d", proc->pid, f->fd);
+	if ((len = readlink(path, sym, sizeof(sym) - 1)) < 1)
+		return NULL;
+
+	*size = f->size;
+	sym[len] = '\0';
+
+	return xstrdup(sym);
 }
 
 /*
@@ -236,6 +337,7 @@ static int get_local_locks(struct list_head *locks)
 	char buf[PATH_MAX], *tok = NULL;
 	size_t sz;
 	struct lock *l;
+	struct lock_proc *proc = NULL;
 	dev_t dev = 0;
 
 	if (!(fp = fopen(_PATH_PROC_LOCKS, "r")))
@@ -280,11 +382,13 @@ static int get_local_locks(struct list_head *locks)
 				 */
 				l->pid = strtos32_or_err(tok, _("failed to parse pid"));
 				if (l->pid > 0) {
-					l->cmdname = proc_get_command_name(l->pid);
-					if (!l->cmdname)
-						l->cmdname = xstrdup(_("(unknown)"));
-				} else
+					proc = get_proc(l->pid);
+					l->cmdname = xstrdup(proc->cmdname ?
+							proc->cmdname : _("(unknown)"));
+				} else {
+					proc = NULL;
 					l->cmdname = xstrdup(_("(undefined)"));
+				}
 				break;
 
 			case 5: /* device major:minor and inode number */
@@ -307,7 +411,14 @@ static int get_local_locks(struct list_head *locks)
 			}
 		}
 
-		l->path = get_filename_sz(inode, l->pid, &sz);
+		/* don't waste time with files of not requested processes;
+		 * the lock is still required to report blockers */
+		if (pid && pid != l->pid) {
+			list_add(&l->locks, locks);
+			continue;
+		}
+
+		l->path = proc ? get_filename_sz(dev, inode, proc, &sz) : NULL;
 
 		/* no permissions -- ignore */
 		if (!l->path && no_inaccessible) {
@@ -360,21 +471,46 @@ static inline struct colinfo *get_column_info(unsigned num)
 	return &infos[ get_column_id(num) ];
 }
 
-static pid_t get_blocker(int id, struct list_head *locks)
+static int cmp_lock_id(const void *a, const void *b)
+{
+	int x = (*(struct lock * const *) a)->id,
+	    y = (*(struct lock * const *) b)->id;
+
+	return x < y ? -1 : x > y ? 1 : 0;
+}
+
+static void index_locks(struct list_head *locks)
 {
 	struct list_head *p;
+	size_t n = 0;
+
+	list_for_each(p, locks)
+		n++;
+
+	lock_index = xcalloc(n ? n : 1, sizeof(struct lock *));
 
 	list_for_each(p, locks) {
 		struct lock *l = list_entry(p, struct lock, locks);
 
-		if (l->id == id && !l->blocked)
-			return l->pid;
+		if (!l->blocked)
+			lock_index[lock_index_sz++] = l;
 	}
+	if (lock_index_sz)
+		qsort(lock_index, lock_index_sz, sizeof(struct lock *), cmp_lock_id);
+}
 
-	return 0;
+static pid_t get_blocker(int id)
+{
+	struct lock key = { .id = id }, *k = &key, **l;
+
+	if (!lock_index_sz)
+		return 0;
+
+	l = bsearch(&k, lock_index, lock_index_sz, sizeof(struct lock *), cmp_lock_id);
+	return l ? (*l)->pid : 0;
 }
 
-static void add_scols_line(struct libscols_table *table, struct lock *l, struct list_head *locks)
+static void add_scols_line(struct libscols_table *table, struct lock *l)
 {
 	size_t i;
 	struct libscols_line *line;
@@ -431,7 +567,7 @@ static void add_scols_line(struct libscols_table *table, struct lock *l, struct
 		case COL_BLOCKER:
 		{
 			pid_t bl = l->blocked && l->id ?
-						get_blocker(l->id, locks) : 0;
+						get_blocker(l->id) : 0;
 			if (bl)
 				xasprintf(&str, "%d", (int) bl);
 		}
@@ -493,6 +629,8 @@ static int show_locks(struct list_head *locks)
 			}
 		}
 
+		if (get_column_id(i) == COL_BLOCKER && !lock_index)
+			index_locks(locks);
 	}
 
 	/* prepare data for output */
@@ -502,7 +640,7 @@ static int show_locks(struct list_head *locks)
 		if (pid && pid != l->pid)
 			continue;
 
-		add_scols_line(table, l, locks);
+		add_scols_line(table, l);
 	}
 
 	/* destroy the list */
@@ -513,6 +651,7 @@ static int show_locks(struct list_head *locks)
 
 	scols_print_table(table);
 	scols_unref_table(table);
+	free(lock_index);
 	return rc;
 }
 
@@ -658,5 +797,6 @@ int main(int argc, char *argv[])
 		rc = show_locks(&locks);
 
 	mnt_unref_table(tab);
+	tdestroy(proc_tree, free_proc);
 	return rc;
 }
@@ -32,6 +32,7 @@
 #include <limits.h>
 #include <getopt.h>
 #include <time.h>
+#include <pthread.h>
 
 #include <sys/ioctl.h>
 #include <sys/stat.h>
@@ -44,6 +45,8 @@
 #include "c.h"
 #include "closestream.h"
 #include "monotonic.h"
+#include "xalloc.h"
+#include "sysfs.h"
 
 #ifndef BLKDISCARD
 # define BLKDISCARD	_IO(0x12,119)
@@ -63,6 +66,31 @@ enum {
 	ACT_SECURE
 };
 
+#define BLKDISCARD_MAX_THREADS	64
+
+/* --threads shared context */
+struct discard_ctl {
+	int		fd;
+	int		act;
+	const char	*path;
+
+	uint64_t	next;		/* offset of the next range */
+	uint64_t	end;
+	uint64_t	step;
+};
+
+/* per-thread statistic, latency in microseconds */
+struct discard_worker {
+	pthread_t	thread;
+	struct discard_ctl *ctl;
+
+	uint64_t	nreqs;
+	uint64_t	bytes;
+	uint64_t	lat_min;
+	uint64_t	lat_max;
+	uint64_t	lat_sum;
+};
+
 static void print_stats(int act, char *path, uint64_t stats[])
 {
 	switch (act) {
@@ -78,6 +106,149 @@ static void print_stats(int act, char *path, uint64_t stats[])
 	}
 }
 
+static void discard_range(int fd, int act, const char *path, uint64_t range[2])
+{
+	switch (act) {
+	case ACT_ZEROOUT:
+		if (ioctl(fd, BLKZEROOUT, range))
+			 err(EXIT_FAILURE, _("%s: BLKZEROOUT ioctl failed"), path);
+		break;
+	case ACT_SECURE:
+		if (ioctl(fd, BLKSECDISCARD, range))
+			err(EXIT_FAILURE, _("%s: BLKSECDISCARD ioctl failed"), path);
+		break;
+	case ACT_DISCARD:
+		if (ioctl(fd, BLKDISCARD, range))
+			err(EXIT_FAILURE, _("%s: BLKDISCARD ioctl failed"), path);
+		break;
+	}
+}
+
+static void *discard_thread(void *data)
+{
+	struct discard_worker *wk = data;
+	struct discard_ctl *ctl = wk->ctl;
+
+	for (;;) {
+		uint64_t range[2], lat;
+		struct timeval start, now, delta;
+
+		range[0] = __sync_fetch_and_add(&ctl->next, ctl->step);
+		if (range[0] >= ctl->end)
+			break;
+		range[1] = min(ctl->step, ctl->end - range[0]);
+
+		gettime_monotonic(&start);
+		discard_range(ctl->fd, ctl->act, ctl->path, range);
+		gettime_monotonic(&now);
+
+		timersub(&now, &start, &delta);
+		lat = (uint64_t) delta.tv_sec * 1000000 + delta.tv_usec;
+
+		if (!wk->nreqs || lat < wk->lat_min)
+			wk->lat_min = lat;
+		if (lat > wk->lat_max)
+			wk->lat_max = lat;
+		wk->lat_sum += lat;
+		wk->nreqs++;
+		wk->bytes += range[1];
+	}
+	return NULL;
+}
+
+/*
+ * Returns step for --threads: the range is split to the same parts for all
+ * threads, but a part is never larger than the largest request supported by
+ * the device. The step is aligned to the discard granularity.
+ */
+static uint64_t get_threads_step(dev_t devno, int act, int secsize,
+				 uint64_t len, size_t nthreads)
+{
+	struct path_cxt *pc;
+	uint64_t max = 0, gran = 0, step;
+	dev_t disk = 0;
+
+	/* queue/ is available for whole-disk only */
+	if (sysfs_devno_to_wholedisk(devno, NULL, 0, &disk) != 0 || !disk)
+		disk = devno;
+
+	pc = ul_new_sysfs_path(disk, NULL, NULL);
+	if (pc) {
+		if (act == ACT_ZEROOUT)
+			ul_path_read_u64(pc, &max, "queue/write_zeroes_max_bytes");
+		else
+			ul_path_read_u64(pc, &max, "queue/discard_max_bytes");
+		ul_path_read_u64(pc, &gran, "queue/discard_granularity");
+		ul_unref_path(pc);
+	}
+
+	if (gran < (uint64_t) secsize || gran % secsize)
+		gran = secsize;
+
+	step = (len + nthreads - 1) / nthreads;
+	step = (step + gran - 1) / gran * gran;
+
+	max = max / gran * gran;
+	if (max && step > max)
+		step = max;
+	return step;
+}
+
+static void run_threads(struct discard_ctl *ctl, size_t nthreads,
+			uint64_t stats[], int verbose)
+{
+	struct discard_worker *wks = xcalloc(nthreads, sizeof(*wks));
+	uint64_t nreqs = 0, lat_min = 0, lat_max = 0, lat_sum = 0;
+	struct timeval start, now, delta;
+	size_t i;
+
+	gettime_monotonic(&start);
+
+	for (i = 0; i < nthreads; i++) {
+		wks[i].ctl = ctl;
+		if (i && pthread_create(&wks[i].thread, NULL, discard_thread, &wks[i]) != 0) {
+			nthreads = i;
+			break;
+		}
+	}
+	/* the main thread is the first worker */
+	discard_thread(&wks[0]);
+
+	for (i = 0; i < nthreads; i++) {
+		if (i)
+			pthread_join(wks[i].thread, NULL);
+		if (!wks[i].nreqs)
+			continue;
+		if (!nreqs || wks[i].lat_min < lat_min)
+			lat_min = wks[i].lat_min;
+		if (wks[i].lat_max > lat_max)
+			lat_max = wks[i].lat_max;
+		lat_sum += wks[i].lat_sum;
+		nreqs += wks[i].nreqs;
+		stats[1] += wks[i].bytes;
+	}
+
+	gettime_monotonic(&now);
+	free(wks);
+
+	if (verbose && nreqs) {
+		double sec;
+		char *rate;
+
+		timersub(&now, &start, &delta);
+		sec = delta.tv_sec + delta.tv_usec / 1000000.0;
+		rate = size_to_human_string(SIZE_SUFFIX_3LETTER | SIZE_SUFFIX_SPACE,
+				sec > 0 ? (uint64_t) (stats[1] / sec) : stats[1]);
+
+		printf(_("%s: %" PRIu64 " requests by %zu threads in %.3f seconds (%s/s)\n"),
+			ctl->path, nreqs, nthreads, sec, rate);
+		printf(_("%s: request latency min/avg/max: %.3f/%.3f/%.3f ms\n"),
+			ctl->path, lat_min / 1000.0,
+			(double) lat_sum / nreqs / 1000.0, lat_max / 1000.0);
+		free(rate);
+	}
+}
+
 static void __attribute__((__noreturn__)) usage(void)
 {
 	FILE *out = stdout;
@@ -96,6 +267,7 @@ static void __attribute__((__noreturn__)) usage(void)
 	fputs(_(" -s, --secure        perform secure discard\n"), out);
 	fputs(_(" -z, --zeroout       zero-fill rather than discard\n"), out);
 	fputs(_(" -v, --verbose       print aligned length and offset\n"), out);
+	fputs(_("     --threads <num> number of requests in parallel\n"), out);
 
 	fputs(USAGE_SEPARATOR, out);
 	printf(USAGE_HELP_OPTIONS(21));
@@ -151,6 +323,10 @@ int main(int argc, char **argv)
 	struct stat sb;
 	struct timeval now, last;
 	int act = ACT_DISCARD;
+	size_t nthreads = 1;
+	enum {
+		OPT_THREADS = CHAR_MAX + 1
+	};
 
 	static const struct option longopts[] = {
 	    { "help",      no_argument,       NULL, 'h' },
@@ -162,6 +338,7 @@ int main(int argc, char **argv)
 	    { "secure",    no_argument,       NULL, 's' },
 	    { "verbose",   no_argument,       NULL, 'v' },
 	    { "zeroout",   no_argument,       NULL, 'z' },
+	    { "threads",   required_argument, NULL, OPT_THREADS },
 	    { NULL, 0, NULL, 0 }
 	};
 
@@ -200,6 +377,13 @@ int main(int argc, char **argv)
 		case 'z':
 			act = ACT_ZEROOUT;
 			break;
+		case OPT_THREADS:
+			nthreads = strtou32_or_err(optarg,
+					_("failed to parse threads"));
+			if (nthreads < 1 || nthreads > BLKDISCARD_MAX_THREADS)
+				errx(EXIT_FAILURE, _("threads must be in range 1-%d"),
+						BLKDISCARD_MAX_THREADS);
+			break;
 
 		case 'h':
 			usage();
@@ -246,6 +430,11 @@ int main(int argc, char **argv)
 	if (end < range[0] || end > blksize)
 		end = blksize;
 
+	/* split the range for the threads by the device limit */
+	if (nthreads > 1 && !step)
+		step = get_threads_step(sb.st_rdev, act, secsize,
+					end - range[0], nthreads);
+
 	range[1] = (step > 0) ? step : end - range[0];
 
 	/* check length alignment to the sector size */
@@ -277,24 +466,25 @@ int main(int argc, char **argv)
 	stats[0] = range[0], stats[1] = 0;
 	gettime_monotonic(&last);
 
+	if (nthreads > 1) {
+		struct discard_ctl ctl = {
+			.fd = fd,
+			.act = act,
+			.path = path,
+			.next = range[0],
+			.end = end,
+			.step = range[1]
+		};
+
+		run_threads(&ctl, nthreads, stats, verbose);
+		range[0] = end;
+	}
+
 	for (/* nothing */; range[0] < end; range[0] += range[1]) {
 		if (range[0] + range[1] > end)
 			range[1] = end - range[0];
 
-		switch (act) {
-		case ACT_ZEROOUT:
-			if (ioctl(fd, BLKZEROOUT, &range))
-				 err(EXIT_FAILURE, _("%s: BLKZEROOUT ioctl failed"), path);
-			break;
-		case ACT_SECURE:
-			if (ioctl(fd, BLKSECDISCARD, &range))
-				err(EXIT_FAILURE, _("%s: BLKSECDISCARD ioctl failed"), path);
-			break;
-		case ACT_DISCARD:
-			if (ioctl(fd, BLKDISCARD, &range))
-				err(EXIT_FAILURE, _("%s: BLKDISCARD ioctl failed"), path);
-			break;
-		}
+		discard_range(fd, act, path, range);
 
 		stats[1] += range[1];
 
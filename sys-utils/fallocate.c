@@ -72,6 +72,7 @@
 #include "closestream.h"
 #include "xalloc.h"
 #include "optutils.h"
+#include "monotonic.h"
 
 static int verbose;
 static char *filename;
@@ -151,39 +152,56 @@ static void xposix_fallocate(int fd, off_t offset, off_t length)
 }
 #endif
 
-/* The real buffer size has to be bufsize + sizeof(uintptr_t) */
-static int is_nul(void *buf, size_t bufsize)
+/*
+ * Returns 1 if the buffer contains zeros only. The first bytes are checked
+ * directly, the rest is compared with the buffer itself by memcmp(), which
+ * is well optimized (vectorized) in libc.
+ */
+static int is_nul(const void *buf, size_t bufsize)
 {
-	typedef uintptr_t word;
-	void const *vp;
-	char const *cbuf = buf, *cp;
-	word const *wp = buf;
+	const unsigned char *p = buf;
+	size_t i, n = min(bufsize, (size_t) 16);
 
-	/* set sentinel */
-	memset((char *) buf + bufsize, '\1', sizeof(word));
-
-	/* Find first nonzero *word*, or the word with the sentinel.  */
-	while (*wp++ == 0)
-		continue;
+	for (i = 0; i < n; i++) {
+		if (p[i])
+			return 0;
+	}
+	return bufsize <= n || memcmp(p, p + n, bufsize - n) == 0;
+}
 
-	/* Find the first nonzero *byte*, or the sentinel.  */
-	vp = wp - 1;
-	cp = vp;
+/* size of the data read by one pread() for --dig-holes */
+#define DIG_BUFSZ	(4 * 1024 * 1024)
 
-	while (*cp++ == 0)
-		continue;
+struct dig_hole {
+	off_t	start;
+	off_t	end;
+	unsigned int to_area_end : 1;	/* the hole ends at the end of data area */
+};
 
-	return cbuf + bufsize < cp;
+static void punch_hole(int fd, struct dig_hole *h, blksize_t blksize,
+		       uintmax_t *npunched)
+{
+	if (h->start < h->end) {
+		off_t sz = h->end - h->start;
+
+		if (h->to_area_end)
+			sz += blksize;		/* meet block boundary */
+		xfallocate(fd, FALLOC_FL_PUNCH_HOLE|FALLOC_FL_KEEP_SIZE,
+			   h->start, sz);
+		(*npunched)++;
+	}
+	memset(h, 0, sizeof(*h));
 }
 
 static void dig_holes(int fd, off_t file_off, off_t len)
 {
 	off_t file_end = len ? file_off + len : 0;
-	off_t hole_start = 0, hole_sz = 0;
-	uintmax_t ct = 0;
+	struct dig_hole hole = { 0 };
+	uintmax_t ct = 0, nread = 0, npunched = 0;
 	size_t  bufsz;
 	char *buf;
 	struct stat st;
+	struct timeval start, now, delta;
 #if defined(POSIX_FADV_SEQUENTIAL) && defined(HAVE_POSIX_FADVISE)
 	off_t cache_start = file_off;
 	/*
@@ -200,18 +218,21 @@ static void dig_holes(int fd, off_t file_off, off_t len)
 	if (fstat(fd, &st) != 0)
 		err(EXIT_FAILURE, _("stat of %s failed"), filename);
 
-	bufsz = st.st_blksize;
+	/* read more blocks at once, but detect zeros per block */
+	bufsz = max((size_t) st.st_blksize,
+		    (size_t) (DIG_BUFSZ / st.st_blksize * st.st_blksize));
 
 	if (lseek(fd, file_off, SEEK_SET) < 0)
 		err(EXIT_FAILURE, _("seek on %s failed"), filename);
 
-	/* buffer + extra space for is_nul() sentinel */
-	buf = xmalloc(bufsz + sizeof(uintptr_t));
+	gettime_monotonic(&start);
+
+	buf = xmalloc(bufsz);
 	while (file_end == 0 || file_off < file_end) {
 		/*
 		 * Detect data area (skip holes)
 		 */
-		off_t end, off;
+		off_t end, off, area_start;
 
 		off = lseek(fd, file_off, SEEK_DATA);
 		if ((off == -1 && errno == ENXIO) ||
@@ -225,6 +246,8 @@ static void dig_holes(int fd, off_t file_off, off_t len)
 		if (off < 0 || end < 0)
 			break;
 
+		area_start = off;
+
 #if defined(POSIX_FADV_SEQUENTIAL) && defined(HAVE_POSIX_FADVISE)
 		(void) posix_fadvise(fd, off, end, POSIX_FADV_SEQUENTIAL);
 #endif
@@ -232,23 +255,36 @@ static void dig_holes(int fd, off_t file_off, off_t len)
 		 * Dig holes in the area
 		 */
 		while (off < end) {
-			ssize_t rsz = pread(fd, buf, bufsz, off);
+			ssize_t i, rsz = pread(fd, buf, bufsz, off);
+
 			if (rsz < 0 && errno)
 				err(EXIT_FAILURE, _("%s: read failed"), filename);
 			if (end && rsz > 0 && off > end - rsz)
 				rsz = end - off;
 			if (rsz <= 0)
 				break;
-
-			if (is_nul(buf, rsz)) {
-				if (!hole_sz)				/* new hole detected */
-					hole_start = off;
-				hole_sz += rsz;
-			 } else if (hole_sz) {
-				xfallocate(fd, FALLOC_FL_PUNCH_HOLE|FALLOC_FL_KEEP_SIZE,
-					   hole_start, hole_sz);
-				ct += hole_sz;
-				hole_sz = hole_start = 0;
+			nread += rsz;
+
+			for (i = 0; i < rsz; i += st.st_blksize) {
+				off_t boff = off + i;
+				size_t blen = min((size_t) (rsz - i), (size_t) st.st_blksize);
+
+				if (!is_nul(buf + i, blen)) {
+					punch_hole(fd, &hole, st.st_blksize, &npunched);
+					continue;
+				}
+
+				/* continue the current hole, also over the
+				 * already existing hole between data areas */
+				if (hole.start == hole.end
+				    || (boff != hole.end &&
+					!(hole.to_area_end && boff == area_start))) {
+					punch_hole(fd, &hole, st.st_blksize, &npunched);
+					hole.start = boff;
+				}
+				hole.end = boff + blen;
+				hole.to_area_end = 0;
+				ct += blen;
 			}
 
 #if defined(POSIX_FADV_DONTNEED) && defined(HAVE_POSIX_FADVISE)
@@ -263,16 +299,17 @@ static void dig_holes(int fd, off_t file_off, off_t len)
 #endif
 			off += rsz;
 		}
-		if (hole_sz) {
-			off_t alloc_sz = hole_sz;
-			if (off >= end)
-				alloc_sz += st.st_blksize;		/* meet block boundary */
-			xfallocate(fd, FALLOC_FL_PUNCH_HOLE|FALLOC_FL_KEEP_SIZE,
-					hole_start, alloc_sz);
-			ct += hole_sz;
-		}
+		/* keep the hole open, the next area may start with zeros;
+		 * don't touch anything behind the requested range */
+		if (hole.start < hole.end && off >= end && hole.end == off
+		    && !(file_end && end == file_end))
+			hole.to_area_end = 1;
+		else
+			punch_hole(fd, &hole, st.st_blksize, &npunched);
+
 		file_off = off;
 	}
+	punch_hole(fd, &hole, st.st_blksize, &npunched);
 
 	free(buf);
 
@@ -282,6 +319,22 @@ static void dig_holes(int fd, off_t file_off, off_t len)
 				filename, str, ct);
 		free(str);
 	}
+	if (verbose > 1) {
+		double sec;
+		char *rd, *rate;
+
+		gettime_monotonic(&now);
+		timersub(&now, &start, &delta);
+		sec = delta.tv_sec + delta.tv_usec / 1000000.0;
+
+		rd = size_to_human_string(SIZE_SUFFIX_3LETTER | SIZE_SUFFIX_SPACE, nread);
+		rate = size_to_human_string(SIZE_SUFFIX_3LETTER | SIZE_SUFFIX_SPACE,
+				sec > 0 ? (uintmax_t) (nread / sec) : nread);
+		fprintf(stdout, _("%s: %s read in %.3f seconds (%s/s), %ju holes punched.\n"),
+				filename, rd, sec, rate, npunched);
+		free(rd);
+		free(rate);
+	}
 }
 
 int main(int argc, char **argv)
@@ -32,9 +32,11 @@
 #include <fcntl.h>
 #include <limits.h>
 #include <getopt.h>
+#include <pthread.h>
 
 #include <sys/ioctl.h>
 #include <sys/stat.h>
+#include <sys/statvfs.h>
 #include <linux/fs.h>
 
 #include "nls.h"
@@ -45,6 +47,8 @@
 #include "pathnames.h"
 #include "sysfs.h"
 #include "optutils.h"
+#include "monotonic.h"
+#include "jsonwrt.h"
 
 #include <libmount.h>
 
@@ -58,12 +62,54 @@ struct fstrim_range {
 #define FITRIM		_IOWR('X', 121, struct fstrim_range)
 #endif
 
+#define FSTRIM_MAX_PARALLEL	256
+
+/* default chunk size for --rate, --max-latency and --resume */
+#define FSTRIM_DEFAULT_CHUNK	(1024ULL * 1024 * 1024)
+
+/* --resume position of the not yet finished filesystem */
+struct fstrim_cursor {
+	dev_t		dev;
+	uint64_t	offset;
+	char		*target;
+};
+
+/* filesystem to trim by --all */
+struct fstrim_fs {
+	char		*target;
+	char		*source;
+	dev_t		disk;		/* whole-disk */
+
+	size_t		next;		/* next in the same disk group + 1, or 0 */
+
+	int		rc;		/* fstrim_filesystem() result */
+	uint64_t	trimmed;	/* bytes */
+	uint64_t	duration;	/* microseconds */
+};
+
 struct fstrim_control {
 	struct fstrim_range range;
 
+	struct fstrim_fs *fss;		/* --all filesystems */
+	size_t nfss;
+	size_t *groups;			/* first filesystem for each disk + 1 */
+	size_t ngroups;
+	size_t next_group;		/* first not yet trimmed group */
+	size_t parallel;		/* --parallel */
+
+	uint64_t chunk;			/* --chunk, or 0 for one FITRIM */
+	uint64_t rate;			/* --rate in bytes per second */
+	uint64_t max_latency;		/* --max-latency in microseconds */
+
+	const char *resume;		/* --resume file */
+	struct fstrim_cursor *cursors;
+	size_t ncursors;
+	pthread_mutex_t lock;		/* cursors */
+
 	unsigned int verbose : 1,
 		     quiet_unsupp : 1,
-		     dryrun : 1;
+		     dryrun : 1,
+		     json : 1;
 };
 
 static int is_directory(const char *path, int silent)
@@ -84,7 +130,292 @@ static int is_directory(const char *path, int silent)
 }
 
 /* returns: 0 = success, 1 = unsupported, < 0 = error */
-static int fstrim_filesystem(struct fstrim_control *ctl, const char *path, const char *devname)
+static int do_fitrim(int fd, const char *path, struct fstrim_range *range)
+{
+	int rc;
+
+	errno = 0;
+	if (ioctl(fd, FITRIM, range) == 0)
+		return 0;
+
+	switch (errno) {
+	case EBADF:
+	case ENOTTY:
+	case EOPNOTSUPP:
+		rc = 1;
+		break;
+	default:
+		rc = -errno;
+	}
+	if (rc < 0)
+		warn(_("%s: FITRIM ioctl failed"), path);
+	return rc;
+}
+
+/*
+ * The --resume file contains one line for every not yet finished
+ * filesystem: "<major>:<minor> <offset> <mountpoint>".
+ */
+static void load_cursors(struct fstrim_control *ctl)
+{
+	FILE *f = fopen(ctl->resume, "r" UL_CLOEXECSTR);
+	char *line = NULL;
+	size_t sz = 0;
+
+	if (!f) {
+		if (errno != ENOENT)
+			warn(_("cannot open %s"), ctl->resume);
+		return;
+	}
+
+	while (getline(&line, &sz, f) >= 0) {
+		unsigned int maj, min;
+		uint64_t off;
+		int n = 0;
+		char *p;
+
+		if (sscanf(line, "%u:%u %" SCNu64 " %n", &maj, &min, &off, &n) != 3 || !n)
+			continue;
+		p = strchr(line + n, '\n');
+		if (p)
+			*p = '\0';
+		if (!*(line + n))
+			continue;
+
+		if (ctl->ncursors % 32 == 0)
+			ctl->cursors = xrealloc(ctl->cursors,
+				(ctl->ncursors + 32) * sizeof(struct fstrim_cursor));
+		ctl->cursors[ctl->ncursors].dev = makedev(maj, min);
+		ctl->cursors[ctl->ncursors].offset = off;
+		ctl->cursors[ctl->ncursors].target = xstrdup(line + n);
+		ctl->ncursors++;
+	}
+	free(line);
+	fclose(f);
+}
+
+static int save_cursors(struct fstrim_control *ctl)
+{
+	char *tmp = NULL;
+	FILE *f;
+	size_t i;
+	int rc = 0;
+
+	xasprintf(&tmp, "%s.tmp", ctl->resume);
+	f = fopen(tmp, "w" UL_CLOEXECSTR);
+	if (!f) {
+		rc = -errno;
+		goto done;
+	}
+	for (i = 0; i < ctl->ncursors; i++) {
+		struct fstrim_cursor *c = &ctl->cursors[i];
+
+		if (c->target && c->offset)
+			fprintf(f, "%u:%u %" PRIu64 " %s\n",
+				major(c->dev), minor(c->dev), c->offset, c->target);
+	}
+	if (close_stream(f) != 0 || rename(tmp, ctl->resume) != 0)
+		rc = -errno;
+done:
+	if (rc)
+		warn(_("cannot write %s"), ctl->resume);
+	free(tmp);
+	return rc;
+}
+
+static struct fstrim_cursor *get_cursor(struct fstrim_control *ctl,
+					dev_t dev, const char *target)
+{
+	size_t i;
+
+	for (i = 0; i < ctl->ncursors; i++) {
+		struct fstrim_cursor *c = &ctl->cursors[i];
+
+		if (c->target && c->dev == dev && strcmp(c->target, target) == 0)
+			return c;
+	}
+	return NULL;
+}
+
+static uint64_t read_cursor(struct fstrim_control *ctl, dev_t dev, const char *target)
+{
+	struct fstrim_cursor *c;
+	uint64_t off = 0;
+
+	pthread_mutex_lock(&ctl->lock);
+	c = get_cursor(ctl, dev, target);
+	if (c)
+		off = c->offset;
+	pthread_mutex_unlock(&ctl->lock);
+	return off;
+}
+
+/* @offset 0 means the filesystem is done */
+static void write_cursor(struct fstrim_control *ctl, dev_t dev, const char *target,
+			 uint64_t offset)
+{
+	struct fstrim_cursor *c;
+
+	pthread_mutex_lock(&ctl->lock);
+	c = get_cursor(ctl, dev, target);
+	if (!c && offset) {
+		if (ctl->ncursors % 32 == 0)
+			ctl->cursors = xrealloc(ctl->cursors,
+				(ctl->ncursors + 32) * sizeof(struct fstrim_cursor));
+		c = &ctl->cursors[ctl->ncursors++];
+		c->dev = dev;
+		c->target = xstrdup(target);
+	}
+	if (c) {
+		c->offset = offset;
+		save_cursors(ctl);
+	}
+	pthread_mutex_unlock(&ctl->lock);
+}
+
+static void free_cursors(struct fstrim_control *ctl)
+{
+	size_t i;
+
+	for (i = 0; i < ctl->ncursors; i++)
+		free(ctl->cursors[i].target);
+	free(ctl->cursors);
+	ctl->cursors = NULL;
+	ctl->ncursors = 0;
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *) a, y = *(const uint64_t *) b;
+
+	return x < y ? -1 : x > y ? 1 : 0;
+}
+
+/*
+ * Split the range to chunks and call FITRIM for each of them. The chunks
+ * are paced to --rate, and the chunk size is halved if a chunk takes longer
+ * than --max-latency (and doubled back up to --chunk if it's fast again).
+ *
+ * returns: 0 = success, 1 = unsupported, < 0 = error
+ */
+static int fstrim_chunked(struct fstrim_control *ctl, int fd, const char *path,
+			  uint64_t *trimmed)
+{
+	struct statvfs vfs;
+	struct stat st;
+	struct timeval begin, start, now, delta;
+	uint64_t off, first, end, hint, bsize, chunk, minchunk, maxchunk, total = 0;
+	uint64_t *lats = NULL;
+	size_t nlats = 0;
+	int rc = 0;
+
+	if (fstatvfs(fd, &vfs) != 0 || fstat(fd, &st) != 0) {
+		warn(_("stat of %s failed"), path);
+		return -errno;
+	}
+
+	/* f_blocks does not include the filesystem overhead (journal, log,
+	 * ...), so it's used only to split the range; the last chunk is
+	 * open-ended and the kernel trims the rest of the filesystem (or up to
+	 * --length) or rejects offset behind the end of the filesystem */
+	hint = (uint64_t) vfs.f_blocks * vfs.f_frsize;
+	off = ctl->range.start;
+	end = ctl->range.len > ULLONG_MAX - off ? ULLONG_MAX : off + ctl->range.len;
+
+	if (ctl->resume) {
+		uint64_t cur = read_cursor(ctl, st.st_dev, path);
+
+		if (cur > off && cur < end) {
+			off = cur;
+			if (ctl->verbose && !ctl->json)
+				printf(_("%s: resuming from offset %" PRIu64 "\n"), path, off);
+		}
+	}
+
+	/* FITRIM rounds start and length of the range down to filesystem
+	 * blocks, unaligned chunks would skip the blocks on chunk boundaries */
+	bsize = vfs.f_bsize ? vfs.f_bsize : 1;
+	maxchunk = max(ctl->chunk / bsize * bsize, bsize);
+	minchunk = max(maxchunk / 64 / bsize * bsize, bsize);
+	chunk = maxchunk;
+	first = off;
+
+	gettime_monotonic(&begin);
+
+	do {
+		struct fstrim_range range = {
+			.start = off,
+			.len = end - off,
+			.minlen = ctl->range.minlen
+		};
+		uint64_t lat;
+
+		if (off < hint && chunk < hint - off && chunk < end - off)
+			range.len = chunk;
+
+		off += range.len;
+
+		gettime_monotonic(&start);
+		rc = do_fitrim(fd, path, &range);
+		if (rc)
+			break;
+		gettime_monotonic(&now);
+
+		total += range.len;	/* kernel returns trimmed bytes */
+
+		if (ctl->resume)
+			write_cursor(ctl, st.st_dev, path, off < end ? off : 0);
+
+		timersub(&now, &start, &delta);
+		lat = (uint64_t) delta.tv_sec * 1000000 + delta.tv_usec;
+		if (nlats % 256 == 0)
+			lats = xrealloc(lats, (nlats + 256) * sizeof(uint64_t));
+		lats[nlats++] = lat;
+
+		if (ctl->max_latency) {
+			if (lat > ctl->max_latency) {
+				chunk = max(chunk / 2 / bsize * bsize, minchunk);
+				xusleep(min(lat, (uint64_t) 1000000));	/* let the device breathe */
+			} else if (lat < ctl->max_latency / 2 && chunk < maxchunk)
+				chunk = min(chunk * 2, maxchunk);
+		}
+		/* the rate is about the scanned range, the trimmed amount
+		 * depends on the filesystem and previous trims */
+		if (ctl->rate && off < end) {
+			uint64_t done = off - first,
+				 want = done / ctl->rate * 1000000
+					+ done % ctl->rate * 1000000 / ctl->rate,
+				 elapsed;
+
+			gettime_monotonic(&now);
+			timersub(&now, &begin, &delta);
+			elapsed = (uint64_t) delta.tv_sec * 1000000 + delta.tv_usec;
+			while (want > elapsed) {
+				uint64_t s = min(want - elapsed, (uint64_t) 1000000);
+
+				xusleep(s);
+				elapsed += s;
+			}
+		}
+	} while (off < end);
+
+	if (trimmed)
+		*trimmed = total;
+
+	if (ctl->verbose && !ctl->json && nlats) {
+		qsort(lats, nlats, sizeof(uint64_t), cmp_u64);
+		printf(_("%s: %zu chunks, latency p99 %.3f ms, max %.3f ms\n"),
+			path, nlats,
+			lats[(nlats * 99 + 99) / 100 - 1] / 1000.0,
+			lats[nlats - 1] / 1000.0);
+	}
+	free(lats);
+	return rc;
+}
+
+/* returns: 0 = success, 1 = unsupported, < 0 = error */
+static int fstrim_filesystem(struct fstrim_control *ctl, const char *path, const char *devname,
+			     uint64_t *trimmed)
 {
 	int fd = -1, rc;
 	struct fstrim_range range;
@@ -106,31 +437,28 @@ static int fstrim_filesystem(struct fstrim_control *ctl, const char *path, const
 	}
 
 	if (ctl->dryrun) {
-		if (devname)
+		if (!ctl->json && devname)
 			printf(_("%s: 0 B (dry run) trimmed on %s\n"), path, devname);
-		else
+		else if (!ctl->json)
 			printf(_("%s: 0 B (dry run) trimmed\n"), path);
 		rc = 0;
 		goto done;
 	}
 
-	errno = 0;
-	if (ioctl(fd, FITRIM, &range)) {
-		switch (errno) {
-		case EBADF:
-		case ENOTTY:
-		case EOPNOTSUPP:
-			rc = 1;
-			break;
-		default:
-			rc = -errno;
-		}
-		if (rc < 0)
-			warn(_("%s: FITRIM ioctl failed"), path);
+	if (ctl->chunk) {
+		uint64_t len = 0;
+
+		rc = fstrim_chunked(ctl, fd, path, &len);
+		range.len = len;
+	} else
+		rc = do_fitrim(fd, path, &range);
+	if (rc)
 		goto done;
-	}
 
-	if (ctl->verbose) {
+	if (trimmed)
+		*trimmed = range.len;
+
+	if (ctl->verbose && !ctl->json) {
 		char *str = size_to_human_string(
 				SIZE_SUFFIX_3LETTER | SIZE_SUFFIX_SPACE,
 				(uint64_t) range.len);
@@ -154,7 +482,7 @@ done:
 	return rc;
 }
 
-static int has_discard(const char *devname, struct path_cxt **wholedisk)
+static int has_discard(const char *devname, struct path_cxt **wholedisk, dev_t *diskno)
 {
 	struct path_cxt *pc = NULL;
 	uint64_t dg = 0;
@@ -178,6 +506,8 @@ static int has_discard(const char *devname, struct path_cxt **wholedisk)
 	rc = sysfs_blkdev_get_wholedisk(pc, NULL, 0, &disk);
 	if (rc != 0 || !disk)
 		goto fail;
+	if (diskno)
+		*diskno = disk;
 
 	if (dev != disk) {
 		/* Partition, try reuse whole-disk context if valid for the
@@ -228,6 +558,187 @@ static int uniq_fs_source_cmp(
 	return !mnt_fs_streq_srcpath(a, mnt_fs_get_srcpath(b));
 }
 
+/*
+ * De-duplicate by maj:min from mountinfo; the same devno means the same
+ * superblock, so it's enough to trim the first entry only. The lookups use
+ * libmount index, so it's linear rather than O(n^2) as mnt_table_uniq_fs().
+ *
+ * Returns 1 if the table does not provide devno numbers (fstab).
+ */
+static int uniq_fs_devno(struct libmnt_table *tb)
+{
+	struct libmnt_iter *itr;
+	struct libmnt_fs *fs, **dups = NULL;
+	size_t ndups = 0, i;
+	int rc = 0;
+
+	itr = mnt_new_iter(MNT_ITER_FORWARD);
+	if (!itr)
+		err(MNT_EX_FAIL, _("failed to initialize libmount iterator"));
+
+	while (mnt_table_next_fs(tb, itr, &fs) == 0) {
+		if (!mnt_fs_get_devno(fs)) {
+			rc = 1;
+			goto done;
+		}
+	}
+
+	mnt_table_enable_index(tb, 1);
+	mnt_reset_iter(itr, MNT_ITER_FORWARD);
+
+	while (mnt_table_next_fs(tb, itr, &fs) == 0) {
+		if (mnt_table_find_devno(tb, mnt_fs_get_devno(fs),
+					 MNT_ITER_FORWARD) == fs)
+			continue;
+		dups = xrealloc(dups, (ndups + 1) * sizeof(struct libmnt_fs *));
+		dups[ndups++] = fs;
+	}
+
+	for (i = 0; i < ndups; i++)
+		mnt_table_remove_fs(tb, dups[i]);
+done:
+	mnt_table_enable_index(tb, 0);
+	mnt_free_iter(itr);
+	free(dups);
+	return rc;
+}
+
+static void add_filesystem(struct fstrim_control *ctl, const char *tgt,
+			   const char *src, dev_t disk)
+{
+	struct fstrim_fs *fs;
+	size_t i;
+
+	if (ctl->nfss % 32 == 0)
+		ctl->fss = xrealloc(ctl->fss,
+				(ctl->nfss + 32) * sizeof(struct fstrim_fs));
+	fs = &ctl->fss[ctl->nfss++];
+	memset(fs, 0, sizeof(*fs));
+	fs->target = xstrdup(tgt);
+	fs->source = xstrdup(src);
+	fs->disk = disk;
+
+	/* append to the group of the disk */
+	for (i = 0; i < ctl->ngroups; i++) {
+		struct fstrim_fs *x = &ctl->fss[ctl->groups[i] - 1];
+
+		if (x->disk != disk)
+			continue;
+		while (x->next)
+			x = &ctl->fss[x->next - 1];
+		x->next = ctl->nfss;
+		return;
+	}
+
+	if (ctl->ngroups % 32 == 0)
+		ctl->groups = xrealloc(ctl->groups,
+				(ctl->ngroups + 32) * sizeof(size_t));
+	ctl->groups[ctl->ngroups++] = ctl->nfss;
+}
+
+static void trim_one(struct fstrim_control *ctl, struct fstrim_fs *fs)
+{
+	struct timeval start, end, delta;
+
+	gettime_monotonic(&start);
+
+	/*
+	 * We're able to detect that the device supports discard, but
+	 * things also depend on filesystem or device mapping, for
+	 * example LUKS (by default) does not support FSTRIM.
+	 *
+	 * This is reason why we ignore EOPNOTSUPP and ENOTTY errors
+	 * from discard ioctl.
+	 */
+	fs->rc = fstrim_filesystem(ctl, fs->target, fs->source, &fs->trimmed);
+	if (fs->rc == 1 && !ctl->quiet_unsupp)
+		warnx(_("%s: the discard operation is not supported"), fs->target);
+
+	gettime_monotonic(&end);
+	timersub(&end, &start, &delta);
+	fs->duration = (uint64_t) delta.tv_sec * 1000000 + delta.tv_usec;
+}
+
+/* trim whole disk groups, filesystems on the same disk are trimmed serially */
+static void *trim_thread(void *data)
+{
+	struct fstrim_control *ctl = data;
+
+	for (;;) {
+		size_t i = __sync_fetch_and_add(&ctl->next_group, 1);
+		size_t n;
+
+		if (i >= ctl->ngroups)
+			break;
+		for (n = ctl->groups[i]; n; n = ctl->fss[n - 1].next)
+			trim_one(ctl, &ctl->fss[n - 1]);
+	}
+	return NULL;
+}
+
+static void trim_filesystems(struct fstrim_control *ctl)
+{
+	pthread_t threads[FSTRIM_MAX_PARALLEL];
+	size_t i, n = min(ctl->parallel, ctl->ngroups);
+
+	if (n <= 1) {
+		/* keep order of the mount table */
+		for (i = 0; i < ctl->nfss; i++)
+			trim_one(ctl, &ctl->fss[i]);
+		return;
+	}
+
+	ctl->next_group = 0;
+
+	/* the main thread is the first worker */
+	for (i = 1; i < n; i++) {
+		if (pthread_create(&threads[i], NULL, trim_thread, ctl) != 0) {
+			n = i;
+			break;
+		}
+	}
+	trim_thread(ctl);
+
+	for (i = 1; i < n; i++)
+		pthread_join(threads[i], NULL);
+}
+
+static void print_json_summary(struct fstrim_control *ctl)
+{
+	struct ul_jsonwrt json;
+	size_t i;
+
+	ul_jsonwrt_init(&json, stdout, 0);
+	ul_jsonwrt_root_open(&json);
+	ul_jsonwrt_array_open(&json, "filesystems");
+
+	for (i = 0; i < ctl->nfss; i++) {
+		struct fstrim_fs *fs = &ctl->fss[i];
+		char *duration, *disk;
+
+		xasprintf(&disk, "%u:%u", major(fs->disk), minor(fs->disk));
+		xasprintf(&duration, "%" PRIu64 ".%06" PRIu64,
+				fs->duration / 1000000, fs->duration % 1000000);
+
+		ul_jsonwrt_object_open(&json, NULL);
+		ul_jsonwrt_value_s(&json, "target", fs->target, 0);
+		ul_jsonwrt_value_s(&json, "source", fs->source, 0);
+		ul_jsonwrt_value_s(&json, "disk", disk, 0);
+		ul_jsonwrt_value_s(&json, "status",
+				fs->rc == 0 ? "ok" :
+				fs->rc == 1 ? "unsupported" : "failed", 0);
+		ul_jsonwrt_value_u64(&json, "trimmed", fs->trimmed, 0);
+		ul_jsonwrt_value_raw(&json, "duration", duration, 1);
+		ul_jsonwrt_object_close(&json, i + 1 == ctl->nfss);
+
+		free(duration);
+		free(disk);
+	}
+
+	ul_jsonwrt_array_close(&json, 1);
+	ul_jsonwrt_root_close(&json);
+}
+
 /*
  * -1 = tab empty
  *  0 = all success
@@ -243,6 +754,7 @@ static int fstrim_all_from_file(struct fstrim_control *ctl, const char *filename
 	struct path_cxt *wholedisk = NULL;
 	int cnt = 0, cnt_err = 0;
 	int fstab = 0;
+	size_t i;
 
 	tab = mnt_new_table_from_file(filename);
 	if (!tab)
@@ -315,15 +827,17 @@ static int fstrim_all_from_file(struct fstrim_control *ctl, const char *filename
 	}
 
 	/* de-duplicate by source */
-	mnt_table_uniq_fs(tab, MNT_UNIQ_FORWARD, uniq_fs_source_cmp);
+	if (uniq_fs_devno(tab) != 0)
+		mnt_table_uniq_fs(tab, MNT_UNIQ_FORWARD, uniq_fs_source_cmp);
 
 	mnt_reset_iter(itr, MNT_ITER_BACKWARD);
 
-	/* Do FITRIM */
+	/* Select filesystems to trim */
 	while (mnt_table_next_fs(tab, itr, &fs) == 0) {
 		const char *src = mnt_fs_get_srcpath(fs),
 			   *tgt = mnt_fs_get_target(fs);
 		char *path;
+		dev_t disk = 0;
 		int rc = 1;
 
 		/* Is it really accessible mountpoint? Not all mountpoints are
@@ -344,26 +858,34 @@ static int fstrim_all_from_file(struct fstrim_control *ctl, const char *filename
 		}
 
 		if (!is_directory(tgt, 1) ||
-		    !has_discard(src, &wholedisk))
+		    !has_discard(src, &wholedisk, &disk))
 			continue;
-		cnt++;
 
-		/*
-		 * We're able to detect that the device supports discard, but
-		 * things also depend on filesystem or device mapping, for
-		 * example LUKS (by default) does not support FSTRIM.
-		 *
-		 * This is reason why we ignore EOPNOTSUPP and ENOTTY errors
-		 * from discard ioctl.
-		 */
-		rc = fstrim_filesystem(ctl, tgt, src);
-		if (rc < 0)
-		       cnt_err++;
-		else if (rc == 1 && !ctl->quiet_unsupp)
-			warnx(_("%s: the discard operation is not supported"), tgt);
+		add_filesystem(ctl, tgt, src, disk);
 	}
 	mnt_free_iter(itr);
 
+	/* Do FITRIM */
+	trim_filesystems(ctl);
+
+	for (i = 0; i < ctl->nfss; i++) {
+		cnt++;
+		if (ctl->fss[i].rc < 0)
+			cnt_err++;
+	}
+	if (ctl->json)
+		print_json_summary(ctl);
+
+	for (i = 0; i < ctl->nfss; i++) {
+		free(ctl->fss[i].target);
+		free(ctl->fss[i].source);
+	}
+	free(ctl->fss);
+	free(ctl->groups);
+	ctl->fss = NULL;
+	ctl->groups = NULL;
+	ctl->nfss = ctl->ngroups = 0;
+
 	ul_unref_path(wholedisk);
 	mnt_unref_table(tab);
 	mnt_unref_cache(cache);
@@ -426,6 +948,12 @@ static void __attribute__((__noreturn__)) usage(void)
 	fputs(_(" -v, --verbose            print number of discarded bytes\n"), out);
 	fputs(_("     --quiet-unsupported  suppress error messages if trim unsupported\n"), out);
 	fputs(_(" -n, --dry-run            does everything, but trim\n"), out);
+	fputs(_(" -J, --json               print summary for --all in JSON format\n"), out);
+	fputs(_("     --parallel <num>     trim up to <num> whole disks at the same time\n"), out);
+	fputs(_("     --chunk <num>        trim in chunks of <num> bytes\n"), out);
+	fputs(_("     --rate <num>         limit trim rate to <num> bytes per second\n"), out);
+	fputs(_("     --max-latency <ms>   make chunks smaller if they take longer\n"), out);
+	fputs(_("     --resume <file>      save and restore trim position in the file\n"), out);
 
 	fputs(USAGE_SEPARATOR, out);
 	printf(USAGE_HELP_OPTIONS(21));
@@ -443,10 +971,16 @@ int main(int argc, char **argv)
 	char *tabs = NULL;
 	int c, rc, all = 0;
 	struct fstrim_control ctl = {
-			.range = { .len = ULLONG_MAX }
+			.range = { .len = ULLONG_MAX },
+			.parallel = 1
 	};
 	enum {
-		OPT_QUIET_UNSUPP = CHAR_MAX + 1
+		OPT_QUIET_UNSUPP = CHAR_MAX + 1,
+		OPT_PARALLEL,
+		OPT_CHUNK,
+		OPT_RATE,
+		OPT_MAX_LATENCY,
+		OPT_RESUME
 	};
 
 	static const struct option longopts[] = {
@@ -461,6 +995,12 @@ int main(int argc, char **argv)
 	    { "verbose",   no_argument,       NULL, 'v' },
 	    { "quiet-unsupported", no_argument,       NULL, OPT_QUIET_UNSUPP },
 	    { "dry-run",   no_argument,       NULL, 'n' },
+	    { "json",      no_argument,       NULL, 'J' },
+	    { "parallel",  required_argument, NULL, OPT_PARALLEL },
+	    { "chunk",     required_argument, NULL, OPT_CHUNK },
+	    { "rate",      required_argument, NULL, OPT_RATE },
+	    { "max-latency", required_argument, NULL, OPT_MAX_LATENCY },
+	    { "resume",    required_argument, NULL, OPT_RESUME },
 	    { NULL, 0, NULL, 0 }
 	};
 
@@ -475,7 +1015,7 @@ int main(int argc, char **argv)
 	textdomain(PACKAGE);
 	close_stdout_atexit();
 
-	while ((c = getopt_long(argc, argv, "AahI:l:m:no:Vv", longopts, NULL)) != -1) {
+	while ((c = getopt_long(argc, argv, "AahI:Jl:m:no:Vv", longopts, NULL)) != -1) {
 
 		err_exclusive_options(c, longopts, excl, excl_st);
 
@@ -513,6 +1053,33 @@ int main(int argc, char **argv)
 		case OPT_QUIET_UNSUPP:
 			ctl.quiet_unsupp = 1;
 			break;
+		case 'J':
+			ctl.json = 1;
+			break;
+		case OPT_PARALLEL:
+			ctl.parallel = strtou32_or_err(optarg,
+					_("failed to parse parallel"));
+			if (ctl.parallel < 1 || ctl.parallel > FSTRIM_MAX_PARALLEL)
+				errx(EXIT_FAILURE, _("parallel must be in range 1-%d"),
+						FSTRIM_MAX_PARALLEL);
+			break;
+		case OPT_CHUNK:
+			ctl.chunk = strtosize_or_err(optarg,
+					_("failed to parse chunk size"));
+			if (!ctl.chunk)
+				errx(EXIT_FAILURE, _("chunk size must be greater than zero"));
+			break;
+		case OPT_RATE:
+			ctl.rate = strtosize_or_err(optarg,
+					_("failed to parse rate"));
+			break;
+		case OPT_MAX_LATENCY:
+			ctl.max_latency = strtou64_or_err(optarg,
+					_("failed to parse max latency")) * 1000;
+			break;
+		case OPT_RESUME:
+			ctl.resume = optarg;
+			break;
 		case 'h':
 			usage();
 		case 'V':
@@ -533,15 +1100,27 @@ int main(int argc, char **argv)
 		errtryhelp(EXIT_FAILURE);
 	}
 
-	if (all)
-		return fstrim_all(&ctl, tabs);	/* MNT_EX_* codes */
+	if (!all && (ctl.json || ctl.parallel > 1))
+		errx(EXIT_FAILURE, _("--json and --parallel are supported with --all, --fstab or --listed-in only"));
 
-	if (!is_directory(path, 0))
-		return EXIT_FAILURE;
+	if (!ctl.chunk && (ctl.rate || ctl.max_latency || ctl.resume))
+		ctl.chunk = FSTRIM_DEFAULT_CHUNK;
+	if (ctl.resume) {
+		pthread_mutex_init(&ctl.lock, NULL);
+		load_cursors(&ctl);
+	}
 
-	rc = fstrim_filesystem(&ctl, path, NULL);
-	if (rc == 1 && !ctl.quiet_unsupp)
-		warnx(_("%s: the discard operation is not supported"), path);
+	if (all)
+		rc = fstrim_all(&ctl, tabs);	/* MNT_EX_* codes */
+	else if (!is_directory(path, 0))
+		rc = EXIT_FAILURE;
+	else {
+		rc = fstrim_filesystem(&ctl, path, NULL, NULL);
+		if (rc == 1 && !ctl.quiet_unsupp)
+			warnx(_("%s: the discard operation is not supported"), path);
+		rc = rc == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+	}
 
-	return rc == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+	free_cursors(&ctl);
+	return rc;
 }
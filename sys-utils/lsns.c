@@ -26,6 +26,8 @@
 #include <unistd.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <fcntl.h>
+#include <pthread.h>
 #include <wchar.h>
 #include <libsmartcols.h>
 #include <libmount.h>
@@ -144,6 +146,8 @@ struct lsns_namespace {
 
 	struct list_head namespaces;	/* lsns->processes member */
 	struct list_head processes;	/* head of lsns_process *siblings */
+
+	struct lsns_namespace *hnext;	/* next in lsns->ns_hash bucket */
 };
 
 struct lsns_process {
@@ -161,13 +165,27 @@ struct lsns_process {
 	struct libscols_line *outline;
 	struct lsns_process *parent;
 
+	struct lsns_process *hnext;	/* next in lsns->proc_hash bucket */
+
 	int netnsid;
 };
 
+/* open hash tables, both grow to keep less than one entry per bucket */
+struct lsns_hash {
+	void	**buckets;
+	size_t	size;
+	size_t	nents;
+};
+
 struct lsns {
 	struct list_head processes;
 	struct list_head namespaces;
 
+	struct lsns_hash ns_hash;	/* namespaces by inode */
+	struct lsns_hash proc_hash;	/* processes by PID */
+
+	int	procfd;		/* /proc directory */
+
 	pid_t	fltr_pid;	/* filter out by PID */
 	ino_t	fltr_ns;	/* filter out by namespace */
 	int	fltr_types[ARRAY_SIZE(ns_names)];
@@ -184,14 +202,6 @@ struct lsns {
 	struct libmnt_table *tab;
 };
 
-struct netnsid_cache {
-	ino_t ino;
-	int   id;
-	struct list_head netnsids;
-};
-
-static struct list_head netnsids_cache;
-
 static int netlink_fd = -1;
 
 static void lsns_init_debug(void)
@@ -290,34 +300,6 @@ error:
 }
 
 #ifdef HAVE_LINUX_NET_NAMESPACE_H
-static int netnsid_cache_find(ino_t netino, int *netnsid)
-{
-	struct list_head *p;
-
-	list_for_each(p, &netnsids_cache) {
-		struct netnsid_cache *e = list_entry(p,
-						     struct netnsid_cache,
-						     netnsids);
-		if (e->ino == netino) {
-			*netnsid = e->id;
-			return 1;
-		}
-	}
-
-	return 0;
-}
-
-static void netnsid_cache_add(ino_t netino, int netnsid)
-{
-	struct netnsid_cache *e;
-
-	e = xcalloc(1, sizeof(*e));
-	e->ino = netino;
-	e->id  = netnsid;
-	INIT_LIST_HEAD(&e->netnsids);
-	list_add(&e->netnsids, &netnsids_cache);
-}
-
 static int get_netnsid_via_netlink_send_request(int target_fd)
 {
 	unsigned char req[NLMSG_SPACE(sizeof(struct rtgenmsg))
@@ -402,57 +384,136 @@ static int get_netnsid_via_netlink(int dir, const char *path)
 	return netnsid;
 }
 
-static int get_netnsid(int dir, ino_t netino)
+/* called once for each network namespace, see add_namespace() */
+static int get_netnsid(int procfd, pid_t pid)
 {
-	int netnsid;
-
-	if (!netnsid_cache_find(netino, &netnsid)) {
-		netnsid = get_netnsid_via_netlink(dir, "ns/net");
-		netnsid_cache_add(netino, netnsid);
-	}
+	char path[sizeof("/ns/net") + sizeof(stringify_value(INT_MAX))];
 
-	return netnsid;
+	snprintf(path, sizeof(path), "%d/ns/net", (int) pid);
+	return get_netnsid_via_netlink(procfd, path);
 }
 #else
-static int get_netnsid(int dir __attribute__((__unused__)),
-		       ino_t netino __attribute__((__unused__)))
+static int get_netnsid(int procfd __attribute__((__unused__)),
+		       pid_t pid __attribute__((__unused__)))
 {
 	return LSNS_NETNS_UNUSABLE;
 }
 #endif /* HAVE_LINUX_NET_NAMESPACE_H */
 
-static int read_process(struct lsns *ls, pid_t pid)
+static inline size_t lsns_hash_slot(struct lsns_hash *h, uintmax_t key)
+{
+	return key % h->size;
+}
+
+#define LSNS_HASH_MIN	256
+
+/*
+ * Insert @ent with @key; @next_of returns pointer to the "hnext" member and
+ * @key_of returns key of an entry (used to rehash).
+ */
+static void lsns_hash_add(struct lsns_hash *h, void *ent, uintmax_t key,
+			  void **(*next_of)(void *),
+			  uintmax_t (*key_of)(void *))
+{
+	size_t i;
+
+	if (h->nents + 1 > h->size) {
+		size_t sz = h->size ? h->size * 2 : LSNS_HASH_MIN;
+		void **buckets = xcalloc(sz, sizeof(void *));
+
+		for (i = 0; i < h->size; i++) {
+			void *e = h->buckets[i];
+
+			while (e) {
+				void *next = *next_of(e);
+				size_t x = key_of(e) % sz;
+
+				*next_of(e) = buckets[x];
+				buckets[x] = e;
+				e = next;
+			}
+		}
+		free(h->buckets);
+		h->buckets = buckets;
+		h->size = sz;
+	}
+
+	i = lsns_hash_slot(h, key);
+	*next_of(ent) = h->buckets[i];
+	h->buckets[i] = ent;
+	h->nents++;
+}
+
+static void **ns_next(void *e)
+{
+	return (void **) &((struct lsns_namespace *) e)->hnext;
+}
+
+static uintmax_t ns_key(void *e)
+{
+	return ((struct lsns_namespace *) e)->id;
+}
+
+static void **proc_next(void *e)
+{
+	return (void **) &((struct lsns_process *) e)->hnext;
+}
+
+static uintmax_t proc_key(void *e)
+{
+	return ((struct lsns_process *) e)->pid;
+}
+
+static struct lsns_process *get_process(struct lsns *ls, pid_t pid)
+{
+	struct lsns_process *proc;
+
+	if (!ls->proc_hash.size)
+		return NULL;
+
+	proc = ls->proc_hash.buckets[lsns_hash_slot(&ls->proc_hash, pid)];
+	for (; proc; proc = proc->hnext) {
+		if (proc->pid == pid)
+			return proc;
+	}
+	return NULL;
+}
+
+/*
+ * Read /proc/<pid>; may be called from more threads at the same time, so
+ * the result is only stored to @res and the caller adds it to @ls.
+ */
+static int read_process(struct lsns *ls, pid_t pid, struct lsns_process **res)
 {
 	struct lsns_process *p = NULL;
-	char buf[BUFSIZ];
-	DIR *dir;
-	int rc = 0, fd;
+	char buf[sizeof(stringify_value(INT_MAX))];
+	int rc = 0, dir, fd;
 	FILE *f = NULL;
 	size_t i;
 	struct stat st;
 
 	DBG(PROC, ul_debug("reading %d", (int) pid));
 
-	snprintf(buf, sizeof(buf), "/proc/%d", pid);
-	dir = opendir(buf);
-	if (!dir)
+	snprintf(buf, sizeof(buf), "%d", (int) pid);
+	dir = openat(ls->procfd, buf, O_RDONLY|O_DIRECTORY|O_CLOEXEC);
+	if (dir < 0)
 		return -errno;
 
 	p = xcalloc(1, sizeof(*p));
 	p->netnsid = LSNS_NETNS_UNUSABLE;
+	p->uid = (uid_t) -1;
 
-	if (fstat(dirfd(dir), &st) == 0) {
+	if (fstat(dir, &st) == 0)
 		p->uid = st.st_uid;
-		add_uid(uid_cache, st.st_uid);
-	}
 
-	fd = openat(dirfd(dir), "stat", O_RDONLY);
+	fd = openat(dir, "stat", O_RDONLY|O_CLOEXEC);
 	if (fd < 0) {
 		rc = -errno;
 		goto done;
 	}
 	if (!(f = fdopen(fd, "r"))) {
 		rc = -errno;
+		close(fd);
 		goto done;
 	}
 	rc = parse_proc_stat(f, &p->pid, &p->state, &p->ppid);
@@ -466,79 +527,167 @@ static int read_process(struct lsns *ls, pid_t pid)
 		if (!ls->fltr_types[i])
 			continue;
 
-		rc = get_ns_ino(dirfd(dir), ns_names[i], &p->ns_ids[i]);
+		rc = get_ns_ino(dir, ns_names[i], &p->ns_ids[i]);
 		if (rc && rc != -EACCES && rc != -ENOENT)
 			goto done;
-		if (i == LSNS_ID_NET)
-			p->netnsid = get_netnsid(dirfd(dir), p->ns_ids[i]);
 		rc = 0;
 	}
 
 	INIT_LIST_HEAD(&p->processes);
-
-	DBG(PROC, ul_debugobj(p, "new pid=%d", p->pid));
-	list_add_tail(&p->processes, &ls->processes);
 done:
 	if (f)
 		fclose(f);
-	closedir(dir);
+	close(dir);
 	if (rc)
 		free(p);
+	else
+		*res = p;
 	return rc;
 }
 
+#define LSNS_MAX_THREADS	16
+#define LSNS_PIDS_PER_THREAD	256
+
+struct lsns_reader {
+	struct lsns		*ls;
+	pid_t			*pids;
+	struct lsns_process	**procs;
+	int			*rcs;
+	size_t			npids;
+	size_t			first;	/* the thread reads first, first + nthreads, ... */
+	size_t			step;
+	pthread_t		thread;
+};
+
+static void *reader_thread(void *data)
+{
+	struct lsns_reader *rd = data;
+	size_t i;
+
+	for (i = rd->first; i < rd->npids; i += rd->step)
+		rd->rcs[i] = read_process(rd->ls, rd->pids[i], &rd->procs[i]);
+	return NULL;
+}
+
 static int read_processes(struct lsns *ls)
 {
 	struct proc_processes *proc = NULL;
-	pid_t pid;
-	int rc = 0;
+	struct lsns_reader *rds = NULL;
+	struct lsns_process **procs = NULL;
+	struct list_head *p;
+	pid_t pid, *pids = NULL;
+	int *rcs = NULL, rc = 0;
+	size_t i, npids = 0, nthreads = 1;
+	long ncpus;
 
 	DBG(PROC, ul_debug("opening /proc"));
 
-	if (!(proc = proc_open_processes())) {
+	ls->procfd = open("/proc", O_RDONLY|O_DIRECTORY|O_CLOEXEC);
+	if (ls->procfd < 0 || !(proc = proc_open_processes())) {
 		rc = -errno;
 		goto done;
 	}
 
 	while (proc_next_pid(proc, &pid) == 0) {
-		rc = read_process(ls, pid);
+		if (npids % 1024 == 0)
+			pids = xrealloc(pids, (npids + 1024) * sizeof(pid_t));
+		pids[npids++] = pid;
+	}
+
+	procs = xcalloc(npids ? npids : 1, sizeof(struct lsns_process *));
+	rcs = xcalloc(npids ? npids : 1, sizeof(int));
+
+	ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+	if (ncpus > 1)
+		nthreads = min((size_t) ncpus, (size_t) LSNS_MAX_THREADS);
+	nthreads = min(nthreads, npids / LSNS_PIDS_PER_THREAD + 1);
+
+	DBG(PROC, ul_debug("reading %zu processes by %zu threads", npids, nthreads));
+
+	rds = xcalloc(nthreads, sizeof(*rds));
+	for (i = 0; i < nthreads; i++) {
+		struct lsns_reader *rd = &rds[i];
+
+		rd->ls = ls;
+		rd->pids = pids;
+		rd->procs = procs;
+		rd->rcs = rcs;
+		rd->npids = npids;
+		rd->first = i;
+		rd->step = nthreads;
+
+		/* the first reader runs in the main thread */
+		if (i && pthread_create(&rd->thread, NULL, reader_thread, rd) != 0)
+			err(EXIT_FAILURE, _("failed to create thread"));
+	}
+	reader_thread(&rds[0]);
+	for (i = 1; i < nthreads; i++)
+		pthread_join(rds[i].thread, NULL);
+
+	/* add to the list in the same order as /proc is read */
+	for (i = 0; i < npids; i++) {
+		struct lsns_process *xp = procs[i];
+
+		rc = rcs[i];
 		if (rc && rc != -EACCES && rc != -ENOENT)
 			break;
 		rc = 0;
+		if (!xp)
+			continue;
+		procs[i] = NULL;
+
+		if (xp->uid != (uid_t) -1)
+			add_uid(uid_cache, xp->uid);
+		else
+			xp->uid = 0;
+
+		DBG(PROC, ul_debugobj(xp, "new pid=%d", xp->pid));
+		list_add_tail(&xp->processes, &ls->processes);
+		lsns_hash_add(&ls->proc_hash, xp, xp->pid, proc_next, proc_key);
+	}
+
+	/* parent<->child relation */
+	list_for_each(p, &ls->processes) {
+		struct lsns_process *xp = list_entry(p, struct lsns_process, processes);
+
+		xp->parent = get_process(ls, xp->ppid);
 	}
 done:
 	DBG(PROC, ul_debug("closing /proc"));
 	proc_close_processes(proc);
+	for (i = 0; procs && i < npids; i++)
+		free(procs[i]);
+	free(procs);
+	free(rcs);
+	free(pids);
+	free(rds);
 	return rc;
 }
 
 static struct lsns_namespace *get_namespace(struct lsns *ls, ino_t ino)
 {
-	struct list_head *p;
+	struct lsns_namespace *ns;
 
-	list_for_each(p, &ls->namespaces) {
-		struct lsns_namespace *ns = list_entry(p, struct lsns_namespace, namespaces);
+	if (!ls->ns_hash.size)
+		return NULL;
 
+	ns = ls->ns_hash.buckets[lsns_hash_slot(&ls->ns_hash, ino)];
+	for (; ns; ns = ns->hnext) {
 		if (ns->id == ino)
 			return ns;
 	}
 	return NULL;
 }
 
-static int namespace_has_process(struct lsns_namespace *ns, pid_t pid)
+static int namespace_has_process(struct lsns *ls, struct lsns_namespace *ns, pid_t pid)
 {
-	struct list_head *p;
-
-	list_for_each(p, &ns->processes) {
-		struct lsns_process *proc = list_entry(p, struct lsns_process, ns_siblings[ns->type]);
+	struct lsns_process *proc = get_process(ls, pid);
 
-		if (proc->pid == pid)
-			return 1;
-	}
-	return 0;
+	return proc && proc->ns_ids[ns->type] == ns->id;
 }
 
-static struct lsns_namespace *add_namespace(struct lsns *ls, int type, ino_t ino)
+static struct lsns_namespace *add_namespace(struct lsns *ls, int type, ino_t ino,
+					    pid_t pid)
 {
 	struct lsns_namespace *ns = xcalloc(1, sizeof(*ns));
 
@@ -552,26 +701,24 @@ static struct lsns_namespace *add_namespace(struct lsns *ls, int type, ino_t ino
 
 	ns->type = type;
 	ns->id = ino;
+	ns->netnsid = LSNS_NETNS_UNUSABLE;
+
+	/* the same for all processes in the namespace */
+	if (type == LSNS_ID_NET)
+		ns->netnsid = get_netnsid(ls->procfd, pid);
 
 	list_add_tail(&ns->namespaces, &ls->namespaces);
+	lsns_hash_add(&ls->ns_hash, ns, ino, ns_next, ns_key);
 	return ns;
 }
 
-static int add_process_to_namespace(struct lsns *ls, struct lsns_namespace *ns, struct lsns_process *proc)
+static int add_process_to_namespace(struct lsns_namespace *ns, struct lsns_process *proc)
 {
-	struct list_head *p;
-
 	DBG(NS, ul_debugobj(ns, "add process [%p] pid=%d to %s[%ju]",
 		proc, proc->pid, ns_names[ns->type], (uintmax_t)ns->id));
 
-	list_for_each(p, &ls->processes) {
-		struct lsns_process *xproc = list_entry(p, struct lsns_process, processes);
-
-		if (xproc->pid == proc->ppid)		/* my parent */
-			proc->parent = xproc;
-		else if (xproc->ppid == proc->pid)	/* my child */
-			xproc->parent = proc;
-	}
+	if (ns->type == LSNS_ID_NET)
+		proc->netnsid = ns->netnsid;
 
 	list_add_tail(&proc->ns_siblings[ns->type], &ns->processes);
 	ns->nprocs++;
@@ -617,11 +764,11 @@ static int read_namespaces(struct lsns *ls)
 			if (proc->ns_ids[i] == 0)
 				continue;
 			if (!(ns = get_namespace(ls, proc->ns_ids[i]))) {
-				ns = add_namespace(ls, i, proc->ns_ids[i]);
+				ns = add_namespace(ls, i, proc->ns_ids[i], proc->pid);
 				if (!ns)
 					return -ENOMEM;
 			}
-			add_process_to_namespace(ls, ns, proc);
+			add_process_to_namespace(ns, proc);
 		}
 	}
 
@@ -838,7 +985,7 @@ static int show_namespaces(struct lsns *ls)
 	list_for_each(p, &ls->namespaces) {
 		struct lsns_namespace *ns = list_entry(p, struct lsns_namespace, namespaces);
 
-		if (ls->fltr_pid != 0 && !namespace_has_process(ns, ls->fltr_pid))
+		if (ls->fltr_pid != 0 && !namespace_has_process(ls, ns, ls->fltr_pid))
 			continue;
 
 		add_scols_line(ls, tab, ns, ns->proc);
@@ -968,7 +1115,7 @@ int main(int argc, char *argv[])
 
 	INIT_LIST_HEAD(&ls.processes);
 	INIT_LIST_HEAD(&ls.namespaces);
-	INIT_LIST_HEAD(&netnsids_cache);
+	ls.procfd = -1;
 
 	while ((c = getopt_long(argc, argv,
 				"Jlp:o:nruhVt:W", long_opts, NULL)) != -1) {
@@ -1094,6 +1241,10 @@ int main(int argc, char *argv[])
 	}
 
 	mnt_free_table(ls.tab);
+	free(ls.ns_hash.buckets);
+	free(ls.proc_hash.buckets);
+	if (ls.procfd >= 0)
+		close(ls.procfd);
 	if (netlink_fd >= 0)
 		close(netlink_fd);
 	free_idcache(uid_cache);
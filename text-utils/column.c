@@ -80,14 +80,19 @@ struct column_control {
 	const char *tab_colnoextrem;	/* --table-noextreme */
 	const char *tab_colwrap;	/* --table-wrap */
 	const char *tab_colhide;	/* --table-hide */
+	const char *tab_colwidths;	/* --table-widths */
 
 	const char *tree;
 	const char *tree_id;
 	const char *tree_parent;
 
 	wchar_t *input_separator;
+	const char *input_separator_ascii;	/* the same, or NULL if not ASCII */
 	const char *output_separator;
 
+	size_t	stream_sample;	/* --table-stream: lines to calculate widths */
+	size_t	stream_nlines;	/* --table-stream: lines since the last header */
+
 	wchar_t	**ents;		/* input entries */
 	size_t	nents;		/* number of entries */
 	size_t	maxlength;	/* longest input record (line) */
@@ -97,7 +102,9 @@ struct column_control {
 		     json :1,
 		     header_repeat :1,
 		     keep_empty_lines :1,	/* --keep-empty-lines */
-		     tab_noheadings :1;
+		     tab_noheadings :1,
+		     stream :1,			/* --table-stream */
+		     stream_started :1;		/* sample window printed */
 };
 
 static size_t width(const wchar_t *str)
@@ -190,6 +197,41 @@ static wchar_t *local_wcstok(struct column_control const *const ctl, wchar_t *p,
 	return result;
 }
 
+static int is_ascii(const char *str)
+{
+	for (; *str; str++) {
+		if (*str & 0x80)
+			return 0;
+	}
+	return 1;
+}
+
+#ifdef HAVE_WIDECHAR
+/* the same as local_wcstok(), but for ASCII lines */
+static char *local_strtok(struct column_control const *const ctl, char *p,
+			  char **state)
+{
+	char *result = NULL;
+
+	if (ctl->greedy)
+		return strtok_r(p, ctl->input_separator_ascii, state);
+	if (!p) {
+		if (!*state)
+			return NULL;
+		p = *state;
+	}
+	result = p;
+	p = strpbrk(result, ctl->input_separator_ascii);
+	if (!p)
+		*state = NULL;
+	else {
+		*p = '\0';
+		*state = p + 1;
+	}
+	return result;
+}
+#endif
+
 static char **split_or_error(const char *str, const char *errmsg)
 {
 	char **res = strv_split(str, ",");
@@ -388,6 +430,27 @@ static void create_tree(struct column_control *ctl)
 	scols_free_iter(itr_i);
 }
 
+static void apply_columnwidths(struct column_control *ctl)
+{
+	char **all = split_or_error(ctl->tab_colwidths, _("failed to parse --table-widths list"));
+	char **one;
+	size_t n = 0;
+
+	STRV_FOREACH(one, all) {
+		struct libscols_column *cl = scols_table_get_column(ctl->tab, n++);
+		uint32_t w;
+
+		if (!cl)
+			break;
+		if (strcmp(*one, "-") == 0)
+			continue;
+		w = strtou32_or_err(*one, _("failed to parse --table-widths list"));
+		if (w)
+			scols_column_set_whint(cl, w);
+	}
+	strv_free(all);
+}
+
 static void modify_table(struct column_control *ctl)
 {
 	scols_table_set_termwidth(ctl->tab, ctl->termwidth);
@@ -413,6 +476,9 @@ static void modify_table(struct column_control *ctl)
 		apply_columnflag_from_list(ctl, ctl->tab_colhide,
 				SCOLS_FL_HIDDEN , _("failed to parse --table-hide list"));
 
+	if (ctl->tab_colwidths)
+		apply_columnwidths(ctl);
+
 	if (!ctl->tab_colnoextrem) {
 		struct libscols_column *cl = get_last_visible_column(ctl);
 		if (cl)
@@ -476,6 +542,115 @@ static int add_line_to_table(struct column_control *ctl, wchar_t *wcs0)
 	return 0;
 }
 
+#ifdef HAVE_WIDECHAR
+/*
+ * The same as add_line_to_table(), but for ASCII lines and separators. The
+ * conversion to wide chars and back is unnecessary in this case.
+ */
+static int add_asciiline_to_table(struct column_control *ctl, char *str0)
+{
+	char *data, *sv = NULL, *str = str0;
+	size_t n = 0, nchars = 0;
+	struct libscols_line *ln = NULL;
+
+	if (!ctl->tab)
+		init_table(ctl);
+	do {
+		if (ctl->maxncols && n + 1 == ctl->maxncols)
+			data = str0 + nchars;
+		else
+			data = local_strtok(ctl, str, &sv);
+
+		if (!data)
+			break;
+		if (scols_table_get_ncols(ctl->tab) < n + 1) {
+			if (scols_table_is_json(ctl->tab))
+				errx(EXIT_FAILURE, _("line %zu: for JSON the name of the "
+					"column %zu is required"),
+					scols_table_get_nlines(ctl->tab) + 1,
+					n + 1);
+			scols_table_new_column(ctl->tab, NULL, 0, 0);
+		}
+		if (!ln) {
+			ln = scols_table_new_line(ctl->tab, NULL);
+			if (!ln)
+				err(EXIT_FAILURE, _("failed to allocate output line"));
+		}
+
+		nchars += strlen(data) + 1;
+
+		if (scols_line_set_data(ln, n, data))
+			err(EXIT_FAILURE, _("failed to add output data"));
+		n++;
+		str = NULL;
+		if (ctl->maxncols && n == ctl->maxncols)
+			break;
+	} while (1);
+
+	return 0;
+}
+#endif
+
+/*
+ * Print the table lines and remove them from the table. The column widths
+ * are calculated from the first --table-stream lines and then used as
+ * minimal widths for all the next lines.
+ */
+static int stream_table(struct column_control *ctl)
+{
+	struct libscols_iter *itr;
+	struct libscols_column *cl;
+	size_t nlines, height;
+	int rc;
+
+	if (!ctl->tab)
+		return 0;
+
+	nlines = scols_table_get_nlines(ctl->tab);
+	height = scols_table_get_termheight(ctl->tab);
+
+	/* libsmartcols prints the header before every printed range if
+	 * header repeat is enabled, so enable it only at the begin of the
+	 * next page */
+	if (!ctl->stream_started) {
+		if (nlines < ctl->stream_sample)
+			return 0;
+		modify_table(ctl);
+		scols_table_enable_header_repeat(ctl->tab, 0);
+
+	} else if (ctl->header_repeat) {
+		int header = ctl->stream_nlines + 1 >= height;
+
+		scols_table_enable_header_repeat(ctl->tab, header);
+		if (header)
+			ctl->stream_nlines = 0;
+	}
+
+	rc = scols_table_print_range(ctl->tab, NULL, NULL);
+	if (rc == 0)
+		fputc('\n', stdout);
+	scols_table_remove_lines(ctl->tab);
+
+	ctl->stream_nlines += nlines;
+	if (ctl->stream_started)
+		return rc;
+
+	/* freeze widths calculated from the sample window */
+	itr = scols_new_iter(SCOLS_ITER_FORWARD);
+	if (!itr)
+		err_oom();
+	while (scols_table_next_column(ctl->tab, itr, &cl) == 0) {
+		size_t w = scols_column_get_width(cl);
+
+		if (w && scols_column_get_whint(cl) < w)
+			scols_column_set_whint(cl, w);
+	}
+	scols_free_iter(itr);
+
+	ctl->stream_started = 1;
+	return rc;
+}
+
 static int add_emptyline_to_table(struct column_control *ctl)
 {
 	if (!ctl->tab)
@@ -526,6 +701,8 @@ static int read_input(struct column_control *ctl, FILE *fp)
 			if (ctl->keep_empty_lines) {
 				if (ctl->mode == COLUMN_MODE_TABLE) {
 					add_emptyline_to_table(ctl);
+					if (ctl->stream)
+						rc = stream_table(ctl);
 				} else {
 					if (!empty)
 						empty = mbs_to_wcs("");
@@ -535,6 +712,15 @@ static int read_input(struct column_control *ctl, FILE *fp)
 			continue;
 		}
 
+#ifdef HAVE_WIDECHAR
+		if (ctl->mode == COLUMN_MODE_TABLE && ctl->input_separator_ascii
+		    && is_ascii(buf)) {
+			rc = add_asciiline_to_table(ctl, buf);
+			if (rc == 0 && ctl->stream)
+				rc = stream_table(ctl);
+			continue;
+		}
+#endif
 		wcs = mbs_to_wcs(buf);
 		if (!wcs) {
 			/*
@@ -553,6 +739,8 @@ static int read_input(struct column_control *ctl, FILE *fp)
 		case COLUMN_MODE_TABLE:
 			rc = add_line_to_table(ctl, wcs);
 			free(wcs);
+			if (rc == 0 && ctl->stream)
+				rc = stream_table(ctl);
 			break;
 
 		case COLUMN_MODE_FILLCOLS:
@@ -664,6 +852,8 @@ static void __attribute__((__noreturn__)) usage(void)
 	fputs(_(" -R, --table-right <columns>      right align text in these columns\n"), out);
 	fputs(_(" -T, --table-truncate <columns>   truncate text in the columns when necessary\n"), out);
 	fputs(_(" -W, --table-wrap <columns>       wrap text in the columns when necessary\n"), out);
+	fputs(_("     --table-widths <list>        comma separated minimal columns widths\n"), out);
+	fputs(_(" -S, --table-stream <lines>       print table continuously, use <lines> to calculate widths\n"), out);
 	fputs(_(" -L, --keep-empty-lines           don't ignore empty lines\n"), out);
 	fputs(_(" -J, --json                       use JSON output format for table\n"), out);
 
@@ -696,6 +886,9 @@ int main(int argc, char **argv)
 
 	int c;
 	unsigned int eval = 0;		/* exit value */
+	enum {
+		OPT_TABLE_WIDTHS = CHAR_MAX + 1
+	};
 
 	static const struct option longopts[] =
 	{
@@ -716,7 +909,9 @@ int main(int argc, char **argv)
 		{ "table-noheadings",    no_argument,       NULL, 'd' },
 		{ "table-order",         required_argument, NULL, 'O' },
 		{ "table-right",         required_argument, NULL, 'R' },
+		{ "table-stream",        required_argument, NULL, 'S' },
 		{ "table-truncate",      required_argument, NULL, 'T' },
+		{ "table-widths",        required_argument, NULL, OPT_TABLE_WIDTHS },
 		{ "table-wrap",          required_argument, NULL, 'W' },
 		{ "table-empty-lines",   no_argument,       NULL, 'L' }, /* deprecated */
 		{ "table-header-repeat", no_argument,       NULL, 'e' },
@@ -727,7 +922,10 @@ int main(int argc, char **argv)
 		{ NULL,	0, NULL, 0 },
 	};
 	static const ul_excl_t excl[] = {       /* rows and cols in ASCII order */
+		{ 'J','S' },
 		{ 'J','x' },
+		{ 'S','r' },
+		{ 'S','x' },
 		{ 't','x' },
 		{ 0 }
 	};
@@ -740,8 +938,9 @@ int main(int argc, char **argv)
 
 	ctl.output_separator = "  ";
 	ctl.input_separator = mbs_to_wcs("\t ");
+	ctl.input_separator_ascii = "\t ";
 
-	while ((c = getopt_long(argc, argv, "c:dE:eH:hi:Jl:LN:n:O:o:p:R:r:s:T:tVW:x", longopts, NULL)) != -1) {
+	while ((c = getopt_long(argc, argv, "c:dE:eH:hi:Jl:LN:n:O:o:p:R:r:S:s:T:tVW:x", longopts, NULL)) != -1) {
 
 		err_exclusive_options(c, longopts, excl, excl_st);
 
@@ -797,9 +996,15 @@ int main(int argc, char **argv)
 		case 'r':
 			ctl.tree = optarg;
 			break;
+		case 'S':
+			ctl.stream_sample = strtou32_or_err(optarg, _("invalid stream lines argument"));
+			ctl.stream = 1;
+			ctl.mode = COLUMN_MODE_TABLE;
+			break;
 		case 's':
 			free(ctl.input_separator);
 			ctl.input_separator = mbs_to_wcs(optarg);
+			ctl.input_separator_ascii = is_ascii(optarg) ? optarg : NULL;
 			ctl.greedy = 0;
 			break;
 		case 'T':
@@ -811,6 +1016,9 @@ int main(int argc, char **argv)
 		case 'W':
 			ctl.tab_colwrap = optarg;
 			break;
+		case OPT_TABLE_WIDTHS:
+			ctl.tab_colwidths = optarg;
+			break;
 		case 'x':
 			ctl.mode = COLUMN_MODE_FILLROWS;
 			break;
@@ -839,7 +1047,7 @@ int main(int argc, char **argv)
 	if (ctl.mode != COLUMN_MODE_TABLE
 	    && (ctl.tab_order || ctl.tab_name || ctl.tab_colwrap ||
 		ctl.tab_colhide || ctl.tab_coltrunc || ctl.tab_colnoextrem ||
-		ctl.tab_colright || ctl.tab_colnames))
+		ctl.tab_colright || ctl.tab_colnames || ctl.tab_colwidths))
 		errx(EXIT_FAILURE, _("option --table required for all --table-*"));
 
 	if (ctl.tab_colnames == NULL && ctl.json)
@@ -870,7 +1078,10 @@ int main(int argc, char **argv)
 	switch (ctl.mode) {
 	case COLUMN_MODE_TABLE:
 		if (ctl.tab && scols_table_get_nlines(ctl.tab)) {
-			modify_table(&ctl);
+			/* the rest of the lines (or all lines) for --table-stream
+			 * is smaller than the sample window */
+			if (!ctl.stream_started)
+				modify_table(&ctl);
 			eval = scols_print_table(ctl.tab);
 		}
 		break;